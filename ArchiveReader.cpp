@@ -0,0 +1,379 @@
+#include <iostream>
+#include <algorithm>
+#include <cstdlib>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <mutex>
+#include <vector>
+#include <ArchiveReader.h>
+#include <BufferPool.h>
+#ifdef BVPM_ENABLE_ZSTD
+#include <zstd.h>
+#include <SeekableZstd.h>
+#include <ZstdDictionary.h>
+#endif
+
+static constexpr size_t mmap_min_size = 1024 * 1024;
+static constexpr size_t hugepage_min_size = 2 * 1024 * 1024;
+static constexpr size_t buffer_size = 1024 * 1024;
+static constexpr size_t libarchive_block_size = 64 * 1024;
+
+namespace {
+/// Everything the callbacks need; owned by libarchive from archive_read_open() on, and freed in closeSource()
+struct Source {
+    int fd = -1;
+    uint64_t size = 0;
+    uint64_t position = 0;
+    const char* map = nullptr;
+    PooledBuffer buffer;
+#ifdef BVPM_ENABLE_ZSTD
+    std::unique_ptr<ParallelZstdReader> zstd;
+    /// Set for files that were compressed with a zstd dictionary
+    ZSTD_DCtx* dictionary_zstd = nullptr;
+    /// Set once the last frame has been decompressed and handed out completely
+    bool dictionary_zstd_done = false;
+#endif
+};
+}
+
+static la_ssize_t readMapped(struct archive*, void* client_data, const void** buff) {
+    auto* source = (Source*)client_data;
+    // Everything that is left is handed over in one block; libarchive never copies it
+    *buff = source->map + source->position;
+    la_ssize_t size = (la_ssize_t)(source->size - source->position);
+    source->position = source->size;
+    return size;
+}
+
+static la_ssize_t readBuffered(struct archive* a, void* client_data, const void** buff) {
+    auto* source = (Source*)client_data;
+    ssize_t size;
+    do {
+        size = read(source->fd, source->buffer.data(), buffer_size);
+    } while(size < 0 && errno == EINTR);
+    if(size < 0) {
+        archive_set_error(a, errno, "read failed");
+        return ARCHIVE_FATAL;
+    }
+    source->position += size;
+    // Have the kernel fetch the next block while libarchive works on this one
+    if(size > 0 && source->position < source->size) { readahead(source->fd, (off64_t)source->position, buffer_size); }
+    *buff = source->buffer.data();
+    return size;
+}
+
+static la_int64_t seekSource(struct archive*, void* client_data, la_int64_t offset, int whence) {
+    auto* source = (Source*)client_data;
+    int64_t target = offset;
+    if(whence == SEEK_CUR) { target += source->position; }
+    else if(whence == SEEK_END) { target += source->size; }
+    if(target < 0) { return ARCHIVE_FATAL; }
+    if((uint64_t)target > source->size) { target = source->size; }
+    if(!source->map && lseek(source->fd, target, SEEK_SET) < 0) { return ARCHIVE_FATAL; }
+    source->position = target;
+    return target;
+}
+
+static la_int64_t skipSource(struct archive* a, void* client_data, la_int64_t request) {
+    auto* source = (Source*)client_data;
+    la_int64_t skipped = std::min<la_int64_t>(request, source->size - source->position);
+    if(seekSource(a, client_data, skipped, SEEK_CUR) < 0) { return 0; }
+    return skipped;
+}
+
+#ifdef BVPM_ENABLE_ZSTD
+static bool hasSeekableFooter(int fd, uint64_t size) {
+    char footer[9];
+    if(size < 17 || pread(fd, footer, sizeof(footer), size - sizeof(footer)) != sizeof(footer)) { return false; }
+    // The footer ends in the seekable magic number, 0x8F92EAB1 in little endian
+    return memcmp(footer + 5, "\xb1\xea\x92\x8f", 4) == 0;
+}
+
+static la_ssize_t readZstd(struct archive* a, void* client_data, const void** buff) {
+    auto* source = (Source*)client_data;
+    const char* block;
+    int64_t size = source->zstd->read(&block);
+    if(size < 0) {
+        archive_set_error(a, EIO, "zstd frame could not be decompressed");
+        return ARCHIVE_FATAL;
+    }
+    *buff = block;
+    return size;
+}
+
+static la_int64_t skipZstd(struct archive*, void* client_data, la_int64_t request) {
+    auto* source = (Source*)client_data;
+    return source->zstd->skip(request);
+}
+
+/// If the file is in the seekable zstd format, map it and set up its frames to be decompressed in parallel.
+static bool openSeekableZstd(Source* source) {
+    if(!hasSeekableFooter(source->fd, source->size)) { return false; }
+    if(!source->map) {
+        void* map = mmap(nullptr, source->size, PROT_READ, MAP_PRIVATE, source->fd, 0);
+        if(map == MAP_FAILED) { return false; }
+        source->map = (const char*)map;
+    }
+    SeekTable table;
+    if(!table.parse(source->map, source->size)) { return false; }
+    // Frames are spread over the workers, so the reads are not sequential anymore
+    madvise((void*)source->map, source->size, MADV_WILLNEED);
+    source->zstd = std::make_unique<ParallelZstdReader>(source->map, std::move(table), std::thread::hardware_concurrency());
+    return true;
+}
+
+// Decompression contexts are reused between packages; a new one allocates its window and buffers again
+static constexpr size_t context_pool_size = 16;
+static std::mutex context_pool_mutex;
+static std::vector<ZSTD_DCtx*> context_pool;
+
+static ZSTD_DCtx* takeContext() {
+    std::lock_guard<std::mutex> guard(context_pool_mutex);
+    if(context_pool.empty()) { return ZSTD_createDCtx(); }
+    ZSTD_DCtx* context = context_pool.back();
+    context_pool.pop_back();
+    return context;
+}
+
+static void returnContext(ZSTD_DCtx* context) {
+    if(!context) { return; }
+    ZSTD_DCtx_reset(context, ZSTD_reset_session_and_parameters);
+    std::lock_guard<std::mutex> guard(context_pool_mutex);
+    if(context_pool.size() < context_pool_size) {
+        context_pool.push_back(context);
+    } else {
+        ZSTD_freeDCtx(context);
+    }
+}
+
+/// \return The ID of the zstd dictionary the file at fd needs, 0 if it needs none.
+static uint32_t fileDictionaryID(int fd) {
+    // The largest a zstd frame header can be
+    char header[18];
+    ssize_t size = pread(fd, header, sizeof(header), 0);
+    return size > 0 ? ZstdDictionaries::frameDictionaryID(header, size) : 0;
+}
+
+static la_ssize_t readDictionaryZstd(struct archive* a, void* client_data, const void** buff) {
+    auto* source = (Source*)client_data;
+    *buff = source->buffer.data();
+    if(source->dictionary_zstd_done) { return 0; }
+    ZSTD_inBuffer in{source->map, source->size, source->position};
+    ZSTD_outBuffer out{source->buffer.data(), buffer_size, 0};
+    // Some input gives no output yet; the block ends when there is output, or nothing is left to give
+    do {
+        size_t result = ZSTD_decompressStream(source->dictionary_zstd, &out, &in);
+        if(ZSTD_isError(result)) {
+            archive_set_error(a, EIO, "zstd: %s", ZSTD_getErrorName(result));
+            return ARCHIVE_FATAL;
+        }
+        // 0 means the frame is done and flushed
+        if(in.pos == in.size && result == 0) {
+            source->dictionary_zstd_done = true;
+            break;
+        }
+        if(in.pos == in.size && out.pos < out.size) {
+            archive_set_error(a, EIO, "zstd: truncated frame");
+            return ARCHIVE_FATAL;
+        }
+    } while(out.pos == 0);
+    source->position = in.pos;
+    return (la_ssize_t)out.pos;
+}
+
+/// If the file was compressed with a zstd dictionary, map it and set up a stream that decompresses it with the
+/// dictionary, which libarchive can not do itself.
+/// \return 1 if it was set up, 0 if the file needs no dictionary, -1 if it needs one that is not there.
+static int openDictionaryZstd(Source* source, const std::string& path) {
+    const uint32_t id = fileDictionaryID(source->fd);
+    if(id == 0) { return 0; }
+    const ZSTD_DDict* dictionary = ZstdDictionaries::find(id);
+    if(!dictionary) {
+        std::cerr << "error reading " << path << ": it needs zstd dictionary " << id << ", which none of the repositories has" << std::endl;
+        return -1;
+    }
+    if(!source->map) {
+        void* map = mmap(nullptr, source->size, PROT_READ, MAP_PRIVATE, source->fd, 0);
+        if(map == MAP_FAILED) { return -1; }
+        source->map = (const char*)map;
+        madvise(map, source->size, MADV_SEQUENTIAL);
+    }
+    if(!source->buffer.data()) {
+        source->buffer = PooledBuffer(buffer_size);
+        if(!source->buffer.data()) { return -1; }
+    }
+    source->dictionary_zstd = takeContext();
+    if(!source->dictionary_zstd || ZSTD_isError(ZSTD_DCtx_refDDict(source->dictionary_zstd, dictionary))) { return -1; }
+    return 1;
+}
+#endif
+
+static int closeSource(struct archive*, void* client_data) {
+    auto* source = (Source*)client_data;
+#ifdef BVPM_ENABLE_ZSTD
+    // The workers read from the mapping, so they have to be stopped first
+    source->zstd.reset();
+    returnContext(source->dictionary_zstd);
+#endif
+    if(source->map) { munmap((void*)source->map, source->size); }
+    if(source->fd >= 0) { close(source->fd); }
+    delete source;
+    return ARCHIVE_OK;
+}
+
+bool ArchiveReader::parseBackend(const std::string& name, ArchiveIO& io) {
+    if(name == "auto") { io = ArchiveIO::Auto; }
+    else if(name == "mmap") { io = ArchiveIO::Mmap; }
+    else if(name == "buffered") { io = ArchiveIO::Buffered; }
+    else if(name == "libarchive") { io = ArchiveIO::Libarchive; }
+    else { return false; }
+    return true;
+}
+
+const char* ArchiveReader::backendName(ArchiveIO io) {
+    switch(io) {
+        case ArchiveIO::Auto: return "auto";
+        case ArchiveIO::Mmap: return "mmap";
+        case ArchiveIO::Buffered: return "buffered";
+        case ArchiveIO::Libarchive: return "libarchive";
+    }
+    return "auto";
+}
+
+ArchiveIO ArchiveReader::backendFromConfig(const ConfigFile& config) {
+    ArchiveIO io = ArchiveIO::Auto;
+    auto entry = config.values.find("ARCHIVE_IO");
+    if(entry != config.values.end() && !parseBackend(entry->second, io)) {
+        std::cerr << "warning: unknown ARCHIVE_IO " << entry->second << ", using auto" << std::endl;
+    }
+    return io;
+}
+
+bool ArchiveReader::isSeekableZstd(const std::string& path) {
+#ifdef BVPM_ENABLE_ZSTD
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0) { return false; }
+    struct stat st{};
+    bool ret = fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && hasSeekableFooter(fd, st.st_size);
+    close(fd);
+    return ret;
+#else
+    return false;
+#endif
+}
+
+bool ArchiveReader::isDecompressedByBvpm(const std::string& path) {
+#ifdef BVPM_ENABLE_ZSTD
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0) { return false; }
+    struct stat st{};
+    bool ret = fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && (hasSeekableFooter(fd, st.st_size) || fileDictionaryID(fd) != 0);
+    close(fd);
+    return ret;
+#else
+    return false;
+#endif
+}
+
+ArchiveHandle ArchiveReader::open(const std::string& path, ArchiveIO io, bool raw) {
+    struct archive* a = archive_read_new();
+    archive_read_support_filter_all(a);
+    if(raw) {
+        archive_read_support_format_raw(a);
+    } else {
+        archive_read_support_format_all(a);
+    }
+
+#ifdef BVPM_ENABLE_ZSTD
+    // libarchive can not read packages that need a zstd dictionary, so those always go through our own reader
+    if(io == ArchiveIO::Libarchive) {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if(fd >= 0 && fileDictionaryID(fd) != 0) { io = ArchiveIO::Auto; }
+        if(fd >= 0) { close(fd); }
+    }
+#endif
+    if(io == ArchiveIO::Libarchive) {
+        if(archive_read_open_filename(a, path.c_str(), libarchive_block_size) != ARCHIVE_OK) {
+            archive_read_free(a);
+            return {};
+        }
+        return ArchiveHandle(a);
+    }
+
+    auto* source = new Source();
+    source->fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st{};
+    if(source->fd < 0 || fstat(source->fd, &st) != 0) {
+        closeSource(a, source);
+        archive_read_free(a);
+        return {};
+    }
+    source->size = S_ISREG(st.st_mode) ? st.st_size : 0;
+
+    if(io == ArchiveIO::Auto) { io = source->size >= mmap_min_size ? ArchiveIO::Mmap : ArchiveIO::Buffered; }
+    if(io == ArchiveIO::Mmap && source->size > 0) {
+        void* map = mmap(nullptr, source->size, PROT_READ, MAP_PRIVATE, source->fd, 0);
+        if(map != MAP_FAILED) {
+            source->map = (const char*)map;
+            madvise(map, source->size, MADV_SEQUENTIAL);
+            // Only a hint: the kernel can only back file mappings with hugepages in some configurations
+            if(source->size >= hugepage_min_size) { madvise(map, source->size, MADV_HUGEPAGE); }
+        }
+    }
+    if(!source->map) {
+        // Buffered, or mmap was not possible; the buffer comes from the pool, as one package is read after another
+        source->buffer = PooledBuffer(buffer_size);
+        if(!source->buffer.data()) {
+            closeSource(a, source);
+            archive_read_free(a);
+            return {};
+        }
+        posix_fadvise(source->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+
+    archive_read_set_callback_data(a, source);
+    archive_read_set_close_callback(a, closeSource);
+#ifdef BVPM_ENABLE_ZSTD
+    // Seekable zstd files are handed to libarchive decompressed, as the plain tar inside
+    if(openSeekableZstd(source)) {
+        archive_read_set_read_callback(a, readZstd);
+        archive_read_set_skip_callback(a, skipZstd);
+        if(archive_read_open1(a) != ARCHIVE_OK) {
+            archive_read_free(a);
+            return {};
+        }
+        return ArchiveHandle(a);
+    }
+    // Packages compressed with a dictionary are handed to libarchive decompressed as well
+    int dictionary = source->size > 0 ? openDictionaryZstd(source, path) : 0;
+    if(dictionary < 0) {
+        closeSource(a, source);
+        archive_read_free(a);
+        return {};
+    }
+    if(dictionary > 0) {
+        archive_read_set_read_callback(a, readDictionaryZstd);
+        if(archive_read_open1(a) != ARCHIVE_OK) {
+            archive_read_free(a);
+            return {};
+        }
+        return ArchiveHandle(a);
+    }
+#endif
+    archive_read_set_read_callback(a, source->map ? readMapped : readBuffered);
+    // Skipping and seeking need a regular file; pipes and the like are read straight through
+    if(source->size > 0) {
+        archive_read_set_skip_callback(a, skipSource);
+        archive_read_set_seek_callback(a, seekSource);
+    }
+    if(archive_read_open1(a) != ARCHIVE_OK) {
+        archive_read_free(a);
+        return {};
+    }
+    return ArchiveHandle(a);
+}
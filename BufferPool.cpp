@@ -0,0 +1,92 @@
+#include <cstdlib>
+#include <mutex>
+#include <utility>
+#include <vector>
+#include <BufferPool.h>
+#include <Stats.h>
+
+static constexpr size_t min_size_class = 12;  // 4 KiB
+static constexpr size_t max_size_class = 24;  // 16 MiB, PooledBuffer::max_pooled_size
+static constexpr size_t alignment = 4096;
+/// How many free buffers of one size are kept; a few threads reading packages at once is all we expect
+static constexpr size_t max_free_per_class = 16;
+
+namespace {
+struct Pool {
+    std::mutex mutex;
+    std::vector<char*> free_buffers[max_size_class + 1];
+};
+}
+
+/// Never destroyed, so that buffers given back during static destruction still have somewhere to go
+static Pool& pool() {
+    static Pool* instance = new Pool();
+    return *instance;
+}
+
+static size_t sizeClass(size_t size) {
+    size_t size_class = min_size_class;
+    while(((size_t)1 << size_class) < size) { size_class++; }
+    return size_class;
+}
+
+PooledBuffer::PooledBuffer(size_t size) {
+    const size_t size_class = sizeClass(size);
+    capacity = (size_t)1 << size_class;
+    if(size_class <= max_size_class) {
+        Pool& p = pool();
+        std::lock_guard<std::mutex> lock(p.mutex);
+        std::vector<char*>& free_buffers = p.free_buffers[size_class];
+        if(!free_buffers.empty()) {
+            buffer = free_buffers.back();
+            free_buffers.pop_back();
+            return;
+        }
+    }
+    if(posix_memalign((void**)&buffer, alignment, capacity) != 0) {
+        buffer = nullptr;
+        capacity = 0;
+        return;
+    }
+    Stats::add(Stats::BuffersAllocated);
+}
+
+PooledBuffer::~PooledBuffer() {
+    release();
+}
+
+PooledBuffer::PooledBuffer(PooledBuffer&& other) noexcept {
+    swap(other);
+}
+
+PooledBuffer& PooledBuffer::operator=(PooledBuffer&& other) noexcept {
+    if(this != &other) {
+        release();
+        swap(other);
+    }
+    return *this;
+}
+
+void PooledBuffer::swap(PooledBuffer& other) noexcept {
+    std::swap(buffer, other.buffer);
+    std::swap(capacity, other.capacity);
+}
+
+void PooledBuffer::release() {
+    if(!buffer) { return; }
+    const size_t size_class = sizeClass(capacity);
+    if(size_class <= max_size_class) {
+        Pool& p = pool();
+        std::lock_guard<std::mutex> lock(p.mutex);
+        std::vector<char*>& free_buffers = p.free_buffers[size_class];
+        if(free_buffers.size() < max_free_per_class) {
+            free_buffers.push_back(buffer);
+            buffer = nullptr;
+            capacity = 0;
+            return;
+        }
+    }
+    free(buffer);
+    buffer = nullptr;
+    capacity = 0;
+}
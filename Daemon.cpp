@@ -0,0 +1,407 @@
+#include <iostream>
+#include <sstream>
+#include <chrono>
+#include <filesystem>
+#include <csignal>
+#include <cstring>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <Daemon.h>
+#include <FileLock.h>
+#include <UninstallEngine.h>
+#include <debug.h>
+
+namespace fs = std::filesystem;
+
+static volatile sig_atomic_t stop_requested = 0;
+
+/// Clients are served one at a time, so one that does not send its request line within this long, or sends one
+/// longer than max_request_size, is dropped rather than keeping every other bvpm waiting
+static const int request_timeout_ms = 5000;
+static const size_t max_request_size = 1024 * 1024;
+static const std::string config_file_option = "--config-file=";
+static const std::string declined_trailer = "declined";
+
+static void requestStop(int) { stop_requested = 1; }
+
+static bool writeAll(int fd, const char* data, size_t size) {
+    while(size) {
+        ssize_t written = write(fd, data, size);
+        if(written < 0) {
+            if(errno == EINTR) { continue; }
+            return false;
+        }
+        data += written;
+        size -= written;
+    }
+    return true;
+}
+
+static void sendExitCode(int fd, int code) {
+    std::string trailer(1, '\0');
+    trailer += std::to_string(code) + "\n";
+    writeAll(fd, trailer.data(), trailer.size());
+}
+
+static bool fillSocketAddress(const std::string& path, sockaddr_un& address) {
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if(path.size() >= sizeof(address.sun_path)) { return false; }
+    strcpy(address.sun_path, path.c_str());
+    return true;
+}
+
+std::string Daemon::defaultSocketPath(const std::string& install_root, const ConfigFile& config) {
+    auto socket = config.values.find("DAEMON_SOCKET");
+    if(socket != config.values.end()) { return install_root + "/" + socket->second; }
+    return install_root + "/run/bvpmd.sock";
+}
+
+bool Daemon::sendRequest(const std::string& socket_path, const std::vector<std::string>& request, int& exit_code) {
+    sockaddr_un address;
+    if(!fillSocketAddress(socket_path, address)) { return false; }
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(fd < 0) { return false; }
+    if(connect(fd, (sockaddr*)&address, sizeof(address)) != 0) {
+        close(fd);
+        return false;
+    }
+
+    std::string line;
+    for(size_t i = 0; i < request.size(); i++) {
+        line += request[i];
+        line += (i + 1 < request.size()) ? '\t' : '\n';
+    }
+    if(!writeAll(fd, line.data(), line.size())) {
+        close(fd);
+        return false;
+    }
+
+    // Everything up to the NUL is output, everything after it the exit code
+    std::string trailer;
+    bool in_trailer = false;
+    char buffer[64 * 1024];
+    ssize_t size;
+    while((size = read(fd, buffer, sizeof(buffer))) != 0) {
+        if(size < 0) {
+            if(errno == EINTR) { continue; }
+            break;
+        }
+        if(in_trailer) {
+            trailer.append(buffer, size);
+            continue;
+        }
+        char* nul = (char*)memchr(buffer, '\0', size);
+        size_t output_size = nul ? (size_t)(nul - buffer) : (size_t)size;
+        std::cout.write(buffer, output_size);
+        if(nul) {
+            in_trailer = true;
+            trailer.append(nul + 1, size - output_size - 1);
+        }
+    }
+    std::cout.flush();
+    close(fd);
+    if(in_trailer && trailer == declined_trailer) { return false; }
+    if(!in_trailer) {
+        std::cerr << "bvpmd closed the connection without finishing the request" << std::endl;
+        exit_code = -1;
+        return true;
+    }
+    exit_code = std::atoi(trailer.c_str());
+    return true;
+}
+
+Daemon::Daemon(std::string _install_root, ConfigFile _config, std::string _config_file, std::string _socket_path)
+    : install_root(std::move(_install_root)), config(std::move(_config)), config_file(std::move(_config_file)),
+      socket_path(std::move(_socket_path)) { }
+
+Daemon::~Daemon() {
+    if(listen_fd >= 0) {
+        close(listen_fd);
+        unlink(socket_path.c_str());
+    }
+    if(inotify_fd >= 0) { close(inotify_fd); }
+}
+
+void Daemon::watch(const std::string& path, uint32_t mask) {
+    int wd = inotify_add_watch(inotify_fd, path.c_str(), mask);
+    if(wd < 0) {
+        PRINT_DEBUG("failed to watch " << path << ": " << strerror(errno) << std::endl);
+        return;
+    }
+    watches[wd] = path;
+}
+
+void Daemon::reload() {
+    std::cout << "Reloading package database and repository indexes" << std::endl;
+    engine.reset();
+    // A transaction of a bvpm that went around us would be seen half done
+    FileLock root_lock;
+    root_lock.lock(FileLock::rootLockPath(install_root), FileLock::Mode::Shared, "install root " + install_root);
+    engine = std::make_unique<InstallEngine>(install_root, config);
+    // The daemon is there to keep everything loaded, so it pays for the full load once, up front
+    engine->dependencyEngine.GetInstalledPackages();
+    root_lock.unlock();
+    dirty = false;
+
+    // (Re)arm the watches; anything that changes the installed packages or a local repository index makes us dirty
+    for(const auto& watch_entry : watches) { inotify_rm_watch(inotify_fd, watch_entry.first); }
+    watches.clear();
+    const std::string packages_path = install_root + "/etc/bvpm/packages";
+    // On a root nothing was installed into yet, the folder is made now, so that the first install is seen too
+    std::error_code ec;
+    fs::create_directories(packages_path, ec);
+    watch(packages_path, IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO);
+    for(fs::directory_iterator it(packages_path, ec), end; !ec && it != end; it.increment(ec)) {
+        if(it->is_directory(ec)) { watch(it->path().generic_string(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE_SELF); }
+    }
+    remote_repositories = false;
+    for(const auto& entry : config.values) {
+        if(entry.first.rfind("REPOSITORY_", 0) != 0) { continue; }
+        std::string location = entry.second;
+        if(location.find("://") != std::string::npos) {
+            // Nothing tells us when a remote index changes; installs fetch it again instead (see runTransaction())
+            if(location.rfind("file://", 0) != 0) {
+                remote_repositories = true;
+                continue;
+            }
+            location = location.substr(strlen("file://"));
+        }
+        watch(location, IN_CLOSE_WRITE | IN_MOVED_TO);
+    }
+}
+
+void Daemon::handleInotify() {
+    alignas(inotify_event) char buffer[16 * 1024];
+    ssize_t size = read(inotify_fd, buffer, sizeof(buffer));
+    for(ssize_t offset = 0; offset < size;) {
+        auto* event = (inotify_event*)(buffer + offset);
+        offset += sizeof(inotify_event) + event->len;
+        // Removing our own watches on reload queues IN_IGNORED events, which are not changes
+        if(event->mask & IN_IGNORED || watches.find(event->wd) == watches.end()) { continue; }
+        PRINT_DEBUG("change in " << watches[event->wd] << (event->len ? std::string("/") + event->name : "") << std::endl);
+        dirty = true;
+    }
+}
+
+int Daemon::handleQuery(const std::vector<std::string>& request, std::ostream& out) {
+    const std::map<std::string, std::string>& installed = engine->dependencyEngine.GetInstalledPackages();
+    if(request[0] == "query-all") {
+        for(const auto& package : installed) {
+            out << package.first << ": " << package.second << "\n";
+        }
+        return 0;
+    }
+    int num_notfound = 0;
+    for(size_t i = 1; i < request.size(); i++) {
+        auto package = installed.find(request[i]);
+        if(package != installed.end()) {
+            out << package->first << ": " << package->second << "\n";
+        } else {
+            out << "package " << request[i] << " not installed" << "\n";
+            num_notfound++;
+        }
+    }
+    return num_notfound;
+}
+
+int Daemon::runTransaction(const std::vector<std::string>& request) {
+    bool files = false;
+    bool ignore_dependencies = false;
+    std::vector<std::string> packages;
+    for(size_t i = 1; i < request.size(); i++) {
+        if(request[i] == "--files") { files = true; }
+        else if(request[i] == "--ignore-dependencies") { ignore_dependencies = true; }
+        else { packages.push_back(request[i]); }
+    }
+
+    FileLock root_lock;
+    if(!root_lock.lock(FileLock::rootLockPath(install_root), FileLock::Mode::Exclusive, "install root " + install_root)) {
+        perror(("error locking install root " + install_root).c_str());
+        return -1;
+    }
+    // A bvpm that went around us may have changed the root before we got the lock
+    handleInotify();
+    // The indexes of remote repositories are as old as the daemon's last reload, so installs from them start afresh
+    if(dirty || (request[0] == "install" && remote_repositories)) { engine = std::make_unique<InstallEngine>(install_root, config); }
+    if(request[0] == "install") {
+        InstallEngine& installEngine = *engine;
+        for(const std::string& package : packages) {
+            if(!(files ? installEngine.AddPackageFile(package) : installEngine.AddPackage(package))) { return -1; }
+        }
+        if(installEngine.empty()) {
+            std::cout << "error: no packages selected" << std::endl;
+            return -1;
+        }
+        if(!installEngine.VerifyPossible()) {
+            std::cout << "Failed to resolve dependencies during install stage; are there problems with the repositories? Bailing!" << std::endl;
+            return -1;
+        }
+        if(!installEngine.Execute()) { return -1; }
+        std::cout << "Operations complete" << std::endl;
+        return 0;
+    }
+
+    UninstallEngine uninstallEngine(install_root, engine->dependencyEngine);
+    for(const std::string& package : packages) {
+        if(!uninstallEngine.AddToList(package, ignore_dependencies)) { return -1; }
+    }
+    if(uninstallEngine.empty()) {
+        std::cout << "error: no packages selected" << std::endl;
+        return -1;
+    }
+    uninstallEngine.Execute();
+    std::cout << "Operations complete" << std::endl;
+    return 0;
+}
+
+void Daemon::handleClient(int client_fd) {
+    // Read the request line
+    std::string line;
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(request_timeout_ms);
+    while(true) {
+        auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+        pollfd fd{client_fd, POLLIN, 0};
+        int ready = remaining > 0 ? poll(&fd, 1, (int)remaining) : 0;
+        if(ready < 0 && errno == EINTR) { continue; }
+        if(ready <= 0 || line.size() > max_request_size) {
+            std::cout << "Dropping a client whose request was too slow or too long" << std::endl;
+            return;
+        }
+        char buffer[4096];
+        ssize_t size = read(client_fd, buffer, sizeof(buffer));
+        if(size < 0 && errno == EINTR) { continue; }
+        if(size <= 0) { break; }
+        line.append(buffer, size);
+        size_t end = line.find('\n');
+        if(end != std::string::npos) {
+            line.resize(end);
+            break;
+        }
+    }
+    std::vector<std::string> request;
+    std::istringstream ss(line);
+    std::string word;
+    while(std::getline(ss, word, '\t')) { request.push_back(word); }
+    if(request.empty()) { return; }
+    PRINT_DEBUG("request: " << line << std::endl);
+
+    // Answers from another config could differ from what bvpm would find itself, so such requests go back to it
+    for(auto word = request.begin() + 1; word != request.end();) {
+        if(word->compare(0, config_file_option.size(), config_file_option) != 0) {
+            ++word;
+            continue;
+        }
+        if(word->substr(config_file_option.size()) != config_file) {
+            std::string trailer(1, '\0');
+            trailer += declined_trailer;
+            writeAll(client_fd, trailer.data(), trailer.size());
+            return;
+        }
+        word = request.erase(word);
+    }
+
+    if(dirty) { reload(); }
+
+    if(request[0] == "query" || request[0] == "query-all") {
+        std::ostringstream out;
+        int code = handleQuery(request, out);
+        std::string output = out.str();
+        writeAll(client_fd, output.data(), output.size());
+        sendExitCode(client_fd, code);
+        return;
+    }
+
+    if(request[0] != "install" && request[0] != "uninstall") {
+        std::string error = "bvpmd: unknown request " + request[0] + "\n";
+        writeAll(client_fd, error.data(), error.size());
+        sendExitCode(client_fd, -1);
+        return;
+    }
+
+    // Only root and the user running the daemon may change the system through it
+    ucred credentials{};
+    socklen_t credentials_size = sizeof(credentials);
+    if(getsockopt(client_fd, SOL_SOCKET, SO_PEERCRED, &credentials, &credentials_size) != 0 ||
+       (credentials.uid != 0 && credentials.uid != getuid())) {
+        std::string error = "bvpmd: permission denied\n";
+        writeAll(client_fd, error.data(), error.size());
+        sendExitCode(client_fd, -1);
+        return;
+    }
+
+    std::cout.flush();
+    pid_t pid = fork();
+    if(pid == 0) {
+        // The child talks straight to the client
+        dup2(client_fd, STDOUT_FILENO);
+        dup2(client_fd, STDERR_FILENO);
+        close(listen_fd);
+        int code = runTransaction(request);
+        std::cout.flush();
+        exit(code);
+    }
+    int status = 0;
+    if(pid < 0 || waitpid(pid, &status, 0) < 0) {
+        sendExitCode(client_fd, -1);
+        return;
+    }
+    sendExitCode(client_fd, WIFEXITED(status) ? (int8_t)WEXITSTATUS(status) : -1);
+    // The transaction changed the system under us
+    dirty = true;
+}
+
+int Daemon::run() {
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, requestStop);
+    signal(SIGTERM, requestStop);
+
+    sockaddr_un address;
+    if(!fillSocketAddress(socket_path, address)) {
+        std::cerr << "socket path " << socket_path << " is too long" << std::endl;
+        return -1;
+    }
+    int probe_code;
+    if(sendRequest(socket_path, {"query"}, probe_code)) {
+        std::cerr << "bvpmd is already running on " << socket_path << std::endl;
+        return -1;
+    }
+    fs::create_directories(fs::path(socket_path).parent_path());
+    unlink(socket_path.c_str());
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    mode_t old_umask = umask(0077);
+    int bound = bind(listen_fd, (sockaddr*)&address, sizeof(address));
+    umask(old_umask);
+    if(bound != 0 || listen(listen_fd, 64) != 0) {
+        std::cerr << "failed to listen on " << socket_path << ": " << strerror(errno) << std::endl;
+        return -1;
+    }
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+    reload();
+    std::cout << "bvpmd listening on " << socket_path << std::endl;
+
+    while(!stop_requested) {
+        pollfd fds[2] = {{listen_fd, POLLIN, 0}, {inotify_fd, POLLIN, 0}};
+        if(poll(fds, 2, -1) < 0) {
+            if(errno == EINTR) { continue; }
+            perror("poll");
+            return -1;
+        }
+        if(fds[1].revents & POLLIN) { handleInotify(); }
+        if(fds[0].revents & POLLIN) {
+            int client_fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+            if(client_fd < 0) { continue; }
+            handleClient(client_fd);
+            close(client_fd);
+        }
+    }
+    std::cout << "bvpmd stopping" << std::endl;
+    return 0;
+}
@@ -4,10 +4,13 @@
 #include <algorithm>
 #include <filesystem>
 #include <iostream>
+#include <unordered_map>
+#include <unordered_set>
 #include <config.h>
 #include <DependencyEngine.h>
 #include <InstallEngine.h>
 #include <debug.h>
+#include <Stats.h>
 
 namespace fs = std::filesystem;
 
@@ -18,8 +21,10 @@ void DependencyEngine::LoadInstalledPackages() {
     // While these should be the same as the package name, as we need to read the package manifest anyway to get the
     // version, we just store these temporarily
     std::vector<std::string> folders;
-    for(auto& p : fs::recursive_directory_iterator(install_root + "/etc/bvpm/packages")) {
-        if(p.is_directory()) { folders.push_back(p.path().string()); }
+    // A root nothing was installed into yet has no package folder at all
+    std::error_code ec;
+    for(fs::recursive_directory_iterator it(install_root + "/etc/bvpm/packages", ec), end; !ec && it != end; it.increment(ec)) {
+        if(it->is_directory(ec)) { folders.push_back(it->path().string()); }
     }
 
     // We can now iterate through each folder, open its manifest, and try to read the installed package name and ver
@@ -32,6 +37,7 @@ void DependencyEngine::LoadInstalledPackages() {
             std::cout << "couldnt open manifest file " << manifest_file_name << std::endl;
             continue;
         }
+        Stats::add(Stats::ManifestsParsed);
         if(manifest.values.find("PACKAGE") == manifest.values.end()) {
             std::cout << "package folder " << manifest_file_name << " has corrupted manifest: no package name" << std::endl;
             continue;
@@ -44,29 +50,119 @@ void DependencyEngine::LoadInstalledPackages() {
         installed_packages[name] = version;
         PRINT_DEBUG("installed package: " << name << ", version: " << version << std::endl);
     }
+    all_installed_loaded = true;
     std::cout << installed_packages.size() << " installed packages." << std::endl;
 }
 
+bool DependencyEngine::LookupInstalled(const std::string& name, std::string& version) {
+    auto installed = installed_packages.find(name);
+    if(installed != installed_packages.end()) {
+        version = installed->second;
+        return true;
+    }
+    if(all_installed_loaded) { return false; }
+    // Only this package's manifest is read; misses are cached by LoadPackageManifest too
+    ConfigFile manifest = LoadPackageManifest(name);
+    if(manifest.values.find("failed") != manifest.values.end()) { return false; }
+    auto package = manifest.values.find("PACKAGE");
+    if(package == manifest.values.end() || package->second != name) { return false; }
+    auto version_entry = manifest.values.find("VERSION");
+    version = version_entry != manifest.values.end() ? version_entry->second : "";
+    installed_packages[name] = version;
+    return true;
+}
+
+bool DependencyEngine::IsInstalled(const std::string& name) {
+    std::string version;
+    return LookupInstalled(name, version);
+}
+
+std::string DependencyEngine::GetInstalledVersion(const std::string& name) {
+    std::string version;
+    LookupInstalled(name, version);
+    return version;
+}
+
+const std::map<std::string, std::string>& DependencyEngine::GetInstalledPackages() {
+    if(!all_installed_loaded) { LoadInstalledPackages(); }
+    return installed_packages;
+}
+
+bool DependencyEngine::ResolveWithClosures(std::vector<SimplePackageData>& packages, RepositoryEngine& repositoryEngine) {
+    std::vector<std::vector<std::string>> closures(packages.size());
+    std::unordered_map<std::string, size_t> asked;
+    for(size_t i = 0; i < packages.size(); i++) {
+        if(packages[i].from_file || !repositoryEngine.getPackageClosure(packages[i].name, closures[i])) { return false; }
+        asked.emplace(packages[i].name, i);
+    }
+    std::vector<SimplePackageData> sorted_packages;
+    std::unordered_set<std::string> listed;
+    std::unordered_map<std::string, SimplePackageData> looked_up;
+    std::unordered_set<std::string> needed;
+    std::unordered_set<std::string> to_install;
+    for(size_t i = 0; i < packages.size(); i++) {
+        const std::vector<std::string>& closure = closures[i];
+        // Going through the closure backwards, every package comes after the packages that depend on it. A package is
+        // needed if a needed package that is not installed depends on it; what installed packages depend on is not
+        // looked at, just like when the dependencies are followed one by one.
+        needed.clear();
+        to_install.clear();
+        needed.insert(packages[i].name);
+        for(size_t k = closure.size(); k-- > 0;) {
+            const std::string& name = closure[k];
+            if(!needed.count(name) || listed.count(name)) { continue; }
+            Stats::add(Stats::DependencyChecks);
+            auto asked_package = asked.find(name);
+            if(asked_package == asked.end() && IsInstalled(name)) { continue; }
+            const SimplePackageData* data;
+            if(asked_package != asked.end()) {
+                data = &packages[asked_package->second];
+            } else {
+                auto found = looked_up.find(name);
+                if(found == looked_up.end()) { found = looked_up.emplace(name, repositoryEngine.getSimplePackageData(name)).first; }
+                data = &found->second;
+            }
+            needed.insert(data->dependencies.begin(), data->dependencies.end());
+            to_install.insert(name);
+        }
+        // The closure is in install order, and so are the packages taken from it
+        for(const std::string& name : closure) {
+            if(!to_install.count(name) || !listed.insert(name).second) { continue; }
+            auto asked_package = asked.find(name);
+            sorted_packages.push_back(asked_package != asked.end() ? packages[asked_package->second] : looked_up[name]);
+        }
+    }
+    packages = std::move(sorted_packages);
+    return true;
+}
+
 bool DependencyEngine::CheckDependencies(std::vector<SimplePackageData>& packages, RepositoryEngine& repositoryEngine) {
+    // With closures from the repositories, every package needs one lookup, and the closures come sorted already
+    if(ResolveWithClosures(packages, repositoryEngine)) { return true; }
     bool passed = true;
     bool sort_req = false;
-    for(SimplePackageData& package : packages) {
+    // Missing dependencies get appended to packages while we go through it, so we index it instead of holding
+    // references into it, and the appended packages get their own dependencies checked as well
+    for(size_t i = 0; i < packages.size(); i++) {
+        const std::string package_name = packages[i].name;
+        const std::vector<std::string> package_dependencies = packages[i].dependencies;
         // If the manifest has a dependencies section, then we check if they are already installed
         // If not, then we check if they are in the install list
         // If also not, then we check if we can add it to the package list
         // If even then not, we bail
-        PRINT_DEBUG(package.name << std::endl);
-        for(const std::string& package_dep : package.dependencies) {
+        PRINT_DEBUG(package_name << std::endl);
+        for(const std::string& package_dep : package_dependencies) {
             PRINT_DEBUG("\t" << package_dep << std::endl);
+            Stats::add(Stats::DependencyChecks);
             // We now check if this dependency is installed
-            if(installed_packages.find(package_dep) == installed_packages.end()) {
+            if(!IsInstalled(package_dep)) {
                 // If we dont have the dependency, then we can go and check if we are also about to install it:
                 // TODO: when network works, add some shit for this
                 bool found = false;
-                for(SimplePackageData depsearch : packages) {
+                for(const SimplePackageData& depsearch : packages) {
                     if(depsearch.name == package_dep) {
                         // If they have us in their dep list, than we report this and cut the dependency between them and us
-                        if(std::find(depsearch.dependencies.begin(), depsearch.dependencies.end(), package.name) != depsearch.dependencies.end()) {
+                        if(std::find(depsearch.dependencies.begin(), depsearch.dependencies.end(), package_name) != depsearch.dependencies.end()) {
                             std::cout << "Package " << package_dep << " has a circular dependency with us, breaking." << std::endl;
                             // TODO
                             found = true;
@@ -81,7 +177,7 @@ bool DependencyEngine::CheckDependencies(std::vector<SimplePackageData>& package
                 if(!found) {
                     // We now ask the repository manager if this package is available
                     if(!repositoryEngine.isPackageInRepos(package_dep)) {
-                        std::cout << "Package " << package.name << " is missing dependency " << package_dep << std::endl;
+                        std::cout << "Package " << package_name << " is missing dependency " << package_dep << std::endl;
                         passed = false;
                     } else {
                         // We can add it to the package dep list
@@ -141,6 +237,7 @@ ConfigFile DependencyEngine::LoadPackageManifest(std::string name) {
     }
     // If we dont, we can just return the correct call to readConfigFile
     ConfigFile config = Config::readConfigFile(install_root + "/etc/bvpm/packages/" + name + "/manifest");
+    if(config.values.find("failed") == config.values.end()) { Stats::add(Stats::ManifestsParsed); }
     packageManifests[name] = config;
     return config;
 }
@@ -160,6 +257,7 @@ std::vector<std::string> DependencyEngine::GetPackageOwnedFiles(std::string name
         while(std::getline(file, line, '\n')) {
             lines.push_back(line);
         }
+        Stats::add(Stats::ManifestsParsed);
     }
     packageOwnedFiles[name] = lines;
     return lines;
@@ -167,7 +265,7 @@ std::vector<std::string> DependencyEngine::GetPackageOwnedFiles(std::string name
 
 std::vector<std::string> DependencyEngine::GetDependedPackages(std::string name_to_compare) {
     std::vector<std::string> ret;
-    for(std::pair<std::string, std::string> package : installed_packages) {
+    for(const std::pair<const std::string, std::string>& package : GetInstalledPackages()) {
         const std::string& name = package.first;
         ConfigFile manifest = LoadPackageManifest(name);
         if(manifest.values.find("DEPENDENCY") != manifest.values.end()) {
@@ -190,7 +288,9 @@ size_t DependencyEngine::GetPackageSize(std::string name) {
     size_t size = 0;
     for(std::string file : files) {
         try {
+            Stats::add(Stats::StatCalls);
             if(fs::is_symlink(fs::path(install_root) += file)) { continue; }
+            Stats::add(Stats::StatCalls);
             size += fs::file_size(fs::path(install_root) += file);
         } catch(fs::filesystem_error& e) {
             std::cout << "Error getting size of file " << (fs::path(install_root) += file) << ": " << e.what() << std::endl;
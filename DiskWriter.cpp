@@ -0,0 +1,275 @@
+#include <iostream>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+#include <DiskWriter.h>
+#include <UringDiskWriter.h>
+#include <Stats.h>
+
+namespace fs = std::filesystem;
+
+/// Temporary names are the base name plus a few characters, and have to stay below NAME_MAX
+static constexpr size_t max_base_length = 200;
+
+// I copied this from the libarchive examples
+// TODO: replace this
+static int copy_data(struct archive *ar, struct archive *aw) {
+    int r;
+    const void *buff;
+    size_t size;
+    la_int64_t offset;
+
+    for (;;) {
+        r = archive_read_data_block(ar, &buff, &size, &offset);
+        if (r == ARCHIVE_EOF)
+            return (ARCHIVE_OK);
+        if (r < ARCHIVE_OK)
+            return (r);
+        r = archive_write_data_block(aw, buff, size, offset);
+        if (r < ARCHIVE_OK) {
+            fprintf(stderr, "%s\n", archive_error_string(aw));
+            return (r);
+        }
+    }
+}
+
+DiskWriter::DiskWriter() {
+    umask_bits = umask(0);
+    umask(umask_bits);
+}
+
+void DiskWriter::writeFolder(const std::string& path) {
+    Stats::add(Stats::StatCalls);
+    if(!fs::exists(path)) {
+        fs::create_directories(path);
+        Stats::add(Stats::DirectoriesCreated);
+    }
+}
+
+void DiskWriter::setSource(int fd) {
+    source_fd = fd;
+    source_size = 0;
+    struct stat st{};
+    if(fd >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) { source_size = st.st_size; }
+}
+
+void DiskWriter::splitPath(const std::string& path, std::string& folder, std::string& base) {
+    size_t slash = path.rfind('/');
+    base = slash == std::string::npos ? path : path.substr(slash + 1);
+    folder = slash == std::string::npos ? "." : path.substr(0, slash);
+    if(folder.empty()) { folder = "/"; }
+}
+
+bool DiskWriter::isPlainFile(struct archive_entry* entry, const std::string& base) {
+    unsigned long fflags_set = 0, fflags_clear = 0;
+    archive_entry_fflags(entry, &fflags_set, &fflags_clear);
+    return archive_entry_filetype(entry) == AE_IFREG && !archive_entry_hardlink(entry) && archive_entry_size_is_set(entry)
+           && archive_entry_acl_count(entry, ARCHIVE_ENTRY_ACL_TYPE_ACCESS | ARCHIVE_ENTRY_ACL_TYPE_DEFAULT | ARCHIVE_ENTRY_ACL_TYPE_NFS4) == 0
+           && fflags_set == 0 && !base.empty() && base.size() <= max_base_length;
+}
+
+mode_t DiskWriter::entryMode(struct archive_entry* entry) {
+    // Set-id bits are only kept for our own ids
+    mode_t mode = archive_entry_perm(entry) & 07777;
+    if(archive_entry_uid(entry) != (la_int64_t)geteuid()) { mode &= ~S_ISUID; }
+    if(archive_entry_gid(entry) != (la_int64_t)getegid()) { mode &= ~S_ISGID; }
+    return mode;
+}
+
+void DiskWriter::entryTimes(struct archive_entry* entry, struct timespec times[2]) {
+    times[0].tv_sec = archive_entry_atime(entry);
+    times[0].tv_nsec = archive_entry_atime_is_set(entry) ? archive_entry_atime_nsec(entry) : UTIME_OMIT;
+    times[1].tv_sec = archive_entry_mtime(entry);
+    times[1].tv_nsec = archive_entry_mtime_is_set(entry) ? archive_entry_mtime_nsec(entry) : UTIME_OMIT;
+}
+
+bool DiskWriter::storedOffset(struct archive* a, struct archive_entry* entry, int64_t& offset) const {
+    if(source_fd < 0 || archive_filter_count(a) != 1 || archive_filter_code(a, 0) != ARCHIVE_FILTER_NONE) { return false; }
+    if((archive_format(a) & ARCHIVE_FORMAT_BASE_MASK) != ARCHIVE_FORMAT_TAR || archive_entry_sparse_count(entry) > 0) { return false; }
+    // Right after the header has been read, everything up to the data has been consumed; in a tar without any
+    // compression, that is the file offset of the data, which always starts on a 512 byte block
+    offset = archive_filter_bytes(a, 0);
+    return offset >= 0 && offset % 512 == 0 && (uint64_t)offset + archive_entry_size(entry) <= source_size;
+}
+
+/// Copy size bytes at offset in source into fd, without the data going through userspace.
+static bool copyRange(int source, int64_t offset, size_t size, int fd) {
+    size_t done = 0;
+    // A reflink shares the blocks instead of copying them, but only whole blocks at the same alignment can be
+    // cloned; the rest is copied
+    struct stat st{};
+    if(fstat(fd, &st) == 0 && st.st_blksize > 0 && offset % st.st_blksize == 0 && size >= (size_t)st.st_blksize) {
+        struct file_clone_range range{};
+        range.src_fd = source;
+        range.src_offset = offset;
+        range.src_length = size - size % st.st_blksize;
+        if(ioctl(fd, FICLONERANGE, &range) == 0) { done = range.src_length; }
+    }
+    loff_t in = offset + done;
+    loff_t out = done;
+    while(done < size) {
+        ssize_t copied = copy_file_range(source, &in, fd, &out, size - done, 0);
+        if(copied < 0 && errno == EINTR) { continue; }
+        if(copied <= 0) { break; }
+        done += copied;
+    }
+    // copy_file_range can not copy between some filesystems; sendfile can, and still copies inside the kernel
+    if(done < size && lseek(fd, done, SEEK_SET) < 0) { return false; }
+    while(done < size) {
+        off_t source_offset = offset + done;
+        ssize_t copied = sendfile(fd, source, &source_offset, size - done);
+        if(copied < 0 && errno == EINTR) { continue; }
+        if(copied <= 0) {
+            if(copied == 0) { errno = EIO; }
+            return false;
+        }
+        done += copied;
+    }
+    return true;
+}
+
+bool DiskWriter::writeDirect(struct archive* a, struct archive_entry* entry, int dirfd, const std::string& base, const std::string& temporary,
+                             mode_t mode, int64_t stored_offset, const struct timespec* times) {
+    int fd = openat(dirfd, temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, mode);
+    if(fd < 0) { return false; }
+    const la_int64_t size = archive_entry_size(entry);
+    bool ok = true;
+    if(stored_offset >= 0) {
+        ok = copyRange(source_fd, stored_offset, size, fd);
+        if(ok) { Stats::add(Stats::StoredBytesCopied, size); }
+    } else {
+        fallocate(fd, 0, 0, size);
+        const void* buff;
+        size_t length;
+        la_int64_t offset;
+        for(;;) {
+            int r = archive_read_data_block(a, &buff, &length, &offset);
+            if(r == ARCHIVE_EOF) { break; }
+            if(r < ARCHIVE_OK) {
+                errno = EIO;
+                ok = false;
+                break;
+            }
+            const char* data = (const char*)buff;
+            while(ok && length > 0) {
+                ssize_t written = pwrite(fd, data, length, offset);
+                if(written < 0 && errno == EINTR) { continue; }
+                ok = written > 0;
+                if(ok) {
+                    data += written;
+                    length -= written;
+                    offset += written;
+                }
+            }
+            if(!ok) { break; }
+        }
+        // Without fallocate, a hole at the end would leave the file short
+        ok = ok && ftruncate(fd, size) == 0;
+    }
+    if(ok && times) {
+        // open() gave the file its mode minus the umask
+        if((mode & umask_bits) && fchmod(fd, mode) != 0) {
+            std::cerr << "warning: could not set the permissions of " << base << ": " << strerror(errno) << std::endl;
+        }
+        if((times[0].tv_nsec != UTIME_OMIT || times[1].tv_nsec != UTIME_OMIT) && futimens(fd, times) != 0) {
+            std::cerr << "warning: could not set the times of " << base << ": " << strerror(errno) << std::endl;
+        }
+    }
+    ok = close(fd) == 0 && ok;
+    ok = ok && renameat(dirfd, temporary.c_str(), dirfd, base.c_str()) == 0;
+    if(!ok) {
+        int error = errno;
+        unlinkat(dirfd, temporary.c_str(), 0);
+        errno = error;
+    }
+    return ok;
+}
+
+bool DiskWriter::parseBackend(const std::string& name, DiskWriterBackend& backend) {
+    if(name == "auto") { backend = DiskWriterBackend::Auto; }
+    else if(name == "io_uring") { backend = DiskWriterBackend::IoUring; }
+    else if(name == "libarchive") { backend = DiskWriterBackend::Libarchive; }
+    else { return false; }
+    return true;
+}
+
+const char* DiskWriter::backendName(DiskWriterBackend backend) {
+    switch(backend) {
+        case DiskWriterBackend::Auto: return "auto";
+        case DiskWriterBackend::IoUring: return "io_uring";
+        case DiskWriterBackend::Libarchive: return "libarchive";
+    }
+    return "auto";
+}
+
+DiskWriterBackend DiskWriter::backendFromConfig(const ConfigFile& config) {
+    DiskWriterBackend backend = DiskWriterBackend::Auto;
+    auto entry = config.values.find("DISK_WRITER");
+    if(entry != config.values.end() && !parseBackend(entry->second, backend)) {
+        std::cerr << "warning: unknown DISK_WRITER " << entry->second << ", using auto" << std::endl;
+    }
+    return backend;
+}
+
+std::unique_ptr<DiskWriter> DiskWriter::create(DiskWriterBackend backend) {
+    // Opens and renames through io_uring run on kernel worker threads; with a single CPU those only add
+    // context switches, and the libarchive writer is faster
+    if(backend == DiskWriterBackend::Auto && sysconf(_SC_NPROCESSORS_ONLN) < 2) { backend = DiskWriterBackend::Libarchive; }
+    if(backend != DiskWriterBackend::Libarchive) {
+        auto writer = std::make_unique<UringDiskWriter>();
+        if(writer->available()) { return writer; }
+        if(backend == DiskWriterBackend::IoUring) {
+            std::cerr << "warning: io_uring is not available, writing files with libarchive" << std::endl;
+        }
+    }
+    return std::make_unique<LibarchiveDiskWriter>();
+}
+
+LibarchiveDiskWriter::LibarchiveDiskWriter() {
+    int flags = ARCHIVE_EXTRACT_TIME | ARCHIVE_EXTRACT_ACL | ARCHIVE_EXTRACT_PERM | ARCHIVE_EXTRACT_FFLAGS;
+    extract = archive_write_disk_new();
+    archive_write_disk_set_options(extract, flags);
+    archive_write_disk_set_standard_lookup(extract);
+}
+
+LibarchiveDiskWriter::~LibarchiveDiskWriter() {
+    archive_write_free(extract);
+}
+
+bool LibarchiveDiskWriter::writeEntry(struct archive* a, struct archive_entry* entry) {
+    // Stored members get copied from the package file, instead of through copy_data()
+    const std::string path = archive_entry_pathname(entry);
+    std::string folder, base;
+    splitPath(path, folder, base);
+    int64_t stored_offset;
+    if(isPlainFile(entry, base) && storedOffset(a, entry, stored_offset)) {
+        std::error_code ec;
+        fs::create_directories(folder, ec);
+        struct timespec times[2];
+        entryTimes(entry, times);
+        if(writeDirect(a, entry, AT_FDCWD, path, folder + "/." + base + ".bvpm", entryMode(entry), stored_offset, times)) { return true; }
+        std::cerr << "error writing " << path << ": " << strerror(errno) << std::endl;
+        failed = true;
+        return false;
+    }
+    bool ok = archive_write_header(extract, entry) >= ARCHIVE_WARN && copy_data(a, extract) >= ARCHIVE_WARN;
+    ok = archive_write_finish_entry(extract) >= ARCHIVE_WARN && ok;
+    if(!ok) {
+        const char* error = archive_error_string(extract);
+        std::cerr << "error writing " << archive_entry_pathname(entry) << ": " << (error ? error : "unknown error") << std::endl;
+        failed = true;
+    }
+    return ok;
+}
+
+bool LibarchiveDiskWriter::finish() {
+    // Closing sets the times and permissions libarchive put off until the end (those of folders)
+    if(archive_write_close(extract) < ARCHIVE_WARN) { failed = true; }
+    return !failed;
+}
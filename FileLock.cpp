@@ -0,0 +1,56 @@
+#include <iostream>
+#include <cerrno>
+#include <filesystem>
+#include <utility>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <FileLock.h>
+
+namespace fs = std::filesystem;
+
+FileLock::FileLock(FileLock&& other) noexcept : fd(std::exchange(other.fd, -1)) { }
+
+FileLock& FileLock::operator=(FileLock&& other) noexcept {
+    if(this != &other) {
+        unlock();
+        fd = std::exchange(other.fd, -1);
+    }
+    return *this;
+}
+
+bool FileLock::lock(const std::string& path, Mode mode, const std::string& what) {
+    unlock();
+    std::error_code ec;
+    fs::create_directories(fs::path(path).parent_path(), ec);
+    int lock_fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    // Readers that may not write the folder can still lock a lock file that is there already
+    if(lock_fd < 0) { lock_fd = open(path.c_str(), O_RDONLY | O_CLOEXEC); }
+    if(lock_fd < 0) { return false; }
+    const int operation = mode == Mode::Shared ? LOCK_SH : LOCK_EX;
+    if(flock(lock_fd, operation | LOCK_NB) != 0) {
+        if(errno != EWOULDBLOCK) {
+            int error = errno;
+            close(lock_fd);
+            errno = error;
+            return false;
+        }
+        std::cerr << "Waiting for another bvpm to finish with " << what << "..." << std::endl;
+        while(flock(lock_fd, operation) != 0) {
+            if(errno == EINTR) { continue; }
+            int error = errno;
+            close(lock_fd);
+            errno = error;
+            return false;
+        }
+    }
+    fd = lock_fd;
+    return true;
+}
+
+void FileLock::unlock() {
+    if(fd < 0) { return; }
+    // Closing the only descriptor of the open file releases the lock
+    close(fd);
+    fd = -1;
+}
@@ -0,0 +1,251 @@
+#include <iostream>
+#include <filesystem>
+#include <memory>
+#include <algorithm>
+#include <cstdio>
+#include <curl/curl.h>
+#include <HttpClient.h>
+#include <Hash.h>
+#include <FileLock.h>
+#include <Stats.h>
+#include <debug.h>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+struct Transfer {
+    const HttpDownload* request = nullptr;
+    CURL* handle = nullptr;
+    FILE* file = nullptr;
+    std::string part_path;
+    /// Held from before the part file is opened until it is renamed into place or given up
+    FileLock part_lock;
+    Sha256 hash;
+    size_t resume_from = 0;
+    size_t written = 0;
+};
+
+size_t writeToString(char* data, size_t size, size_t nmemb, void* userdata) {
+    ((std::string*)userdata)->append(data, size * nmemb);
+    return size * nmemb;
+}
+
+size_t writeToTransfer(char* data, size_t size, size_t nmemb, void* userdata) {
+    auto* transfer = (Transfer*)userdata;
+    size_t bytes = size * nmemb;
+    if(fwrite(data, 1, bytes, transfer->file) != bytes) { return 0; }
+    transfer->hash.update(data, bytes);
+    transfer->written += bytes;
+    Stats::add(Stats::ArchiveBytesRead, bytes);
+    return bytes;
+}
+
+}
+
+HttpClient::HttpClient() {
+    static bool initialized = false;
+    if(!initialized) {
+        curl_global_init(CURL_GLOBAL_DEFAULT);
+        initialized = true;
+    }
+    multi = curl_multi_init();
+}
+
+HttpClient::~HttpClient() {
+    for(void* handle : idle_handles) { curl_easy_cleanup((CURL*)handle); }
+    curl_multi_cleanup((CURLM*)multi);
+}
+
+void* HttpClient::acquireHandle() {
+    CURL* handle;
+    if(!idle_handles.empty()) {
+        handle = (CURL*)idle_handles.back();
+        idle_handles.pop_back();
+        curl_easy_reset(handle);
+    } else {
+        handle = curl_easy_init();
+    }
+    curl_easy_setopt(handle, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(handle, CURLOPT_FAILONERROR, 1L);
+    curl_easy_setopt(handle, CURLOPT_TCP_KEEPALIVE, 1L);
+    curl_easy_setopt(handle, CURLOPT_USERAGENT, "bvpm");
+    return handle;
+}
+
+void HttpClient::releaseHandle(void* handle) {
+    idle_handles.push_back(handle);
+}
+
+bool HttpClient::fetch(const std::string& url, std::string& out) {
+    out.clear();
+    CURL* handle = (CURL*)acquireHandle();
+    curl_easy_setopt(handle, CURLOPT_URL, url.c_str());
+    curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, writeToString);
+    curl_easy_setopt(handle, CURLOPT_WRITEDATA, &out);
+    // Run through the multi handle, so that the connection ends up in the shared connection cache
+    curl_multi_add_handle((CURLM*)multi, handle);
+    int running = 1;
+    while(running) {
+        if(curl_multi_perform((CURLM*)multi, &running) != CURLM_OK) { break; }
+        if(running) { curl_multi_poll((CURLM*)multi, nullptr, 0, 1000, nullptr); }
+    }
+    CURLcode result = CURLE_OK;
+    int queued;
+    while(CURLMsg* msg = curl_multi_info_read((CURLM*)multi, &queued)) {
+        if(msg->msg == CURLMSG_DONE && msg->easy_handle == handle) { result = msg->data.result; }
+    }
+    curl_multi_remove_handle((CURLM*)multi, handle);
+    releaseHandle(handle);
+    if(result != CURLE_OK) {
+        std::cerr << "error fetching " << url << ": " << curl_easy_strerror(result) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool HttpClient::download(const std::vector<HttpDownload>& downloads, size_t parallel_limit) {
+    if(parallel_limit == 0) { parallel_limit = 1; }
+    curl_multi_setopt((CURLM*)multi, CURLMOPT_MAX_HOST_CONNECTIONS, (long)parallel_limit);
+    curl_multi_setopt((CURLM*)multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+
+    // Skip files that are already in the cache and intact. A broken file is not removed, only replaced once the new
+    // one is complete: another bvpm sharing the cache may be reading it.
+    auto cached = [](const HttpDownload& download) {
+        if(!fs::exists(download.destination)) { return false; }
+        return download.sha256.empty() || Sha256::hashFile(download.destination) == download.sha256;
+    };
+
+    // Several bvpm processes sharing a cache may want the same package, so a part file is only written while its lock
+    // is held. The locks are taken in the order of the destinations, so two processes can not wait for each other.
+    std::vector<const HttpDownload*> ordered;
+    for(const HttpDownload& download : downloads) { ordered.push_back(&download); }
+    std::sort(ordered.begin(), ordered.end(), [](const HttpDownload* a, const HttpDownload* b) { return a->destination < b->destination; });
+
+    bool passed = true;
+    std::vector<std::unique_ptr<Transfer>> pending;
+    for(const HttpDownload* download : ordered) {
+        if(cached(*download)) {
+            PRINT_DEBUG("using cached " << download->destination << std::endl);
+            continue;
+        }
+        fs::create_directories(fs::path(download->destination).parent_path());
+        auto transfer = std::make_unique<Transfer>();
+        transfer->request = download;
+        transfer->part_path = download->destination + ".part";
+        const std::string name = fs::path(download->destination).filename().generic_string();
+        if(!transfer->part_lock.lock(transfer->part_path + ".lock", FileLock::Mode::Exclusive, "the download of " + name)) {
+            perror(("error downloading " + download->url + ": cannot lock " + transfer->part_path).c_str());
+            passed = false;
+            continue;
+        }
+        // Whoever held the lock before us may have just finished the download
+        if(cached(*download)) {
+            PRINT_DEBUG("using " << download->destination << ", downloaded by another bvpm" << std::endl);
+            continue;
+        }
+        pending.push_back(std::move(transfer));
+    }
+    if(pending.empty()) { return passed; }
+
+    size_t next = 0;
+    size_t active = 0;
+    size_t done = 0;
+    auto start_transfer = [&](Transfer* transfer) -> bool {
+        // If an earlier run left a partial download, we hash what we have and ask for the rest
+        if(fs::exists(transfer->part_path)) {
+            transfer->resume_from = fs::file_size(transfer->part_path);
+            FILE* part = fopen(transfer->part_path.c_str(), "rb");
+            if(part) {
+                char buffer[64 * 1024];
+                size_t size;
+                while((size = fread(buffer, 1, sizeof(buffer), part)) > 0) { transfer->hash.update(buffer, size); }
+                fclose(part);
+            }
+            transfer->written = transfer->resume_from;
+        }
+        transfer->file = fopen(transfer->part_path.c_str(), transfer->resume_from ? "ab" : "wb");
+        if(!transfer->file) {
+            std::cerr << "error downloading " << transfer->request->url << ": cannot open " << transfer->part_path << std::endl;
+            return false;
+        }
+        transfer->handle = (CURL*)acquireHandle();
+        curl_easy_setopt(transfer->handle, CURLOPT_URL, transfer->request->url.c_str());
+        curl_easy_setopt(transfer->handle, CURLOPT_WRITEFUNCTION, writeToTransfer);
+        curl_easy_setopt(transfer->handle, CURLOPT_WRITEDATA, transfer);
+        curl_easy_setopt(transfer->handle, CURLOPT_PRIVATE, transfer);
+        if(transfer->resume_from) {
+            PRINT_DEBUG("resuming " << transfer->request->url << " at " << transfer->resume_from << std::endl);
+            curl_easy_setopt(transfer->handle, CURLOPT_RESUME_FROM_LARGE, (curl_off_t)transfer->resume_from);
+        }
+        curl_multi_add_handle((CURLM*)multi, transfer->handle);
+        active++;
+        return true;
+    };
+
+    auto finish_transfer = [&](Transfer* transfer, CURLcode result) {
+        long code = 0;
+        curl_easy_getinfo(transfer->handle, CURLINFO_RESPONSE_CODE, &code);
+        curl_multi_remove_handle((CURLM*)multi, transfer->handle);
+        releaseHandle(transfer->handle);
+        fclose(transfer->file);
+        active--;
+        done++;
+        const HttpDownload& request = *transfer->request;
+        if(result == CURLE_RANGE_ERROR && transfer->resume_from) {
+            // The server does not do range requests, so we have to start over
+            PRINT_DEBUG("server does not support ranges for " << request.url << ", restarting" << std::endl);
+            done--;
+            fs::remove(transfer->part_path);
+            transfer->hash.reset();
+            transfer->resume_from = 0;
+            transfer->written = 0;
+            if(!start_transfer(transfer)) { passed = false; }
+            return;
+        }
+        // A 416 means we asked for a range past the end, so the part file already has everything
+        if(result != CURLE_OK && !(code == 416 && transfer->resume_from)) {
+            std::cerr << "error downloading " << request.url << ": " << curl_easy_strerror(result) << std::endl;
+            passed = false;
+            return;
+        }
+        if(request.size && transfer->written != request.size) {
+            std::cerr << "error downloading " << request.url << ": expected " << request.size << " bytes, got " << transfer->written << std::endl;
+            fs::remove(transfer->part_path);
+            passed = false;
+            return;
+        }
+        if(!request.sha256.empty()) {
+            std::string hash = transfer->hash.finishHex();
+            if(hash != request.sha256) {
+                std::cerr << "error downloading " << request.url << ": hash mismatch (expected " << request.sha256 << ", got " << hash << ")" << std::endl;
+                fs::remove(transfer->part_path);
+                passed = false;
+                return;
+            }
+        }
+        fs::rename(transfer->part_path, request.destination);
+        transfer->part_lock.unlock();
+        std::cout << "\33[2K\rDownloaded " << fs::path(request.destination).filename().generic_string() << " (" << done << "/" << pending.size() << ")";
+        std::cout.flush();
+    };
+
+    while(next < pending.size() || active) {
+        while(active < parallel_limit && next < pending.size()) {
+            if(!start_transfer(pending[next].get())) { passed = false; }
+            next++;
+        }
+        int running;
+        if(curl_multi_perform((CURLM*)multi, &running) != CURLM_OK) { passed = false; break; }
+        int queued;
+        while(CURLMsg* msg = curl_multi_info_read((CURLM*)multi, &queued)) {
+            if(msg->msg != CURLMSG_DONE) { continue; }
+            Transfer* transfer;
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char**)&transfer);
+            finish_transfer(transfer, msg->data.result);
+        }
+        if(active) { curl_multi_poll((CURLM*)multi, nullptr, 0, 1000, nullptr); }
+    }
+    std::cout << std::endl;
+    return passed;
+}
@@ -0,0 +1,212 @@
+#include <iostream>
+#include <sstream>
+#include <filesystem>
+#include <HttpRepository.h>
+#include <Hash.h>
+#include <Stats.h>
+#include <config.h>
+#include <debug.h>
+#ifdef BVPM_ENABLE_ZSTD
+#include <ZstdDictionary.h>
+#endif
+
+namespace fs = std::filesystem;
+
+/// Whether a name from a remote repo.index can be used as one component of a cache path or URL
+static bool safePathComponent(const std::string& component) {
+    return !component.empty() && component.find('/') == std::string::npos && component.find("..") == std::string::npos
+        && component.find('\0') == std::string::npos;
+}
+
+HttpRepository::HttpRepository(std::string _name, std::string _url, std::string _cache_path, size_t _parallel_downloads)
+    : Repository(std::move(_name)), url(std::move(_url)), parallel_downloads(_parallel_downloads) {
+    while(!url.empty() && url.back() == '/') { url.pop_back(); }
+    PRINT_DEBUG("http repo url: " << url << std::endl);
+
+    std::string data;
+    if(!client.fetch(url + "/repo.manifest", data)) {
+        std::cerr << "error reading http repository " << url << ": missing manifest file" << std::endl;
+        _good = false;
+        return;
+    }
+    std::istringstream manifest_stream(data);
+    ConfigFile repo_manifest = Config::readFromStream(manifest_stream);
+    if(repo_manifest.values.find("NAME") != repo_manifest.values.end()) {
+        name = repo_manifest.values["NAME"];
+    }
+
+    if(!client.fetch(url + "/repo.index", data)) {
+        std::cerr << "error reading http repository " << url << ": missing index file" << std::endl;
+        _good = false;
+        return;
+    }
+    std::istringstream index_stream(data);
+    if(!index.readFromStream(index_stream)) {
+        _good = false;
+        return;
+    }
+    // The names end up in paths in the cache folder, and bvp files are only taken with the hash to check them against
+    for(auto it = index.packages.begin(); it != index.packages.end();) {
+        const RepositoryIndexEntry& entry = it->second;
+        if(!safePathComponent(entry.name) || !safePathComponent(entry.filename)) {
+            std::cerr << "warning: ignoring package \"" << entry.name << "\" of http repository " << url
+                      << ": invalid package or file name" << std::endl;
+            it = index.packages.erase(it);
+        } else if(entry.sha256.empty()) {
+            std::cerr << "warning: ignoring package " << entry.name << " of http repository " << url
+                      << ": no SHA-256 in repo.index" << std::endl;
+            it = index.packages.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    // Every repository gets its own cache folder, named after its URL
+    std::string folder_name;
+    for(char c : url.substr(url.find("://") + 3)) {
+        folder_name += std::isalnum((unsigned char)c) ? c : '_';
+    }
+    cache_path = (fs::path(_cache_path) / folder_name).generic_string();
+
+#ifdef BVPM_ENABLE_ZSTD
+    // The zstd dictionaries packages may be compressed with are fetched once, and kept in the cache from then on
+    const std::string dictionaries_path = (fs::path(cache_path) / "dictionaries").generic_string();
+    std::vector<HttpDownload> downloads;
+    std::stringstream ss(repo_manifest.values["DICTIONARIES"]);
+    std::string id;
+    while(std::getline(ss, id, ',')) {
+        if(id.empty()) { continue; }
+        // The ID is a file name, and a dictionary serves every package naming its ID, from whichever repository
+        const std::string sha256 = repo_manifest.values["DICTIONARY_SHA256_" + id];
+        if(id.size() > 10 || id.find_first_not_of("0123456789") != std::string::npos || sha256.empty()) {
+            std::cerr << "warning: ignoring zstd dictionary \"" << id << "\" of http repository " << url
+                      << ": not a dictionary ID with a DICTIONARY_SHA256_ in repo.manifest" << std::endl;
+            continue;
+        }
+        HttpDownload download;
+        download.url = url + "/dictionaries/" + id + ".zdict";
+        download.destination = dictionaries_path + "/" + id + ".zdict";
+        download.sha256 = sha256;
+        downloads.push_back(download);
+    }
+    // Cached dictionaries are checked against their hash too. Packages that need a missing dictionary fail when they
+    // are read; the others can still be installed. A cache that did not check out is not used at all.
+    if(!downloads.empty() && !client.download(downloads, parallel_downloads)) {
+        std::cerr << "warning: could not fetch the zstd dictionaries of http repository " << url << std::endl;
+    } else if(!downloads.empty()) {
+        ZstdDictionaries::addFolder(dictionaries_path);
+    }
+#endif
+}
+
+bool HttpRepository::checkIfPackageIsAvailable(const std::string& package_name) {
+    Stats::add(Stats::RepositoryLookups);
+    return good() && index.find(package_name) != nullptr;
+}
+
+bool HttpRepository::listPackages(std::vector<std::pair<std::string, std::string>>& packages) {
+    if(!good()) { return false; }
+    for(const auto& package : index.packages) {
+        packages.emplace_back(package.first, package.second.version);
+    }
+    return true;
+}
+
+std::string HttpRepository::packageURL(const RepositoryIndexEntry& entry) const {
+    return url + "/packages/" + entry.name + "/" + entry.filename;
+}
+
+std::string HttpRepository::packageCachePath(const RepositoryIndexEntry& entry) const {
+    return (fs::path(cache_path) / entry.name / entry.filename).generic_string();
+}
+
+bool HttpRepository::preparePackage(const std::string& package) {
+    return preparePackages({package});
+}
+
+bool HttpRepository::preparePackages(const std::vector<std::string>& packages) {
+    if(!good()) { return false; }
+    std::vector<HttpDownload> downloads;
+    for(const std::string& package : packages) {
+        const RepositoryIndexEntry* entry = index.find(package);
+        if(!entry) {
+            std::cerr << "error preparing package " << package << ": not in repository " << name << std::endl;
+            return false;
+        }
+        if(entry->sha256.empty()) {
+            std::cerr << "error preparing package " << package << ": repository " << name << " has no hash for it" << std::endl;
+            return false;
+        }
+        HttpDownload download;
+        download.url = packageURL(*entry);
+        download.destination = packageCachePath(*entry);
+        download.sha256 = entry->sha256;
+        download.size = entry->file_size;
+        downloads.push_back(download);
+    }
+    return client.download(downloads, parallel_downloads);
+}
+
+bool HttpRepository::packageGood(const std::string& package_name) {
+    const RepositoryIndexEntry* entry = index.find(package_name);
+    if(!entry || entry->sha256.empty()) { return false; }
+    std::string path = packageCachePath(*entry);
+    if(!fs::exists(path)) { return false; }
+    return Sha256::hashFile(path) == entry->sha256;
+}
+
+std::string HttpRepository::getPackageBVPFilePath(const std::string& package_name) {
+    const RepositoryIndexEntry* entry = index.find(package_name);
+    if(!entry) { return ""; }
+    return packageCachePath(*entry);
+}
+
+std::string HttpRepository::getPackageVersion(const std::string& package_name) {
+    const RepositoryIndexEntry* entry = index.find(package_name);
+    if(!entry) { return ""; }
+    return entry->version;
+}
+
+size_t HttpRepository::getPackageFileSize(const std::string& package_name) {
+    const RepositoryIndexEntry* entry = index.find(package_name);
+    if(!entry) { return 0; }
+    return entry->file_size;
+}
+
+size_t HttpRepository::getPackageTotalSize(const std::string& package_name) {
+    const RepositoryIndexEntry* entry = index.find(package_name);
+    if(!entry) { return 0; }
+    return entry->installed_size;
+}
+
+std::vector<std::string> HttpRepository::getPackageDependencies(const std::string& package_name) {
+    const RepositoryIndexEntry* entry = index.find(package_name);
+    if(!entry) { return {}; }
+    return entry->dependencies;
+}
+
+std::string HttpRepository::getPackageHash(const std::string& package_name) {
+    const RepositoryIndexEntry* entry = index.find(package_name);
+    if(!entry) { return ""; }
+    return entry->sha256;
+}
+
+bool HttpRepository::getPackageClosure(const std::string& package_name, std::vector<std::string>& closure) {
+    return good() && index.getClosure(package_name, closure);
+}
+
+bool HttpRepository::getPackageFiles(const std::string& package_name, std::vector<RepositoryFile>& files) {
+    const RepositoryIndexEntry* entry = good() ? index.find(package_name) : nullptr;
+    if(!entry) { return false; }
+    if(!file_index_fetched) {
+        file_index_fetched = true;
+        // Repositories from before repo.files have none; their packages are simply not checked up front
+        std::string data;
+        if(client.fetch(url + "/repo.files", data)) {
+            std::istringstream stream(data);
+            file_index.readFromStream(stream);
+        } else {
+            PRINT_DEBUG("http repo " << url << " has no file index" << std::endl);
+        }
+    }
+    return file_index.getFiles(package_name, entry->sha256, files);
+}
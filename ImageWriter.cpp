@@ -0,0 +1,240 @@
+#include <iostream>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <ImageWriter.h>
+#include <Stats.h>
+
+namespace fs = std::filesystem;
+
+static constexpr size_t copy_buffer_size = 256 * 1024;
+
+ImageWriter::ImageWriter(const std::string& root, std::string image)
+    : image_path(std::move(image)), temporary_path(image_path + ".part"), buffer(copy_buffer_size) {
+    std::string folder = root;
+    while(folder.size() > 1 && folder.back() == '/') { folder.pop_back(); }
+    root_prefix = folder == "/" ? folder : folder + "/";
+}
+
+ImageWriter::~ImageWriter() {
+    if(!out) { return; }
+    // finish() was never called, so the image is not complete
+    archive_write_free(out);
+    unlink(temporary_path.c_str());
+}
+
+bool ImageWriter::open() {
+    out = archive_write_new();
+    if(archive_write_set_format_filter_by_ext(out, image_path.c_str()) != ARCHIVE_OK) {
+        // Not an extension libarchive knows; a failed attempt may leave the writer half set up, so we start over
+        archive_write_free(out);
+        out = archive_write_new();
+        archive_write_set_format_pax_restricted(out);
+        const std::string extension = fs::path(image_path).extension().generic_string();
+        if(extension == ".zst" || extension == ".tzst") { archive_write_add_filter_zstd(out); }
+    }
+    if(archive_write_open_filename(out, temporary_path.c_str()) != ARCHIVE_OK) {
+        std::cout << "error creating image " << image_path << ": " << archive_error_string(out) << std::endl;
+        archive_write_free(out);
+        out = nullptr;
+        return false;
+    }
+    return true;
+}
+
+std::string ImageWriter::imagePath(const std::string& path) const {
+    if(path.compare(0, root_prefix.size(), root_prefix) != 0) { return ""; }
+    size_t start = root_prefix.size();
+    while(start < path.size() && path[start] == '/') { start++; }
+    size_t end = path.size();
+    while(end > start && path[end - 1] == '/') { end--; }
+    return path.substr(start, end - start);
+}
+
+bool ImageWriter::writeHeader(struct archive_entry* entry) {
+    if(archive_write_header(out, entry) < ARCHIVE_WARN) {
+        std::cout << "error writing " << archive_entry_pathname(entry) << " to image " << image_path << ": " << archive_error_string(out) << std::endl;
+        failed = true;
+        return false;
+    }
+    return true;
+}
+
+bool ImageWriter::writeData(const char* data, size_t size) {
+    while(size > 0) {
+        la_ssize_t written = archive_write_data(out, data, size);
+        if(written <= 0) {
+            std::cout << "error writing to image " << image_path << ": " << archive_error_string(out) << std::endl;
+            failed = true;
+            return false;
+        }
+        data += written;
+        size -= written;
+    }
+    return true;
+}
+
+void ImageWriter::writeParents(const std::string& path) {
+    size_t slash = 0;
+    while((slash = path.find('/', slash + 1)) != std::string::npos) {
+        std::string folder = path.substr(0, slash);
+        if(!folders.insert(folder).second) { continue; }
+        struct archive_entry* entry = archive_entry_new();
+        archive_entry_set_pathname(entry, folder.c_str());
+        archive_entry_set_filetype(entry, AE_IFDIR);
+        archive_entry_set_size(entry, 0);
+        archive_entry_set_perm(entry, 0777 & ~umask_bits);
+        archive_entry_set_uid(entry, 0);
+        archive_entry_set_gid(entry, 0);
+        archive_entry_set_uname(entry, "root");
+        archive_entry_set_gname(entry, "root");
+        archive_entry_set_mtime(entry, time(nullptr), 0);
+        writeHeader(entry);
+        archive_entry_free(entry);
+        Stats::add(Stats::DirectoriesCreated);
+    }
+}
+
+void ImageWriter::writeFolder(const std::string& path) {
+    std::string folder = imagePath(path);
+    if(folder.empty() || folders.count(folder)) { return; }
+    // Going through the parents of a file in the folder writes the folder itself as well
+    writeParents(folder + "/");
+}
+
+bool ImageWriter::writeEntry(struct archive* a, struct archive_entry* entry) {
+    const std::string path = imagePath(archive_entry_pathname(entry));
+    if(path.empty()) {
+        std::cout << "error writing " << archive_entry_pathname(entry) << " to image " << image_path << ": not in the image root" << std::endl;
+        failed = true;
+        return false;
+    }
+    writeParents(path);
+    struct archive_entry* image_entry = archive_entry_clone(entry);
+    archive_entry_set_pathname(image_entry, path.c_str());
+    // Hard links in a package point at its root/ members
+    const char* hardlink = archive_entry_hardlink(entry);
+    if(hardlink && strncmp(hardlink, "root/", strlen("root/")) == 0) { archive_entry_set_hardlink(image_entry, hardlink + strlen("root/")); }
+    archive_entry_set_uid(image_entry, 0);
+    archive_entry_set_gid(image_entry, 0);
+    archive_entry_set_uname(image_entry, "root");
+    archive_entry_set_gname(image_entry, "root");
+    if(archive_entry_filetype(image_entry) == AE_IFDIR) { folders.insert(path); }
+    bool ok = writeHeader(image_entry);
+    archive_entry_free(image_entry);
+    if(!ok || archive_entry_filetype(entry) != AE_IFREG || hardlink) { return ok; }
+    la_ssize_t read;
+    while((read = archive_read_data(a, buffer.data(), buffer.size())) > 0) {
+        if(!writeData(buffer.data(), read)) { return false; }
+    }
+    if(read < 0) {
+        std::cout << "error reading " << path << " for image " << image_path << ": " << archive_error_string(a) << std::endl;
+        failed = true;
+        return false;
+    }
+    return true;
+}
+
+static bool sameTime(const struct timespec& a, const struct timespec& b) {
+    return a.tv_sec == b.tv_sec && a.tv_nsec == b.tv_nsec;
+}
+
+void ImageWriter::recordRoot() {
+    recorded.clear();
+    const std::string root = root_prefix == "/" ? root_prefix : root_prefix.substr(0, root_prefix.size() - 1);
+    std::error_code ec;
+    for(fs::recursive_directory_iterator it(root, fs::directory_options::skip_permission_denied, ec), end; !ec && it != end; it.increment(ec)) {
+        const std::string source = it->path().generic_string();
+        struct stat st{};
+        Stats::add(Stats::StatCalls);
+        if(lstat(source.c_str(), &st) != 0) { continue; }
+        recorded[source] = {st.st_ino, st.st_mode, st.st_size, st.st_mtim, st.st_ctim};
+    }
+}
+
+bool ImageWriter::addChangedFiles() {
+    struct archive* disk = archive_read_disk_new();
+    archive_read_disk_set_standard_lookup(disk);
+    const std::string root = root_prefix == "/" ? root_prefix : root_prefix.substr(0, root_prefix.size() - 1);
+    std::error_code ec;
+    for(fs::recursive_directory_iterator it(root, fs::directory_options::skip_permission_denied, ec), end; !ec && it != end; it.increment(ec)) {
+        const std::string source = it->path().generic_string();
+        struct stat st{};
+        Stats::add(Stats::StatCalls);
+        if(lstat(source.c_str(), &st) != 0) { continue; }
+        auto before = recorded.find(source);
+        if(before != recorded.end() && before->second.mode == st.st_mode) {
+            const FileState& state = before->second;
+            // A folder that got files added or removed is still the same folder; its entry is in the image already
+            if(S_ISDIR(st.st_mode)) { continue; }
+            if(state.inode == st.st_ino && state.size == st.st_size && sameTime(state.mtime, st.st_mtim) && sameTime(state.ctime, st.st_ctim)) { continue; }
+        }
+        const std::string path = imagePath(source);
+        if(path.empty()) { continue; }
+        struct archive_entry* entry = archive_entry_new();
+        archive_entry_copy_sourcepath(entry, source.c_str());
+        if(archive_read_disk_entry_from_file(disk, entry, -1, &st) < ARCHIVE_WARN) {
+            std::cout << "error reading " << source << " for image " << image_path << ": " << archive_error_string(disk) << std::endl;
+            archive_entry_free(entry);
+            failed = true;
+            continue;
+        }
+        archive_entry_set_pathname(entry, path.c_str());
+        writeParents(path);
+        if(S_ISDIR(st.st_mode)) { folders.insert(path); }
+        bool ok = writeHeader(entry);
+        archive_entry_free(entry);
+        if(!ok || !S_ISREG(st.st_mode) || st.st_size == 0) { continue; }
+        int fd = ::open(source.c_str(), O_RDONLY | O_CLOEXEC);
+        if(fd < 0) {
+            perror(("error reading " + source + " for image").c_str());
+            failed = true;
+            continue;
+        }
+        // The header promised st_size bytes, and that is what goes in, even if the file changes under us
+        size_t left = st.st_size;
+        while(ok && left > 0) {
+            ssize_t read = ::read(fd, buffer.data(), std::min(left, buffer.size()));
+            if(read < 0 && errno == EINTR) { continue; }
+            if(read <= 0) { break; }
+            ok = writeData(buffer.data(), read);
+            left -= read;
+        }
+        close(fd);
+        if(ok && left > 0) {
+            std::cout << "error reading " << source << " for image " << image_path << ": file shrank while being read" << std::endl;
+            failed = true;
+        }
+        if(ok && left == 0) { Stats::add(Stats::FilesCreated); }
+    }
+    archive_read_free(disk);
+    if(ec) {
+        std::cout << "error reading " << root << " for image " << image_path << ": " << ec.message() << std::endl;
+        failed = true;
+    }
+    return !failed;
+}
+
+bool ImageWriter::finish() {
+    if(!out) { return false; }
+    if(archive_write_close(out) != ARCHIVE_OK) {
+        std::cout << "error writing image " << image_path << ": " << archive_error_string(out) << std::endl;
+        failed = true;
+    }
+    archive_write_free(out);
+    out = nullptr;
+    if(failed) {
+        unlink(temporary_path.c_str());
+        return false;
+    }
+    if(rename(temporary_path.c_str(), image_path.c_str()) != 0) {
+        perror(("error moving image into place at " + image_path).c_str());
+        unlink(temporary_path.c_str());
+        return false;
+    }
+    return true;
+}
@@ -3,30 +3,72 @@
 #include <iostream>
 #include <cstring>
 #include <filesystem>
+#include <set>
+#include <fstream>
+#include <unordered_map>
 #include <debug.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
 #include <human-readable.h>
+#include <Stats.h>
+#include <OwnedFilesIndex.h>
+#include <OwnerIndex.h>
+#include <ImageWriter.h>
+#include <InstallPlan.h>
+#include <Hash.h>
+#include <Version.h>
+#ifdef BVPM_ENABLE_HTTP
+#include <HttpClient.h>
+#endif
 
 namespace fs = std::filesystem;
 
+InstallEngine::InstallEngine(const std::string root, ConfigFile global_config_file)
+    : dependencyEngine(root), repositoryEngine(global_config_file, root), install_root(root) {
+    auto threshold = global_config_file.values.find("STREAMING_INSTALL_THRESHOLD");
+    if(threshold != global_config_file.values.end()) { streaming_threshold = std::strtoull(threshold->second.c_str(), nullptr, 10); }
+    archive_io = ArchiveReader::backendFromConfig(global_config_file);
+    disk_writer = DiskWriter::backendFromConfig(global_config_file);
+}
+
 bool InstallEngine::AddPackageFile(std::string package) {
     PRINT_DEBUG("adding package file " << package << " to install engine list" << std::endl);
     std::cout << "\33[2K\rAdding package " << package;
     std::cout.flush();
-    // TODO: add network package support
+    // Package files given as URLs are downloaded into the cache first
+    if(package.rfind("http://", 0) == 0 || package.rfind("https://", 0) == 0) {
+#ifdef BVPM_ENABLE_HTTP
+        HttpDownload download;
+        download.url = package;
+        download.destination = install_root + "/var/cache/bvpm/files/" + fs::path(package).filename().generic_string();
+        HttpClient client;
+        std::cout << std::endl;
+        if(!client.download({download}, 1)) { return false; }
+        package = download.destination;
+#else
+        std::cout << std::endl << "error adding package " << package << ": this bvpm was built without http support" << std::endl;
+        return false;
+#endif
+    }
     PackageFile file;
+    file.streaming_threshold = streaming_threshold;
+    file.archive_io = archive_io;
     if(!file.readFile(package)) { return false; }
 
     // We now also check if we even need to install this
     // If this package is installed, then a config read of /etc/bvpm/packages/x/manifest should work
     ConfigFile installed_manifest = Config::readConfigFile(install_root + "/etc/bvpm/packages/" + file.name + "/manifest");
     if(installed_manifest.values.find("failed") == installed_manifest.values.end()) {
+        Stats::add(Stats::ManifestsParsed);
         // This package is already installed
         // If the version is the same as this package
         // Exception: if this package has no version, we let it install
         if(installed_manifest.values.find("VERSION") != installed_manifest.values.end()) {
-            if(installed_manifest.values["VERSION"] == file.version) {
+            if(Version::compare(installed_manifest.values["VERSION"], file.version) == 0) {
                 std::cout << std::endl << "Package " << file.name << " of same version is already installed, skipping" << std::endl;
+                already_installed.push_back(file.name);
                 return true; // We return true here since this is not a fatal error
             }
         }
@@ -34,10 +76,8 @@ bool InstallEngine::AddPackageFile(std::string package) {
 
     std::cout << "\33[2K\rDone reading package " << package;
     std::cout.flush();
-    archive_read_close(file.a);
-    archive_read_free(file.a);
 
-    package_list.push_back(file);
+    package_list.push_back(std::move(file));
     return true;
 }
 
@@ -54,12 +94,14 @@ bool InstallEngine::AddPackage(const std::string& package_name) {
     // If this package is installed, then a config read of /etc/bvpm/packages/x/manifest should work
     ConfigFile installed_manifest = Config::readConfigFile(install_root + "/etc/bvpm/packages/" + package_name + "/manifest");
     if(installed_manifest.values.find("failed") == installed_manifest.values.end()) {
+        Stats::add(Stats::ManifestsParsed);
         // This package is already installed
         // If the version is the same as this package
         // Exception: if this package has no version, we let it install
         if(installed_manifest.values.find("VERSION") != installed_manifest.values.end()) {
-            if(installed_manifest.values["VERSION"] == repositoryEngine.getPackageVersion(package_name)) {
+            if(Version::compare(installed_manifest.values["VERSION"], repositoryEngine.getPackageVersion(package_name)) == 0) {
                 std::cout << std::endl << "Package " << package_name << " of same version is already installed, skipping" << std::endl;
+                already_installed.push_back(package_name);
                 return true; // We return true here since this is not a fatal error
             }
         }
@@ -69,49 +111,44 @@ bool InstallEngine::AddPackage(const std::string& package_name) {
     return true;
 }
 
+size_t InstallEngine::AddUpgrades() {
+    // One pass over the installed packages, looking every one up in the repositories' package table
+    size_t upgrades = 0;
+    for(const auto& installed : dependencyEngine.GetInstalledPackages()) {
+        const std::string& name = installed.first;
+        if(!repositoryEngine.isPackageInRepos(name)) { continue; }
+        const std::string available = repositoryEngine.getPackageVersion(name);
+        if(Version::compare(available, installed.second) <= 0) { continue; }
+        std::cout << "Package " << name << " can be upgraded from " << installed.second << " to " << available << std::endl;
+        packages_by_name_list.push_back(name);
+        upgrades++;
+    }
+    return upgrades;
+}
+
 bool InstallEngine::VerifyIntegrity() {
-    for(PackageFile package : package_list) {
+    for(PackageFile& package : package_list) {
         // We now reopen the archive
-        package.a = archive_read_new();
-        archive_read_support_format_all(package.a);
-        archive_read_support_filter_all(package.a);
-        if(archive_read_open_filename(package.a, package.path.c_str(), 1024) != ARCHIVE_OK) {
+        ArchiveHandle a = ArchiveReader::open(package.path, archive_io);
+        if(!a) {
             std::cout << "error installing package " << package.name << ": archive not ok" << std::endl;
             continue;
         }
+        Stats::add(Stats::ArchivesOpened);
     }
     return true;
 }
 
-// I copied this from the libarchive examples
-// TODO: replace this
-static int copy_data(struct archive *ar, struct archive *aw) {
-    int r;
-    const void *buff;
-    size_t size;
-    la_int64_t offset;
-
-    for (;;) {
-        r = archive_read_data_block(ar, &buff, &size, &offset);
-        if (r == ARCHIVE_EOF)
-            return (ARCHIVE_OK);
-        if (r < ARCHIVE_OK)
-            return (r);
-        r = archive_write_data_block(aw, buff, size, offset);
-        if (r < ARCHIVE_OK) {
-            fprintf(stderr, "%s\n", archive_error_string(aw));
-            return (r);
-        }
-    }
-}
-
 bool InstallEngine::GetUserPermission() {
     if(empty()) { return false; }
     std::cout << "The following packages will be installed: " << std::endl;
     size_t total_size = 0;
     size_t total_file_size = 0;
     for(const SimplePackageData& package : all_packages_to_install) {
-        std::cout << "\t" << package.name << " (size: " << humanSize(package.total_package_bytes) << ", file size: " << humanSize(package.total_package_file_bytes) << ")" << std::endl;
+        std::cout << "\t" << package.name << " (size: " << humanSize(package.total_package_bytes) << ", file size: " << humanSize(package.total_package_file_bytes) << ")";
+        auto changes = upgrade_changes.find(package.name);
+        if(changes != upgrade_changes.end()) { std::cout << "; upgrade: " << changes->second; }
+        std::cout << std::endl;
         total_size += package.total_package_bytes;
         total_file_size += package.total_package_file_bytes;
     }
@@ -131,9 +168,14 @@ bool InstallEngine::GetUserPermission() {
 }
 
 bool InstallEngine::Execute() {
-    // Prepare the packages
+    // Prepare the packages, all at once so that remote repositories can download them in parallel
+    std::vector<std::string> packages_to_prepare;
     for(const SimplePackageData& package : all_packages_to_install) {
-        if(!package.from_file) { repositoryEngine.preparePackage(package.name); }
+        if(!package.from_file) { packages_to_prepare.push_back(package.name); }
+    }
+    if(!packages_to_prepare.empty() && !repositoryEngine.preparePackages(packages_to_prepare)) {
+        std::cout << "Failed to fetch packages, bailing" << std::endl;
+        return false;
     }
 
     // Read the package
@@ -141,48 +183,104 @@ bool InstallEngine::Execute() {
         if(package.from_file) { continue; }
         std::string path_to_bvp_file = repositoryEngine.getBVPFileForPackage(package.name);
         PackageFile file;
+        file.streaming_threshold = streaming_threshold;
+        file.archive_io = archive_io;
         if(!file.readFile(path_to_bvp_file, package.name)) {
             exit(-1);
         }
-        package_list.push_back(file);
+        package_list.push_back(std::move(file));
     }
 
     VerifyIntegrity();
 
-    std::vector<PackageFile> afterinstall_script_list;
-    for(PackageFile package : package_list) {
+    // An upgraded package's old triggers are replaced by those of the new version
+    std::set<std::string> installing;
+    for(const PackageFile& package : package_list) { installing.insert(package.name); }
+    triggers.addInstalled(install_root, installing);
+    for(const PackageFile& package : package_list) { triggers.addManifest(package.manifest); }
+
+    if(!image_path.empty()) { return ExecuteImage(); }
+    std::vector<const PackageFile*> afterinstall_script_list;
+    // One writer for the whole transaction, so that writes of small packages get batched together
+    std::unique_ptr<DiskWriter> writer = DiskWriter::create(disk_writer);
+    WritePackages(*writer, afterinstall_script_list);
+    // The writer may still have files in flight; they have to be there before any after install script runs
+    if(!writer->finish()) { std::cout << "error: some files could not be written" << std::endl; }
+    writer.reset();
+    UpdateIndexes();
+    RunAfterInstallScripts(afterinstall_script_list);
+    triggers.run(install_root);
+    return true;
+}
+
+bool InstallEngine::ExecuteImage() {
+    ImageWriter image(install_root, image_path);
+    if(!image.open()) { return false; }
+    std::vector<const PackageFile*> afterinstall_script_list;
+    WritePackages(image, afterinstall_script_list);
+    if(!afterinstall_script_list.empty() || triggers.pending()) {
+        // The scripts and triggers need the files of the transaction to run against, so only for them the packages
+        // also get installed into the install root, which serves as the scratch root. What they change there goes
+        // into the image after the package entries.
+        std::cout << "Installing into " << install_root << " for the after install scripts and triggers" << std::endl;
+        std::unique_ptr<DiskWriter> writer = DiskWriter::create(disk_writer);
+        std::vector<const PackageFile*> listed_already;
+        WritePackages(*writer, listed_already);
+        if(!writer->finish()) { std::cout << "error: some files could not be written" << std::endl; }
+        writer.reset();
+        UpdateIndexes();
+        // Everything that differs from here on is the scripts' and triggers' doing
+        image.recordRoot();
+        RunAfterInstallScripts(afterinstall_script_list);
+        triggers.run(install_root);
+        std::cout << "Adding the files the after install scripts and triggers changed to the image" << std::endl;
+        if(!image.addChangedFiles()) {
+            std::cout << "error: the files the after install scripts and triggers changed could not be added to the image" << std::endl;
+        }
+    }
+    if(!image.finish()) {
+        std::cout << "error: the image " << image_path << " could not be written" << std::endl;
+        return false;
+    }
+    std::cout << "Wrote image " << image_path << std::endl;
+    return true;
+}
+
+void InstallEngine::UpdateIndexes() {
+    std::vector<const ConfigFile*> manifests;
+    std::set<std::string> names;
+    for(const PackageFile& package : package_list) {
+        manifests.push_back(&package.manifest);
+        names.insert(package.name);
+    }
+    TriggerSet::updateInstalled(install_root, manifests, {});
+    OwnerIndex::updateInstalled(install_root, names, {});
+}
+
+void InstallEngine::WritePackages(DiskWriter& writer, std::vector<const PackageFile*>& afterinstall_script_list) {
+    for(PackageFile& package : package_list) {
         std::cout << "Operating on " << package.name << '\r';
         std::cout.flush();
         // We mkdir all the folders first
-        for(std::string folder : package.folders) {
-            folder = install_root + "/" + folder;
-            PRINT_DEBUG("creating folder " << folder << std::endl);
-            if(!fs::exists(folder)) {
-                fs::create_directories(folder);
-            }
-        }
+        // Streaming packages have no folder list; their folders get created as we come across them
+        package.folders.forEach([&](const std::string& folder) { writer.writeFolder(install_root + "/" + folder); });
 
         // We now copy the files
-        // To do this we re-create the libarchive archive
-        int flags = ARCHIVE_EXTRACT_TIME | ARCHIVE_EXTRACT_ACL | ARCHIVE_EXTRACT_PERM | ARCHIVE_EXTRACT_FFLAGS;
-        package.a = archive_read_new();
-        archive_read_support_format_all(package.a);
-        archive_read_support_filter_all(package.a);
-        struct archive* extract;
-
-        // We create the libarchive extractor thing
-        extract = archive_write_disk_new();
-        archive_write_disk_set_options(extract, flags);
-        archive_write_disk_set_standard_lookup(extract);
-        if(archive_read_open_filename(package.a, package.path.c_str(), 1024) != ARCHIVE_OK) {
+        // To do this we re-open the archive
+        package.a = ArchiveReader::open(package.path, archive_io);
+        if(!package.a) {
             std::cout << "error installing package " << package.name << ": archive not ok" << std::endl;
             continue;
         }
+        Stats::add(Stats::ArchivesOpened);
+        // Members of uncompressed packages get copied straight from the package file
+        int source = ArchiveReader::isDecompressedByBvpm(package.path) ? -1 : open(package.path.c_str(), O_RDONLY | O_CLOEXEC);
+        writer.setSource(source);
 
         // We now stream through the archive again
         struct archive_entry* file_entry;
         size_t copied_files = 0;
-        while(archive_read_next_header(package.a, &file_entry) == ARCHIVE_OK) {
+        while(archive_read_next_header(package.a.get(), &file_entry) == ARCHIVE_OK) {
             const char* name = archive_entry_pathname(file_entry);
             if(strcmp(name, "manifest") == 0 || strcmp(name, "owned-files") == 0 || strcmp(name, "afterinstall.sh") == 0 || strcmp(name, "sums") == 0) {
                 // We copy the manifest to a specific folder
@@ -197,16 +295,16 @@ bool InstallEngine::Execute() {
 
                 archive_entry_set_pathname(extracted_entry, path_string.c_str());
                 // We can now begin copying the data
-                archive_write_header(extract, extracted_entry);
-                copy_data(package.a, extract);
-                archive_write_finish_entry(extract);
+                if(writer.writeEntry(package.a.get(), extracted_entry)) { Stats::add(Stats::FilesCreated); }
+                archive_entry_free(extracted_entry);
             }
             if(strncmp(name, "root/", strlen("root/")) == 0) {
                 // Create a std::string and chop the root/ off
                 std::string name_str(name + strlen("root/"));
                 if(name_str.empty()) { continue; }
-                if(name[strlen(name) - 1] == '/') {
-                    // We dont care about folders anymore
+                if(name[strlen(name) - 1] == '/' || archive_entry_filetype(file_entry) == AE_IFDIR) {
+                    // Folders of non-streaming packages have been created already
+                    if(package.streaming) { writer.writeFolder(install_root + "/" + name_str); }
                 } else {
                    PRINT_DEBUG("extracting in root: " << name_str << std::endl);
                    struct archive_entry* extracted_entry;
@@ -217,27 +315,31 @@ bool InstallEngine::Execute() {
 
                    archive_entry_set_pathname(extracted_entry, path_string.c_str());
                    // We can now begin copying the data
-                   archive_write_header(extract, extracted_entry);
-                   copy_data(package.a, extract);
-                   archive_write_finish_entry(extract);
-                   std::cout << "\33[2K\rOperating on " << package.name << ": " << ++copied_files << "/" << package.files.size() << '\r';
+                   if(writer.writeEntry(package.a.get(), extracted_entry)) { Stats::add(Stats::FilesCreated); }
+                   archive_entry_free(extracted_entry);
+                   triggers.match(name_str);
+                   std::cout << "\33[2K\rOperating on " << package.name << ": " << ++copied_files << "/" << package.file_count << '\r';
                    std::cout.flush();
                 }
             }
         }
-        archive_read_close(package.a);
-        archive_read_free(package.a);
-        archive_write_close(extract);
-        archive_write_free(extract);
+        Stats::add(Stats::ArchiveBytesRead, archive_filter_bytes(package.a.get(), -1));
+        Stats::add(Stats::ArchiveBytesDecompressed, archive_filter_bytes(package.a.get(), 0));
+        package.a.reset();
+        writer.setSource(-1);
+        if(source >= 0) { close(source); }
 
         // If this package has an after install script, we run it now
         if(package.has_after_install) {
-            afterinstall_script_list.push_back(package);
+            afterinstall_script_list.push_back(&package);
         }
         std::cout << "\33[2K\rDone operating on " << package.name << std::endl;
     }
-    if(afterinstall_script_list.empty()) { return true; }
-    for(PackageFile package : afterinstall_script_list) {
+}
+
+void InstallEngine::RunAfterInstallScripts(const std::vector<const PackageFile*>& afterinstall_script_list) {
+    for(const PackageFile* package_pointer : afterinstall_script_list) {
+        const PackageFile& package = *package_pointer;
         std::cout << "Running after install script for " << package.name << std::endl;
         std::cout.flush();
         // Generic fork/exec/wait
@@ -267,7 +369,6 @@ bool InstallEngine::Execute() {
         std::cout << "\33[2K\rDone runinng after install for " << package.name << std::endl;
         std::cout.flush();
     }
-    return true;
 }
 
 bool InstallEngine::VerifyPossible() {
@@ -282,13 +383,242 @@ bool InstallEngine::VerifyPossible() {
     if(!dependencyEngine.CheckDependencies(all_packages_to_install, repositoryEngine)) { return false; }
     // We now check and make sure that all files the packages want to install dont already exist
     bool passed = true;
-    for(PackageFile package : package_list) {
-        for(std::string file : package.files) {
-            if(fs::exists(fs::path(install_root + file))) {
-                std::cout << "Error: file " << install_root + file << " (part of package " << package.name << ") already exists" << std::endl;
+    for(const PackageFile& package : package_list) {
+        passed = CheckConflicts(package) && passed;
+    }
+    return CheckRepositoryPackages() && passed;
+}
+
+bool InstallEngine::WritePlan(const std::string& file) {
+    InstallPlan plan;
+    // The steps are in the order Execute() installs them in: package files first, then the packages from the repositories
+    for(const PackageFile& package : package_list) {
+        InstallPlanStep step;
+        step.name = package.name;
+        step.version = package.version;
+        step.installed_size = package.total_package_bytes;
+        step.file_size = package.total_package_file_bytes;
+        step.dependencies = package.dependencies;
+        step.file = fs::absolute(package.path).generic_string();
+        step.sha256 = Sha256::hashFile(package.path);
+        if(step.sha256.empty()) {
+            std::cout << "error writing plan: could not read " << package.path << std::endl;
+            return false;
+        }
+        plan.steps.push_back(std::move(step));
+    }
+    for(const SimplePackageData& package : all_packages_to_install) {
+        if(package.from_file) { continue; }
+        InstallPlanStep step;
+        step.name = package.name;
+        step.version = package.version;
+        step.installed_size = package.total_package_bytes;
+        step.file_size = package.total_package_file_bytes;
+        step.dependencies = package.dependencies;
+        step.sha256 = package.file_hash;
+        plan.steps.push_back(std::move(step));
+    }
+
+    // Everything the resolution looked at: the packages themselves, their dependencies from outside the plan,
+    // and the packages left out because they were installed already
+    std::set<std::string> recorded;
+    auto record = [&](const std::string& name) {
+        if(!recorded.insert(name).second) { return; }
+        InstallPlanState entry;
+        entry.name = name;
+        entry.installed = dependencyEngine.IsInstalled(name);
+        entry.version = dependencyEngine.GetInstalledVersion(name);
+        plan.state.push_back(std::move(entry));
+    };
+    for(const InstallPlanStep& step : plan.steps) { record(step.name); }
+    for(const InstallPlanStep& step : plan.steps) {
+        for(const std::string& dependency : step.dependencies) { record(dependency); }
+    }
+    for(const std::string& name : already_installed) { record(name); }
+
+    if(!plan.writeToFile(file)) {
+        std::cout << "error writing plan " << file << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool InstallEngine::LoadPlan(const std::string& file) {
+    InstallPlan plan;
+    if(!plan.readFromFile(file)) { return false; }
+    bool passed = true;
+    for(const InstallPlanState& entry : plan.state) {
+        const bool installed = dependencyEngine.IsInstalled(entry.name);
+        const std::string version = dependencyEngine.GetInstalledVersion(entry.name);
+        if(installed == entry.installed && version == entry.version) { continue; }
+        std::cout << "Package " << entry.name << " is " << (installed ? "installed at version " + version : "not installed")
+                  << ", but the plan was made with it " << (entry.installed ? "at version " + entry.version : "not installed") << std::endl;
+        passed = false;
+    }
+    if(!passed) {
+        std::cout << "The installed packages do not match the plan" << std::endl;
+        return false;
+    }
+
+    for(const InstallPlanStep& step : plan.steps) {
+        if(!step.file.empty()) {
+            if(Sha256::hashFile(step.file) != step.sha256) {
+                std::cout << "Package file " << step.file << " is not the one the plan was made with" << std::endl;
+                passed = false;
+                continue;
+            }
+            PackageFile package;
+            package.streaming_threshold = streaming_threshold;
+            package.archive_io = archive_io;
+            if(!package.readFile(step.file)) {
                 passed = false;
+                continue;
+            }
+            std::cout << "\33[2K\rDone reading package " << step.file;
+            std::cout.flush();
+            all_packages_to_install.push_back(package.toSimplePackageData());
+            all_packages_to_install.back().total_package_bytes = step.installed_size;
+            all_packages_to_install.back().total_package_file_bytes = step.file_size;
+            package_list.push_back(std::move(package));
+            continue;
+        }
+        // The repositories are only asked whether they still have the very same package; nothing is resolved
+        if(!repositoryEngine.isPackageInRepos(step.name) || repositoryEngine.getPackageVersion(step.name) != step.version) {
+            std::cout << "Package " << step.name << " " << step.version << " is no longer in the repositories" << std::endl;
+            passed = false;
+            continue;
+        }
+        if(!step.sha256.empty() && repositoryEngine.getPackageHash(step.name) != step.sha256) {
+            std::cout << "Package " << step.name << " " << step.version << " in the repositories is not the one the plan was made with" << std::endl;
+            passed = false;
+            continue;
+        }
+        SimplePackageData package;
+        package.name = step.name;
+        package.version = step.version;
+        package.dependencies = step.dependencies;
+        package.total_package_bytes = step.installed_size;
+        package.total_package_file_bytes = step.file_size;
+        package.file_hash = step.sha256;
+        all_packages_to_install.push_back(std::move(package));
+    }
+    if(!package_list.empty()) { std::cout << std::endl; }
+    for(const PackageFile& package : package_list) {
+        passed = CheckConflicts(package) && passed;
+    }
+    return CheckRepositoryPackages() && passed;
+}
+
+namespace {
+/// Looks for the files of a package that exist in the install root already. Files an installed version of the
+/// package owns get replaced; they are not conflicts.
+class ConflictCheck {
+public:
+    ConflictCheck(const std::string& _root, std::string _package)
+        : root(_root), package(std::move(_package)), replaced(_root + "/etc/bvpm/packages/" + package + "/owned-files") { }
+
+    void operator()(std::string_view file) {
+        path.assign(root).append("/").append(file);
+        Stats::add(Stats::StatCalls);
+        struct stat st{};
+        if(lstat(path.c_str(), &st) != 0) { return; }
+        owned_path.assign("/").append(file);
+        if(replaced.contains(owned_path)) { return; }
+        if(++conflicts <= max_reported) {
+            std::cout << "Error: file " << path << " (part of package " << package << ") already exists" << std::endl;
+        }
+    }
+
+    /// \return If false, there were conflicts; they have all been reported.
+    bool finish() const {
+        if(conflicts > max_reported) {
+            std::cout << "Error: " << conflicts - max_reported << " more files of package " << package << " already exist" << std::endl;
+        }
+        return conflicts == 0;
+    }
+
+private:
+    static constexpr size_t max_reported = 20;
+    const std::string& root;
+    std::string package;
+    OwnedFilesIndex replaced;
+    size_t conflicts = 0;
+    std::string path;
+    std::string owned_path;
+};
+}
+
+/// Read the sums file of an installed package, with the paths as they are below root/ in the package.
+/// \return If false, the package has no sums file.
+static bool readInstalledSums(const std::string& file, std::unordered_map<std::string, std::string>& sums) {
+    std::ifstream stream(file);
+    if(!stream.is_open()) { return false; }
+    Stats::add(Stats::ManifestsParsed);
+    std::string line;
+    while(std::getline(stream, line)) {
+        // The same format PackageFile reads from the package: sha256sum output, run inside root/
+        size_t space = line.find(' ');
+        if(space == std::string::npos) { continue; }
+        size_t start = line.find_first_not_of(" *./", space);
+        if(start == std::string::npos) { continue; }
+        sums.emplace(line.substr(start), line.substr(0, space));
+    }
+    return true;
+}
+
+bool InstallEngine::CheckRepositoryPackages() {
+    bool passed = true;
+    std::vector<RepositoryFile> files;
+    std::unordered_map<std::string, std::string> installed_sums;
+    for(const SimplePackageData& package : all_packages_to_install) {
+        if(package.from_file || !repositoryEngine.getPackageFiles(package.name, files)) { continue; }
+        ConflictCheck check(install_root, package.name);
+        for(const RepositoryFile& file : files) { check(file.path); }
+        passed = check.finish() && passed;
+
+        // An upgrade: compare with the sums of the installed version, as far as both have them
+        installed_sums.clear();
+        if(!dependencyEngine.IsInstalled(package.name) ||
+           !readInstalledSums(install_root + "/etc/bvpm/packages/" + package.name + "/sums", installed_sums)) { continue; }
+        size_t changed = 0, added = 0, unchanged = 0;
+        for(const RepositoryFile& file : files) {
+            auto installed = installed_sums.find(file.path);
+            if(installed == installed_sums.end()) {
+                added++;
+                continue;
             }
+            if(!file.sha256.empty() && installed->second == file.sha256) { unchanged++; } else { changed++; }
+            installed_sums.erase(installed);
         }
+        upgrade_changes[package.name] = std::to_string(changed) + " files changed, " + std::to_string(added) + " added, " +
+                                        std::to_string(installed_sums.size()) + " removed, " + std::to_string(unchanged) + " unchanged";
     }
     return passed;
+}
+
+bool InstallEngine::CheckConflicts(const PackageFile& package) {
+    ConflictCheck check(install_root, package.name);
+
+    if(!package.streaming) {
+        package.files.forEach([&](std::string_view file) { check(file); });
+    } else {
+        // No file list was kept, so we go through the archive headers again, checking every entry as it comes
+        ArchiveHandle a = ArchiveReader::open(package.path, archive_io);
+        if(!a) {
+            std::cout << "error checking package " << package.name << ": archive not ok" << std::endl;
+            return false;
+        }
+        Stats::add(Stats::ArchivesOpened);
+        struct archive_entry* entry;
+        while(archive_read_next_header(a.get(), &entry) == ARCHIVE_OK) {
+            const char* name = archive_entry_pathname(entry);
+            if(strncmp(name, "root/", strlen("root/")) != 0) { continue; }
+            std::string_view file(name + strlen("root/"));
+            if(file.empty() || file.back() == '/' || archive_entry_filetype(entry) == AE_IFDIR) { continue; }
+            check(file);
+        }
+        Stats::add(Stats::ArchiveBytesRead, archive_filter_bytes(a.get(), -1));
+        Stats::add(Stats::ArchiveBytesDecompressed, archive_filter_bytes(a.get(), 0));
+    }
+    return check.finish();
 }
\ No newline at end of file
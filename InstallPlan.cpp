@@ -0,0 +1,84 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+#include <InstallPlan.h>
+
+namespace fs = std::filesystem;
+
+static const char* plan_header = "BVPM-PLAN 1";
+
+static std::vector<std::string> splitFields(const std::string& line, char separator) {
+    std::vector<std::string> fields;
+    std::istringstream ss(line);
+    std::string field;
+    while(std::getline(ss, field, separator)) { fields.push_back(field); }
+    // A trailing empty field does not produce one
+    if(!line.empty() && line.back() == separator) { fields.emplace_back(); }
+    return fields;
+}
+
+bool InstallPlan::readFromFile(const std::string& file) {
+    state.clear();
+    steps.clear();
+    std::ifstream stream(file);
+    if(!stream.is_open()) {
+        std::cerr << "error reading plan " << file << ": could not open it" << std::endl;
+        return false;
+    }
+    std::string line;
+    if(!std::getline(stream, line) || line != plan_header) {
+        std::cerr << "error reading plan " << file << ": unknown plan format" << std::endl;
+        return false;
+    }
+    while(std::getline(stream, line)) {
+        if(line.empty()) { continue; }
+        std::vector<std::string> fields = splitFields(line, '\t');
+        if(fields[0] == "state" && fields.size() == 4) {
+            InstallPlanState entry;
+            entry.name = fields[1];
+            entry.installed = fields[2] == "1";
+            entry.version = fields[3];
+            state.push_back(std::move(entry));
+        } else if(fields[0] == "install" && fields.size() == 8) {
+            InstallPlanStep step;
+            step.name = fields[1];
+            step.version = fields[2];
+            step.installed_size = std::atoll(fields[3].c_str());
+            step.file_size = std::atoll(fields[4].c_str());
+            if(!fields[5].empty()) { step.dependencies = splitFields(fields[5], ','); }
+            step.file = fields[6];
+            step.sha256 = fields[7];
+            steps.push_back(std::move(step));
+        } else {
+            // Unlike an index line, a plan line can not be skipped: the plan would no longer be the same
+            std::cerr << "error reading plan " << file << ": invalid line \"" << line << "\"" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool InstallPlan::writeToFile(const std::string& file) const {
+    // Write to a temporary file first, so that a half-written plan is never applied
+    std::string temp_file = file + ".new";
+    {
+        std::ofstream stream(temp_file, std::ios::trunc);
+        if(!stream.is_open()) { return false; }
+        stream << plan_header << "\n";
+        for(const InstallPlanState& entry : state) {
+            stream << "state\t" << entry.name << "\t" << (entry.installed ? "1" : "0") << "\t" << entry.version << "\n";
+        }
+        for(const InstallPlanStep& step : steps) {
+            stream << "install\t" << step.name << "\t" << step.version << "\t" << step.installed_size << "\t" << step.file_size << "\t";
+            for(size_t i = 0; i < step.dependencies.size(); i++) {
+                stream << (i ? "," : "") << step.dependencies[i];
+            }
+            stream << "\t" << step.file << "\t" << step.sha256 << "\n";
+        }
+        if(!stream.good()) { return false; }
+    }
+    std::error_code ec;
+    fs::rename(temp_file, file, ec);
+    return !ec;
+}
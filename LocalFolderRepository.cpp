@@ -3,85 +3,240 @@
 //
 
 #include <iostream>
+#include <fstream>
 #include <filesystem>
 #include <utility>
+#include <atomic>
+#include <thread>
+#include <unordered_map>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
 #include <LocalFolderRepository.h>
 #include <debug.h>
 #include <PackageFile.h>
+#include <Stats.h>
+#include <Hash.h>
+#include <RepositoryIndex.h>
+#include <ArchiveReader.h>
+#ifdef BVPM_ENABLE_ZSTD
+#include <ZstdDictionary.h>
+#endif
 
 namespace fs = std::filesystem;
 
 bool LocalFolderRepository::checkIfPackageIsAvailable(const std::string& package_name) {
-    if(!good()) { return false; }
-
-    // If manifests/package_name exists, then the package is in the repo
-    auto path = fs::path(path_str) / "manifests" / package_name / "manifest";
-    return fs::exists(path);
+    // repo.index lists every package that has a manifests/package_name folder
+    return findPackage(package_name) != nullptr;
 }
 
-bool LocalFolderRepository::addPackageFileToRepository(const std::string& package_file) {
-    if(!good()) { return false; }
-
+/// What adding a package needs from its file; filled in on a worker thread
+struct ScannedPackage {
+    bool ok = false;
+    std::string name;
+    std::string version;
+    size_t installed_size = 0;
+    size_t file_size = 0;
+    std::vector<std::string> dependencies;
+    std::string sha256;
+    /// For repo.files; the hashes come from the sums file
+    std::vector<RepositoryFile> files;
+};
+
+static void scanPackage(const std::string& package_file, bool show_progress, ScannedPackage& scanned) {
     PackageFile file;
-    if(!file.readFile(package_file)) { return false; }
-
-    if(checkIfPackageIsAvailable(file.name)) {
-        // We have to remove the current one first
-        // TODO: we should be able to have logic to update the manifest and maintain old versions
-        PRINT_DEBUG("Removing old package files first" << std::endl);
-        removePackageFromRepository(file.name);
+    file.show_progress = show_progress;
+    scanned.ok = file.readFile(package_file);
+    if(!scanned.ok) { return; }
+    scanned.name = file.name;
+    scanned.version = file.version;
+    scanned.installed_size = file.total_package_bytes;
+    scanned.file_size = file.total_package_file_bytes;
+    scanned.dependencies = std::move(file.dependencies);
+    scanned.sha256 = Sha256::hashFile(package_file);
+
+    // Paths in the sums file start with a slash (once the ./ is cut off), members below root/ do not
+    std::unordered_map<std::string, std::string> sums;
+    for(size_t i = 0; i < file.file_hashes.size(); i++) {
+        std::string path = file.file_hashes.paths.get(i);
+        size_t start = path.find_first_not_of('/');
+        if(start != std::string::npos) { sums.emplace(path.substr(start), file.file_hashes.hex(i)); }
     }
+    scanned.files.reserve(file.files.size());
+    file.files.forEach([&](const std::string& path) {
+        auto sum = sums.find(path);
+        scanned.files.push_back({path, sum != sums.end() ? sum->second : ""});
+    });
+}
 
-    // We are now going to create the manifest file
-    // We don't need the owned-files, or the sums file
-    auto manifest_package_folder_path = fs::path(path_str) / "manifests" / file.name;
-    auto bvp_files_package_folder_path = fs::path(path_str) / "packages" / file.name;
+/// Put the package file at destination without copying its data if possible: as a reflink, which shares the
+/// blocks but is a file of its own, or as a hard link, which is the same file as the original.
+/// \return If false, the error has been printed; otherwise method says how the file was stored.
+static bool storePackageFile(const fs::path& source, const fs::path& destination, bool allow_hardlink, std::string& method) {
+    std::error_code ec;
+    fs::remove(destination, ec);
+
+    int in = open(source.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st{};
+    if(in >= 0 && fstat(in, &st) == 0) {
+        int out = open(destination.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, st.st_mode & 07777);
+        bool cloned = out >= 0 && ioctl(out, FICLONE, in) == 0;
+        if(out >= 0) { close(out); }
+        if(out >= 0 && !cloned) { unlink(destination.c_str()); }
+        if(cloned) {
+            close(in);
+            method = "reflink";
+            return true;
+        }
+    }
+    if(in >= 0) { close(in); }
 
-    // We now ensure that these folders exist
-    fs::create_directories(manifest_package_folder_path);
-    fs::create_directories(bvp_files_package_folder_path);
+    if(allow_hardlink && link(source.c_str(), destination.c_str()) == 0) {
+        method = "hard link";
+        return true;
+    }
 
-    auto manifest_file_path = manifest_package_folder_path / "manifest";
+    if(!fs::copy_file(source, destination, ec)) {
+        std::cerr << "error storing package file " << source << " in repository: " << ec.message() << std::endl;
+        return false;
+    }
+    method = "copy";
+    return true;
+}
 
-    auto bvp_file_path = bvp_files_package_folder_path / fs::path(package_file).filename();
+bool LocalFolderRepository::addPackageFileToRepository(const std::string& package_file) {
+    return addPackageFilesToRepository({package_file}, 1);
+}
 
-    // This string has the contents of the new manifest file in it
-    std::string package_repo_manifest = "NAME=" + file.name + "\n";
-    package_repo_manifest += "NEWEST_VERSION=" + file.version + "\n";
-    package_repo_manifest += "INSTALLED_SIZE=" + std::to_string(file.total_package_bytes) + "\n";
-    package_repo_manifest += "FILE_SIZE=" + std::to_string(file.total_package_file_bytes) + "\n";
-    package_repo_manifest += "ARCH=todo\n";
+bool LocalFolderRepository::addPackageFilesToRepository(const std::vector<std::string>& package_files, unsigned jobs, bool allow_hardlink) {
+    if(!good()) { return false; }
 
-    package_repo_manifest += "DEPENDENCIES=";
-    std::cout << "amount dependencies: " << file.dependencies.size() << std::endl;
-    for(size_t i = 0; i < file.dependencies.size(); i++) {
-        package_repo_manifest += file.dependencies[i];
-        if(i < (file.dependencies.size() - 1)) { package_repo_manifest += ","; }
+    // Reading and hashing the package files is most of the work, and every file can be done on its own
+    std::vector<ScannedPackage> scanned(package_files.size());
+    jobs = std::max(1u, std::min<unsigned>(jobs, package_files.size()));
+    if(jobs == 1) {
+        for(size_t i = 0; i < package_files.size(); i++) { scanPackage(package_files[i], true, scanned[i]); }
+    } else {
+        std::atomic<size_t> next{0};
+        std::vector<std::thread> workers;
+        for(unsigned i = 0; i < jobs; i++) {
+            workers.emplace_back([&]() {
+                for(size_t n; (n = next.fetch_add(1)) < package_files.size();) { scanPackage(package_files[n], false, scanned[n]); }
+            });
+        }
+        for(std::thread& worker : workers) { worker.join(); }
     }
-    package_repo_manifest += "\n";
 
-    // We now add the package file names for each version
-    // For now, we only have the one version
-    package_repo_manifest += "FILENAME_" + file.version + "=" + bvp_file_path.filename().generic_string() + "\n";
+    // Everything that touches the repository is done in order, so that a later file of the same package wins
+    bool all_ok = true;
+    std::set<std::string> changed;
+    for(size_t i = 0; i < package_files.size(); i++) {
+        const std::string& package_file = package_files[i];
+        ScannedPackage& file = scanned[i];
+        if(!file.ok || file.sha256.empty()) {
+            std::cerr << "error adding package file " << package_file << " to repository" << std::endl;
+            all_ok = false;
+            continue;
+        }
 
-    {
-        std::ofstream package_repo_manifest_stream(manifest_file_path);
-        package_repo_manifest_stream << package_repo_manifest;
-        package_repo_manifest_stream.flush();
-        package_repo_manifest_stream.close();
-    }
+        // We are now going to create the manifest file
+        // We don't need the owned-files, or the sums file
+        auto manifest_package_folder_path = fs::path(path_str) / "manifests" / file.name;
+        auto bvp_files_package_folder_path = fs::path(path_str) / "packages" / file.name;
+
+        // We now ensure that these folders exist
+        fs::create_directories(manifest_package_folder_path);
+        fs::create_directories(bvp_files_package_folder_path);
+
+        auto manifest_file_path = manifest_package_folder_path / "manifest";
+
+        auto bvp_file_path = bvp_files_package_folder_path / fs::path(package_file).filename();
+
+        RepositoryIndexEntry entry;
+        entry.name = file.name;
+        entry.version = file.version;
+        entry.installed_size = file.installed_size;
+        entry.file_size = file.file_size;
+        entry.dependencies = file.dependencies;
+        entry.filename = bvp_file_path.filename().generic_string();
+        entry.sha256 = file.sha256;
+
+        // This string has the contents of the new manifest file in it
+        std::string package_repo_manifest = "NAME=" + file.name + "\n";
+        package_repo_manifest += "NEWEST_VERSION=" + file.version + "\n";
+        package_repo_manifest += "INSTALLED_SIZE=" + std::to_string(file.installed_size) + "\n";
+        package_repo_manifest += "FILE_SIZE=" + std::to_string(file.file_size) + "\n";
+        package_repo_manifest += "SHA256=" + entry.sha256 + "\n";
+        package_repo_manifest += "ARCH=todo\n";
+
+        package_repo_manifest += "DEPENDENCIES=";
+        for(size_t d = 0; d < file.dependencies.size(); d++) {
+            package_repo_manifest += file.dependencies[d];
+            if(d < (file.dependencies.size() - 1)) { package_repo_manifest += ","; }
+        }
+        package_repo_manifest += "\n";
+
+        // We now add the package file names for each version
+        // For now, we only have the one version
+        package_repo_manifest += "FILENAME_" + file.version + "=" + bvp_file_path.filename().generic_string() + "\n";
+
+        // The new files are staged next to the old ones, which stay published until the new ones are complete
+        const fs::path staged_manifest_path = manifest_file_path.generic_string() + ".new";
+        const fs::path staged_bvp_file_path = bvp_file_path.generic_string() + ".new";
+        std::error_code ec;
+        bool staged;
+        {
+            std::ofstream package_repo_manifest_stream(staged_manifest_path, std::ios::trunc);
+            package_repo_manifest_stream << package_repo_manifest;
+            package_repo_manifest_stream.flush();
+            staged = package_repo_manifest_stream.good();
+        }
+
+        // Now we put the bvp file in the correct location
+        std::string method;
+        if(!staged || !storePackageFile(fs::path(package_file), staged_bvp_file_path, allow_hardlink, method)) {
+            std::cerr << "error adding package file " << package_file << " to repository; the repository keeps what it had" << std::endl;
+            fs::remove(staged_manifest_path, ec);
+            fs::remove(staged_bvp_file_path, ec);
+            all_ok = false;
+            continue;
+        }
+        fs::rename(staged_bvp_file_path, bvp_file_path, ec);
+        if(!ec) { fs::rename(staged_manifest_path, manifest_file_path, ec); }
+        if(ec) {
+            std::cerr << "error publishing package file " << bvp_file_path << ": " << ec.message() << std::endl;
+            fs::remove(staged_manifest_path, ec);
+            fs::remove(staged_bvp_file_path, ec);
+            all_ok = false;
+            continue;
+        }
+        // The old version may have had a file of another name, which goes now
+        // TODO: we should be able to have logic to update the manifest and maintain old versions
+        std::vector<fs::path> old_files;
+        for(fs::directory_iterator it(bvp_files_package_folder_path, ec), end; !ec && it != end; it.increment(ec)) {
+            if(it->path().filename() != bvp_file_path.filename() && it->path().extension() != ".new") { old_files.push_back(it->path()); }
+        }
+        for(const fs::path& old_file : old_files) {
+            PRINT_DEBUG("removing old package file " << old_file << std::endl);
+            fs::remove_all(old_file, ec);
+        }
+        changed.insert(file.name);
+        std::cout << "Stored BVP file at " << bvp_file_path << " (" << method << ")" << std::endl;
 
-    // Now we copy the bvp file to the correct location
-    std::cout << "Copying BVP file to " << bvp_file_path << std::endl;
-    if(fs::exists(bvp_file_path)) { fs::remove(bvp_file_path); }
-    fs::copy(fs::path(package_file), bvp_file_path);
+        loadFileIndex();
+        file_index.setFiles(entry.name, entry.sha256, std::move(file.files));
+        index.packages[entry.name] = entry;
+    }
 
-    return true;
+    // repo.index is written once for the whole batch, whenever anything in the repository changed
+    if(changed.empty()) { return all_ok; }
+    index.updateClosures(changed);
+    return writeIndex() && all_ok;
 }
 
-bool LocalFolderRepository::removePackageFromRepository(const std::string& package_name) {
-    if(!good() || !checkIfPackageIsAvailable(package_name)) { return false; }
-
+void LocalFolderRepository::removePackageFolders(const std::string& package_name) {
     // We simply delete the two folders containing the package files and the manigests
     auto manifest_package_folder_path = fs::path(path_str) / "manifests" / package_name;
     auto bvp_files_package_folder_path = fs::path(path_str) / "packages" / package_name;
@@ -102,76 +257,382 @@ bool LocalFolderRepository::removePackageFromRepository(const std::string& packa
         }
     }
 
-    return true;
+    index.packages.erase(package_name);
 }
 
-std::string LocalFolderRepository::getPackageBVPFilePath(const std::string& package_name) {
-    if(!good() || !checkIfPackageIsAvailable(package_name)) { return ""; }
+bool LocalFolderRepository::removePackageFromRepository(const std::string& package_name) {
+    if(!good() || !checkIfPackageIsAvailable(package_name)) { return false; }
 
-    ConfigFile manifest = getManifestFile(package_name);
+    removePackageFolders(package_name);
+    index.updateClosures({package_name});
+    return writeIndex();
+}
 
-    if(manifest.values.find("NEWEST_VERSION") == manifest.values.end()) { return ""; }
-    std::string filename_manifest_entry = "FILENAME_" + manifest.values["NEWEST_VERSION"];
-    if(manifest.values.find(filename_manifest_entry) == manifest.values.end()) { return ""; }
+std::string LocalFolderRepository::getPackageBVPFilePath(const std::string& package_name) {
+    const RepositoryIndexEntry* entry = findPackage(package_name);
+    if(!entry || entry->filename.empty()) { return ""; }
 
     auto bvp_files_package_folder_path = fs::path(path_str) / "packages" / package_name;
-    auto bvp_file_path = bvp_files_package_folder_path / manifest.values[filename_manifest_entry];
+    auto bvp_file_path = bvp_files_package_folder_path / entry->filename;
     return bvp_file_path;
 }
 
 std::string LocalFolderRepository::getPackageVersion(const std::string& package_name) {
-    if(!good() || !checkIfPackageIsAvailable(package_name)) { return ""; }
+    const RepositoryIndexEntry* entry = findPackage(package_name);
+    if(!entry) { return ""; }
+    return entry->version;
+}
 
-    ConfigFile manifest = getManifestFile(package_name);
+size_t LocalFolderRepository::getPackageFileSize(const std::string& package_name) {
+    const RepositoryIndexEntry* entry = findPackage(package_name);
+    if(!entry) { return 0; }
+    return entry->file_size;
+}
 
-    if(manifest.values.find("NEWEST_VERSION") == manifest.values.end()) { return ""; }
-    return manifest.values["NEWEST_VERSION"];
+size_t LocalFolderRepository::getPackageTotalSize(const std::string& package_name) {
+    const RepositoryIndexEntry* entry = findPackage(package_name);
+    if(!entry) { return 0; }
+    return entry->installed_size;
 }
 
-size_t LocalFolderRepository::getPackageFileSize(const std::string& package_name) {
-    if(!good() || !checkIfPackageIsAvailable(package_name)) { return 0; }
+std::vector<std::string> LocalFolderRepository::getPackageDependencies(const std::string& package_name) {
+    const RepositoryIndexEntry* entry = findPackage(package_name);
+    if(!entry) { return {}; }
+    return entry->dependencies;
+}
 
-    ConfigFile manifest = getManifestFile(package_name);
+std::string LocalFolderRepository::getPackageHash(const std::string& package_name) {
+    const RepositoryIndexEntry* entry = findPackage(package_name);
+    if(!entry) { return ""; }
+    return entry->sha256;
+}
 
-    if(manifest.values.find("FILE_SIZE") == manifest.values.end()) { return 0; }
-    return std::atoll(manifest.values["FILE_SIZE"].c_str());
+bool LocalFolderRepository::getPackageClosure(const std::string& package_name, std::vector<std::string>& closure) {
+    if(!findPackage(package_name)) { return false; }
+    return index.getClosure(package_name, closure);
 }
 
-size_t LocalFolderRepository::getPackageTotalSize(const std::string& package_name) {
-    if(!good() || !checkIfPackageIsAvailable(package_name)) { return 0; }
+bool LocalFolderRepository::getPackageFiles(const std::string& package_name, std::vector<RepositoryFile>& files) {
+    const RepositoryIndexEntry* entry = findPackage(package_name);
+    if(!entry) { return false; }
+    loadFileIndex();
+    return file_index.getFiles(package_name, entry->sha256, files);
+}
 
-    ConfigFile manifest = getManifestFile(package_name);
+void LocalFolderRepository::loadFileIndex() {
+    if(file_index_loaded) { return; }
+    file_index_loaded = true;
+    // Repositories from before repo.files have none; only the packages added from now on get their files listed
+    if(!file_index.readFromFile((fs::path(path_str) / "repo.files").generic_string())) {
+        PRINT_DEBUG("repo " << path_str << " has no file index" << std::endl);
+    }
+}
 
-    if(manifest.values.find("INSTALLED_SIZE") == manifest.values.end()) { return 0; }
-    return std::atoll(manifest.values["INSTALLED_SIZE"].c_str());
+bool LocalFolderRepository::listPackages(std::vector<std::pair<std::string, std::string>>& packages) {
+    if(!good()) { return false; }
+    for(const auto& package : index.packages) {
+        packages.emplace_back(package.first, package.second.version);
+    }
+    return true;
 }
 
-std::vector<std::string> LocalFolderRepository::getPackageDependencies(const std::string& package_name) {
-    if(!good() || !checkIfPackageIsAvailable(package_name)) { return {}; }
+const RepositoryIndexEntry* LocalFolderRepository::findPackage(const std::string& package_name) {
+    if(!good()) { return nullptr; }
+    Stats::add(Stats::RepositoryLookups);
+    return index.find(package_name);
+}
+
+void LocalFolderRepository::rebuildIndex() {
+    // Used for repositories that were created before repo.index existed
+    index.packages.clear();
+    auto manifests_path = fs::path(path_str) / "manifests";
+    if(fs::exists(manifests_path)) {
+        for(auto& p : fs::directory_iterator(manifests_path)) {
+            if(!p.is_directory()) { continue; }
+            std::string package_name = p.path().filename().generic_string();
+            ConfigFile manifest = Config::readConfigFile((p.path() / "manifest").generic_string());
+            if(manifest.values.find("failed") != manifest.values.end()) { continue; }
+            Stats::add(Stats::ManifestsParsed);
+            RepositoryIndexEntry entry;
+            entry.name = package_name;
+            entry.version = manifest.values["NEWEST_VERSION"];
+            entry.installed_size = std::atoll(manifest.values["INSTALLED_SIZE"].c_str());
+            entry.file_size = std::atoll(manifest.values["FILE_SIZE"].c_str());
+            if(!manifest.values["DEPENDENCIES"].empty()) {
+                std::stringstream ss(manifest.values["DEPENDENCIES"]);
+                std::string package_dep;
+                while(std::getline(ss, package_dep, ',')) { entry.dependencies.push_back(package_dep); }
+            }
+            entry.filename = manifest.values["FILENAME_" + entry.version];
+            entry.sha256 = manifest.values["SHA256"];
+            index.packages[package_name] = entry;
+        }
+    }
+    // None of the packages has a closure yet, so they all get one
+    index.updateClosures({});
+}
+
+/// Set KEY=VALUE lines in a file like repo.manifest, keeping the other lines as they were; keys that are not in it
+/// yet are added at the end.
+static bool setConfigValues(const fs::path& file, std::map<std::string, std::string> values) {
+    std::string contents;
+    {
+        std::ifstream stream(file);
+        std::string line;
+        while(std::getline(stream, line)) {
+            auto value = values.find(line.substr(0, line.find('=')));
+            if(line.find('=') != std::string::npos && value != values.end()) {
+                line = value->first + "=" + value->second;
+                values.erase(value);
+            }
+            contents += line + "\n";
+        }
+    }
+    for(const auto& value : values) { contents += value.first + "=" + value.second + "\n"; }
+    const fs::path temp_file = file.generic_string() + ".new";
+    {
+        std::ofstream stream(temp_file, std::ios::trunc);
+        stream << contents;
+        if(!stream.good()) { return false; }
+    }
+    std::error_code ec;
+    fs::rename(temp_file, file, ec);
+    return !ec;
+}
 
-    ConfigFile manifest = getManifestFile(package_name);
+/// Read what is inside a package file once it is decompressed: the tar file.
+static bool readDecompressed(const std::string& path, std::string& out) {
+    ArchiveHandle a = ArchiveReader::open(path, ArchiveIO::Auto, true);
+    struct archive_entry* entry;
+    if(!a || archive_read_next_header(a.get(), &entry) != ARCHIVE_OK) { return false; }
+    out.clear();
+    char buffer[64 * 1024];
+    la_ssize_t read;
+    while((read = archive_read_data(a.get(), buffer, sizeof(buffer))) > 0) { out.append(buffer, read); }
+    return read == 0;
+}
 
-    std::vector<std::string> ret;
-    if(manifest.values.find("DEPENDENCIES") != manifest.values.end() && !manifest.values["DEPENDENCIES"].empty()) {
-        std::stringstream ss(manifest.values["DEPENDENCIES"]);
-        while (ss.good()) {
-            std::string package_dep;
-            std::getline(ss, package_dep, ',');
+#ifdef BVPM_ENABLE_ZSTD
+/// A package compressed again for trainDictionary(); filled in on a worker thread
+struct RecompressedPackage {
+    bool ok = false;
+    size_t original_size = 0;
+    size_t decompressed_size = 0;
+    /// The size at the same level, without the dictionary
+    size_t plain_size = 0;
+    /// The package compressed with the dictionary
+    std::string data;
+    std::string sha256;
+};
+#endif
+
+bool LocalFolderRepository::trainDictionary(size_t max_package_size, size_t dictionary_size, int level, unsigned jobs) {
+#ifdef BVPM_ENABLE_ZSTD
+    if(!good()) { return false; }
+    std::vector<std::string> names;
+    std::vector<std::string> files;
+    for(const auto& package : index.packages) {
+        if(package.second.filename.empty() || package.second.file_size > max_package_size) { continue; }
+        names.push_back(package.first);
+        files.push_back(getPackageBVPFilePath(package.first));
+    }
 
-            ret.push_back(package_dep);
+    // zstd suggests about a hundred times the dictionary size in samples; more only makes training slower
+    std::vector<std::string> samples;
+    size_t sample_bytes = 0;
+    for(size_t i = 0; i < files.size() && sample_bytes < dictionary_size * 100; i++) {
+        std::string sample;
+        if(!readDecompressed(files[i], sample)) { continue; }
+        sample_bytes += sample.size();
+        samples.push_back(std::move(sample));
+    }
+    // A dictionary much bigger than a tenth of the samples is mostly the samples themselves
+    const size_t capacity = std::min(dictionary_size, sample_bytes / 10);
+    if(capacity < 256) {
+        std::cerr << "error training zstd dictionary: only " << samples.size() << " packages of at most " << max_package_size
+                  << " bytes, with " << sample_bytes << " bytes in them" << std::endl;
+        return false;
+    }
+    if(capacity < dictionary_size) { std::cout << "Only " << sample_bytes << " bytes of samples; training a " << capacity << " byte dictionary" << std::endl; }
+    const std::string dictionary = ZstdDictionaries::train(samples, capacity);
+    samples.clear();
+    if(dictionary.empty()) { return false; }
+    const uint32_t id = ZstdDictionaries::dictionaryID(dictionary);
+    std::cout << "Trained a " << dictionary.size() << " byte zstd dictionary (ID " << id << ") on " << sample_bytes << " bytes of " << names.size() << " packages" << std::endl;
+
+    const fs::path dictionaries_path = fs::path(path_str) / "dictionaries";
+    const fs::path dictionary_path = dictionaries_path / (std::to_string(id) + ".zdict");
+    {
+        std::error_code ec;
+        fs::create_directories(dictionaries_path, ec);
+        const fs::path temp_file = dictionary_path.generic_string() + ".new";
+        std::ofstream stream(temp_file, std::ios::binary | std::ios::trunc);
+        stream.write(dictionary.data(), (std::streamsize)dictionary.size());
+        stream.close();
+        if(stream.good()) { fs::rename(temp_file, dictionary_path, ec); }
+        if(!stream.good() || ec) {
+            std::cerr << "error storing zstd dictionary at " << dictionary_path << std::endl;
+            return false;
+        }
+    }
+    // HTTP clients fetch every dictionary repo.manifest lists; the new one goes first
+    std::string listed = std::to_string(id);
+    {
+        ConfigFile repo_manifest = Config::readConfigFile((fs::path(path_str) / "repo.manifest").generic_string());
+        std::stringstream ss(repo_manifest.values["DICTIONARIES"]);
+        std::string other;
+        while(std::getline(ss, other, ',')) {
+            if(!other.empty() && other != std::to_string(id)) { listed += "," + other; }
         }
     }
-    return ret;
+    // ...and only take the ones matching their DICTIONARY_SHA256_<ID>, as a dictionary is used for every package naming its ID
+    Sha256 hash;
+    hash.update(dictionary.data(), dictionary.size());
+    const std::map<std::string, std::string> manifest_values = {
+        {"DICTIONARIES", listed},
+        {"DICTIONARY_SHA256_" + std::to_string(id), hash.finishHex()},
+    };
+    if(!setConfigValues(fs::path(path_str) / "repo.manifest", manifest_values)) {
+        std::cerr << "error listing zstd dictionary " << id << " in repo.manifest" << std::endl;
+        return false;
+    }
+
+    // Compressing is most of the work, and every package can be done on its own
+    std::vector<RecompressedPackage> recompressed(files.size());
+    auto recompress = [&](ZstdCompressor& with_dictionary, ZstdCompressor& without_dictionary, size_t n) {
+        RecompressedPackage& package = recompressed[n];
+        std::string tar, plain;
+        if(!readDecompressed(files[n], tar)) { return; }
+        std::error_code ec;
+        package.original_size = fs::file_size(files[n], ec);
+        package.decompressed_size = tar.size();
+        if(ec || !without_dictionary.compress(tar, plain) || !with_dictionary.compress(tar, package.data)) { return; }
+        package.plain_size = plain.size();
+        Sha256 hash;
+        hash.update(package.data.data(), package.data.size());
+        package.sha256 = hash.finishHex();
+        package.ok = true;
+    };
+    jobs = std::max(1u, std::min<unsigned>(jobs, files.size()));
+    std::atomic<size_t> next{0};
+    std::vector<std::thread> workers;
+    for(unsigned i = 0; i < jobs; i++) {
+        workers.emplace_back([&]() {
+            ZstdCompressor with_dictionary(dictionary, level);
+            ZstdCompressor without_dictionary("", level);
+            for(size_t n; (n = next.fetch_add(1)) < files.size();) { recompress(with_dictionary, without_dictionary, n); }
+        });
+    }
+    for(std::thread& worker : workers) { worker.join(); }
+
+    bool all_ok = true;
+    size_t decompressed_total = 0, original_total = 0, plain_total = 0, dictionary_total = 0, stored = 0, saved = 0;
+    for(size_t i = 0; i < files.size(); i++) {
+        RecompressedPackage& package = recompressed[i];
+        if(!package.ok) {
+            std::cerr << "error compressing package " << names[i] << " with zstd dictionary " << id << std::endl;
+            all_ok = false;
+            continue;
+        }
+        decompressed_total += package.decompressed_size;
+        original_total += package.original_size;
+        plain_total += package.plain_size;
+        dictionary_total += package.data.size();
+        if(package.data.size() >= package.original_size) { continue; }
+
+        // The file is replaced, not overwritten, as it may be a hard link to the file it was added from
+        const std::string temp_file = files[i] + ".new";
+        {
+            std::ofstream stream(temp_file, std::ios::binary | std::ios::trunc);
+            stream.write(package.data.data(), (std::streamsize)package.data.size());
+            stream.close();
+            std::error_code ec;
+            if(stream.good()) { fs::rename(temp_file, files[i], ec); }
+            if(!stream.good() || ec) {
+                std::cerr << "error storing package " << names[i] << " compressed with zstd dictionary " << id << std::endl;
+                fs::remove(temp_file, ec);
+                all_ok = false;
+                continue;
+            }
+        }
+        RepositoryIndexEntry& entry = index.packages[names[i]];
+        entry.file_size = package.data.size();
+        entry.sha256 = package.sha256;
+        loadFileIndex();
+        file_index.setPackageHash(names[i], entry.sha256);
+        setConfigValues(fs::path(path_str) / "manifests" / names[i] / "manifest",
+                        {{"FILE_SIZE", std::to_string(entry.file_size)}, {"SHA256", entry.sha256}});
+        saved += package.original_size - package.data.size();
+        stored++;
+    }
+
+    std::cout << "Packages of at most " << max_package_size << " bytes: " << decompressed_total << " bytes decompressed, "
+              << original_total << " bytes as they were, " << plain_total << " bytes at zstd level " << level << ", "
+              << dictionary_total << " bytes at zstd level " << level << " with the dictionary" << std::endl;
+    if(decompressed_total && plain_total && dictionary_total) {
+        std::cout << "Compression ratio " << (double)decompressed_total / plain_total << " without the dictionary, "
+                  << (double)decompressed_total / dictionary_total << " with it" << std::endl;
+    }
+    std::cout << "Compressed " << stored << " package(s) again with the dictionary, saving " << saved << " bytes" << std::endl;
+    if(stored == 0) { return all_ok; }
+    return writeIndex() && all_ok;
+#else
+    std::cerr << "error training zstd dictionary: this bvpm was built without zstd support" << std::endl;
+    return false;
+#endif
+}
+
+bool LocalFolderRepository::writeIndex() {
+    if(!index.writeToFile((fs::path(path_str) / "repo.index").generic_string())) {
+        std::cerr << "error writing repository index" << std::endl;
+        return false;
+    }
+    // Everything in repo.files has to survive the rewrite, not only what was added this time
+    loadFileIndex();
+    if(!file_index.writeToFile((fs::path(path_str) / "repo.files").generic_string(), index)) {
+        std::cerr << "error writing repository file index" << std::endl;
+        return false;
+    }
+    return writeQueryIndex();
+}
+
+bool LocalFolderRepository::writeQueryIndex() {
+    auto path = fs::path(path_str);
+    if(!RepositoryQueryIndex::write(index, (path / "repo.index").generic_string(), (path / "repo.query").generic_string())) {
+        std::cerr << "error writing repository query index" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool LocalFolderRepository::openQueryIndex(const std::string& path, RepositoryQueryIndex& query_index) {
+    const std::string index_file = (fs::path(path) / "repo.index").generic_string();
+    const std::string query_file = (fs::path(path) / "repo.query").generic_string();
+    if(query_index.open(query_file, index_file)) { return true; }
+
+    // Repositories from before repo.query, or a repo.index that was changed by something else than bvpm-repo
+    PRINT_DEBUG("repo " << path << " has no up to date query index, writing it" << std::endl);
+    LocalFolderRepository repo("repository", path, true);
+    if(!repo.good()) { return false; }
+    // Someone else may have written it while we waited for the lock
+    if(query_index.open(query_file, index_file)) { return true; }
+    if(!fs::exists(index_file) && !repo.writeIndex()) { return false; }
+    if(!repo.writeQueryIndex()) { return false; }
+    return query_index.open(query_file, index_file);
 }
 
 bool LocalFolderRepository::good() {
     return _good;
 }
 
-LocalFolderRepository::LocalFolderRepository(std::string _name, std::string _path) : Repository(std::move(_name)), path_str(std::move(_path)) {
+LocalFolderRepository::LocalFolderRepository(std::string _name, std::string _path, bool for_writing) : Repository(std::move(_name)), path_str(std::move(_path)) {
     auto path = fs::path(path_str);
     path_str = fs::absolute(path).generic_string();
     PRINT_DEBUG("repo path: " + path_str << std::endl);
+#ifdef BVPM_ENABLE_ZSTD
+    // Packages name the dictionary they were compressed with (see trainDictionary()); this is where they are
+    ZstdDictionaries::addFolder((fs::path(path_str) / "dictionaries").generic_string());
+#endif
 
     auto repo_manifest_path = path / "repo.manifest";
     if(!fs::exists(repo_manifest_path)) {
@@ -181,9 +642,42 @@ LocalFolderRepository::LocalFolderRepository(std::string _name, std::string _pat
     }
 
     ConfigFile repo_manifest = Config::readConfigFile(repo_manifest_path.generic_string());
-    if(repo_manifest.values.find("NAME") == repo_manifest.values.end()) {
+    if(repo_manifest.values.find("NAME") != repo_manifest.values.end()) {
            name = repo_manifest.values["NAME"];
     }
+
+    const std::string lock_path = (path / "repo.lock").generic_string();
+    if(!lock.lock(lock_path, for_writing ? FileLock::Mode::Exclusive : FileLock::Mode::Shared, "repository " + path_str) && for_writing) {
+        perror(("error locking repository " + path_str).c_str());
+        _good = false;
+        return;
+    }
+    // All package metadata is served from repo.index, which is read once here
+    index_identity = indexIdentity();
+    if(!index.readFromFile((path / "repo.index").generic_string())) {
+        PRINT_DEBUG("repo " << path_str << " has no usable index, rebuilding it from the manifests" << std::endl);
+        rebuildIndex();
+    }
+    // Readers let go until they actually install something, so that bvpm-repo only has to wait for transactions
+    if(!for_writing) { lock.unlock(); }
+}
+
+std::string LocalFolderRepository::indexIdentity() const {
+    struct stat st{};
+    if(stat((fs::path(path_str) / "repo.index").c_str(), &st) != 0) { return ""; }
+    return std::to_string(st.st_ino) + ":" + std::to_string(st.st_size) + ":" + std::to_string(st.st_mtim.tv_sec) + "." + std::to_string(st.st_mtim.tv_nsec);
+}
+
+bool LocalFolderRepository::preparePackage(const std::string& package) {
+    if(lock.locked()) { return true; }
+    // Without a lock file we can create or open, there is nobody to keep out
+    lock.lock((fs::path(path_str) / "repo.lock").generic_string(), FileLock::Mode::Shared, "repository " + path_str);
+    if(indexIdentity() != index_identity) {
+        std::cerr << "error preparing package " << package << ": repository " << path_str << " changed since it was read; please try again" << std::endl;
+        lock.unlock();
+        return false;
+    }
+    return true;
 }
 
 ConfigFile LocalFolderRepository::getManifestFile(const std::string& package_name) {
@@ -197,5 +691,7 @@ ConfigFile LocalFolderRepository::getManifestFile(const std::string& package_nam
 
     auto manifest_file_path = manifest_package_folder_path / "manifest";
 
-    return Config::readConfigFile(manifest_file_path);
+    ConfigFile manifest = Config::readConfigFile(manifest_file_path);
+    if(manifest.values.find("failed") == manifest.values.end()) { Stats::add(Stats::ManifestsParsed); }
+    return manifest;
 }
@@ -0,0 +1,44 @@
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <OwnedFilesIndex.h>
+
+OwnedFilesIndex::OwnedFilesIndex(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0) { return; }
+    struct stat st{};
+    // Offsets are 32 bit; a list of more than 4 GiB is not something we index
+    if(fstat(fd, &st) != 0 || st.st_size == 0 || (uint64_t)st.st_size > UINT32_MAX) {
+        close(fd);
+        return;
+    }
+    void* mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(mapped == MAP_FAILED) { return; }
+    data = (const char*)mapped;
+    data_size = st.st_size;
+    madvise(mapped, data_size, MADV_SEQUENTIAL);
+
+    for(size_t offset = 0; offset < data_size;) {
+        auto* newline = (const char*)memchr(data + offset, '\n', data_size - offset);
+        size_t end = newline ? (size_t)(newline - data) : data_size;
+        if(end > offset) { lines.emplace_back((uint32_t)offset, (uint32_t)(end - offset)); }
+        offset = end + 1;
+    }
+    std::sort(lines.begin(), lines.end(), [this](const auto& a, const auto& b) { return line(a) < line(b); });
+    madvise(mapped, data_size, MADV_RANDOM);
+}
+
+OwnedFilesIndex::~OwnedFilesIndex() {
+    if(data) { munmap((void*)data, data_size); }
+}
+
+bool OwnedFilesIndex::contains(std::string_view path) const {
+    auto it = std::lower_bound(lines.begin(), lines.end(), path, [this](const auto& entry, std::string_view value) {
+        return line(entry) < value;
+    });
+    return it != lines.end() && line(*it) == path;
+}
@@ -0,0 +1,171 @@
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <filesystem>
+#include <iostream>
+#include <utility>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <OwnerIndex.h>
+#include <Stats.h>
+
+namespace fs = std::filesystem;
+
+static const std::string index_header = "BVPM-OWNERS 1";
+
+/// (path, package)
+typedef std::vector<std::pair<std::string, std::string>> Entries;
+
+static std::string indexPath(const std::string& root) {
+    return root + "/var/lib/bvpm/owners";
+}
+
+static void addOwnedFiles(const std::string& root, const std::string& package, Entries& entries) {
+    std::ifstream stream(root + "/etc/bvpm/packages/" + package + "/owned-files");
+    if(!stream.is_open()) { return; }
+    Stats::add(Stats::ManifestsParsed);
+    std::string line;
+    while(std::getline(stream, line)) {
+        if(!line.empty()) { entries.emplace_back(line, package); }
+    }
+}
+
+/// \return If false, the root has no valid owner index.
+static bool readIndex(const std::string& root, Entries& entries) {
+    std::ifstream stream(indexPath(root));
+    std::string line;
+    if(!stream.is_open() || !std::getline(stream, line) || line != index_header) { return false; }
+    while(std::getline(stream, line)) {
+        // Package names have no tabs, paths might
+        size_t tab = line.rfind('\t');
+        if(tab == std::string::npos) { return false; }
+        entries.emplace_back(line.substr(0, tab), line.substr(tab + 1));
+    }
+    Stats::add(Stats::ManifestsParsed);
+    return true;
+}
+
+/// Read the owned-files list of every installed package, for roots installed before the owner index existed.
+static Entries scanInstalled(const std::string& root) {
+    Entries entries;
+    std::error_code ec;
+    for(fs::directory_iterator it(root + "/etc/bvpm/packages", ec), end; !ec && it != end; it.increment(ec)) {
+        if(it->is_directory(ec)) { addOwnedFiles(root, it->path().filename().string(), entries); }
+    }
+    return entries;
+}
+
+static bool writeIndex(const std::string& root, Entries& entries) {
+    std::sort(entries.begin(), entries.end());
+    const std::string file = indexPath(root);
+    // Queries write the index too, for roots without one, and they only hold the root lock shared
+    const std::string temp_file = file + ".new." + std::to_string(getpid());
+    std::error_code ec;
+    fs::create_directories(fs::path(file).parent_path(), ec);
+    {
+        std::ofstream stream(temp_file, std::ios::trunc);
+        if(!stream.is_open()) { return false; }
+        stream << index_header << "\n";
+        for(const auto& entry : entries) { stream << entry.first << "\t" << entry.second << "\n"; }
+        if(!stream.good()) {
+            stream.close();
+            fs::remove(temp_file, ec);
+            return false;
+        }
+    }
+    fs::rename(temp_file, file, ec);
+    if(ec) { fs::remove(temp_file, ec); }
+    return !ec;
+}
+
+void OwnerIndex::updateInstalled(const std::string& root, const std::set<std::string>& installed, const std::set<std::string>& removed) {
+    Entries entries;
+    if(!readIndex(root, entries)) {
+        entries = scanInstalled(root);
+    }
+    entries.erase(std::remove_if(entries.begin(), entries.end(),
+                                 [&](const auto& entry) { return installed.count(entry.second) != 0 || removed.count(entry.second) != 0; }),
+                  entries.end());
+    for(const std::string& package : installed) { addOwnedFiles(root, package, entries); }
+    if(!writeIndex(root, entries)) {
+        std::cout << "warning: could not write the owner index " << indexPath(root) << std::endl;
+    }
+}
+
+OwnerIndex::OwnerIndex(std::string _root) : root(std::move(_root)) { }
+
+OwnerIndex::~OwnerIndex() {
+    if(data) { munmap((void*)data, data_size); }
+}
+
+bool OwnerIndex::load() {
+    if(loaded) { return data != nullptr; }
+    loaded = true;
+    for(int attempt = 0; attempt < 2; attempt++) {
+        int fd = open(indexPath(root).c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat st{};
+        if(fd >= 0 && fstat(fd, &st) == 0 && (size_t)st.st_size > index_header.size()) {
+            void* mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            close(fd);
+            if(mapped == MAP_FAILED) { return false; }
+            data = (const char*)mapped;
+            data_size = st.st_size;
+            if(memcmp(data, index_header.data(), index_header.size()) == 0 && data[index_header.size()] == '\n') {
+                lines_start = index_header.size() + 1;
+                Stats::add(Stats::ManifestsParsed);
+                return true;
+            }
+            munmap(mapped, data_size);
+            data = nullptr;
+        } else if(fd >= 0) {
+            close(fd);
+        }
+        if(attempt == 0) {
+            // Written once, so that later lookups on this root read the index instead
+            Entries entries = scanInstalled(root);
+            if(!writeIndex(root, entries)) {
+                std::cerr << "warning: could not write the owner index " << indexPath(root) << std::endl;
+                return false;
+            }
+        }
+    }
+    return false;
+}
+
+std::vector<std::string> OwnerIndex::owners(std::string_view path) {
+    std::vector<std::string> found;
+    if(!load()) { return found; }
+    auto lineEnd = [&](size_t start) {
+        auto* newline = (const char*)memchr(data + start, '\n', data_size - start);
+        return newline ? (size_t)(newline - data) : data_size;
+    };
+    auto linePath = [&](size_t start, size_t end) {
+        std::string_view line(data + start, end - start);
+        size_t tab = line.rfind('\t');
+        return tab == std::string_view::npos ? line : line.substr(0, tab);
+    };
+    // Find the first line whose path is not before path. Everything in front of low is before it, everything from
+    // high on is not; a probe in between is moved back to the start of its line.
+    size_t low = lines_start, high = data_size;
+    while(low < high) {
+        size_t start = low + (high - low) / 2;
+        while(start > low && data[start - 1] != '\n') { start--; }
+        size_t end = lineEnd(start);
+        if(linePath(start, end) < path) {
+            low = end + 1;
+        } else {
+            high = start;
+        }
+    }
+    for(size_t start = low; start < data_size;) {
+        size_t end = lineEnd(start);
+        std::string_view line(data + start, end - start);
+        size_t tab = line.rfind('\t');
+        if(tab == std::string_view::npos || line.substr(0, tab) != path) { break; }
+        found.emplace_back(line.substr(tab + 1));
+        start = end + 1;
+    }
+    return found;
+}
@@ -1,102 +1,145 @@
 #include <iostream>
 #include <PackageFile.h>
+#include <ArchiveReader.h>
+#include <BufferPool.h>
 #include <cstring>
 #include <archive.h>
 #include <archive_entry.h>
 #include <human-readable.h>
+#include <Stats.h>
 #include <sstream>
+#include <string>
+#include <string_view>
 #include <filesystem>
 
 namespace fs = std::filesystem;
 
+/// Read the current entry in blocks, and call on_line for every line in it.
+/// A line that runs past the end of a block is moved to the front of the buffer, and the next block read behind it.
+template<typename F>
+static void readLines(struct archive* a, F on_line) {
+    PooledBuffer buffer(64 * 1024);
+    size_t partial = 0;
+    la_ssize_t size;
+    while(buffer.data() && (size = archive_read_data(a, buffer.data() + partial, buffer.size() - partial)) > 0) {
+        std::string_view block(buffer.data(), partial + size);
+        size_t end;
+        while((end = block.find('\n')) != std::string_view::npos) {
+            on_line(block.substr(0, end));
+            block.remove_prefix(end + 1);
+        }
+        partial = block.size();
+        if(partial == buffer.size()) {
+            // A line longer than the buffer
+            PooledBuffer larger(buffer.size() * 2);
+            if(larger.data()) { memcpy(larger.data(), buffer.data(), partial); }
+            buffer.swap(larger);
+        } else if(partial > 0) {
+            memmove(buffer.data(), block.data(), partial);
+        }
+    }
+    if(partial > 0 && buffer.data()) { on_line(std::string_view(buffer.data(), partial)); }
+}
+
+void PackageFile::startStreaming() {
+    streaming = true;
+    files.clear();
+    folders.clear();
+    owned_files.clear();
+    file_hashes = FileDigests();
+}
+
 bool PackageFile::readFile(std::string file, std::string display_name) {
     name = "";
     path = file;
-    a = archive_read_new();
-    archive_read_support_filter_all(a);
-    archive_read_support_format_all(a);
-    if(archive_read_open_filename(a, path.c_str(), 1024) != ARCHIVE_OK) {
+    // The archive is only needed while reading the metadata, and is freed on every way out of here
+    ArchiveHandle archive = ArchiveReader::open(path, archive_io);
+    struct archive* reader = archive.get();
+    if(!reader) {
         std::cout << "error reading package " << display_name << ": archive not ok" << std::endl;
         return false;
     }
+    Stats::add(Stats::ArchivesOpened);
     struct archive_entry* file_entry;
     bool has_manifest = false;
     bool has_owned_files = false;
     bool has_hashes = false;
     size_t file_size = fs::file_size(file);
+    Stats::add(Stats::StatCalls);
     total_package_file_bytes = file_size;
-    while(archive_read_next_header(a, &file_entry) == ARCHIVE_OK) {
-        if(display_name != "") {
-            std::cout << "\33[2K\rReading package " << display_name << ": " << humanSize(archive_filter_bytes(a, -1))
-                      << "/" << humanSize(file_size);
-        } else {
-            std::cout << "\33[2K\rReading package file: " << humanSize(archive_filter_bytes(a, -1)) << "/" << humanSize(file_size);
+    while(archive_read_next_header(reader, &file_entry) == ARCHIVE_OK) {
+        if(show_progress) {
+            if(display_name != "") {
+                std::cout << "\33[2K\rReading package " << display_name << ": " << humanSize(archive_filter_bytes(reader, -1))
+                          << "/" << humanSize(file_size);
+            } else {
+                std::cout << "\33[2K\rReading package file: " << humanSize(archive_filter_bytes(reader, -1)) << "/" << humanSize(file_size);
+            }
+            std::cout.flush();
         }
-        std::cout.flush();
-        std::string file_name = archive_entry_pathname(file_entry);
+        std::string_view file_name = archive_entry_pathname(file_entry);
         total_package_bytes += archive_entry_size(file_entry);
         if(file_name == "manifest") {
             has_manifest = true;
             // We also try to read the manifest now
             size_t manifest_size = archive_entry_size(file_entry);
-            char* data = (char*)malloc(manifest_size + 2);
-            memset(data, 0, manifest_size + 1);
-            archive_read_data(a, data, manifest_size);
-            manifest = Config::readFromData(data);
+            PooledBuffer data(manifest_size);
+            la_ssize_t manifest_read = data.data() ? archive_read_data(reader, data.data(), manifest_size) : -1;
+            manifest = Config::readFromData(std::string_view(data.data(), manifest_read > 0 ? manifest_read : 0));
+            if(manifest_read > 0) { Stats::add(Stats::ManifestsParsed); }
         }
         if(file_name == "owned-files") {
             has_owned_files = true;
-            // We also try to read the manifest now
-            size_t owned_files_size = archive_entry_size(file_entry);
-            char* data = (char*)malloc(owned_files_size + 2);
-            memset(data, 0, owned_files_size + 1);
-            archive_read_data(a, data, owned_files_size);
-
-            // Split the owned-files by newline
-            std::istringstream ss(data);
-            std::string line;
-            while(std::getline(ss, line, '\n')) {
-                owned_files.push_back(line);
-            }
+            // Read it line by line, so that a huge list never has to be in memory at once
+            readLines(reader, [this](std::string_view line) {
+                if(streaming) { return; }
+                owned_files.add(line);
+                if(owned_files.size() > streaming_threshold) { startStreaming(); }
+            });
+            Stats::add(Stats::ManifestsParsed);
         }
         if(file_name == "sums") {
             has_hashes = true;
-            // We also try to read the manifest now
-            size_t sums_size = archive_entry_size(file_entry);
-            char* data = (char*)malloc(sums_size + 2);
-            memset(data, 0, sums_size + 1);
-            archive_read_data(a, data, sums_size);
-
-            // Split the sums by newline
-            std::istringstream ss(data);
-            std::string line;
-            while(std::getline(ss, line, '\n')) {
-                std::string hash = line.substr(0, line.find(' '));
-                std::string file_str = line.substr(line.find(' '), line.size());
+            readLines(reader, [this, &display_name](std::string_view line) {
+                if(streaming) { return; }
+                size_t space = line.find(' ');
+                if(space == std::string_view::npos) { return; }
+                std::string_view hash = line.substr(0, space);
+                std::string_view file_str = line.substr(space);
 
                 // Sanitize file a bit
-                while(file_str[0] == ' ') { file_str.erase(0, 1); }
-                if(file_str[0] == '*') { file_str.erase(0, 1); }
-                if(file_str[0] == '.') { file_str.erase(0, 1); }
+                while(!file_str.empty() && file_str[0] == ' ') { file_str.remove_prefix(1); }
+                if(!file_str.empty() && file_str[0] == '*') { file_str.remove_prefix(1); }
+                if(!file_str.empty() && file_str[0] == '.') { file_str.remove_prefix(1); }
 
-                file_hashes[file_str] = hash;
-            }
+                if(!file_hashes.add(file_str, hash)) {
+                    std::cout << std::endl << "warning reading package " << display_name << ": malformed hash for " << file_str << std::endl;
+                }
+                if(file_hashes.size() > streaming_threshold) { startStreaming(); }
+            });
         }
         if(file_name == "afterinstall.sh") { has_after_install = true; }
         // We also make a record of all files and folders in root/
         if(file_name.rfind("root/", 0) == 0) {
-            // Create a std::string and chop the root/ off
-            std::string name_str(file_name.erase(0, strlen("root/")));
+            // Chop the root/ off
+            std::string_view name_str(file_name);
+            name_str.remove_prefix(strlen("root/"));
             if(name_str.empty()) { continue; }
-            if(*(file_name.end()--) == '/') {
+            bool is_folder = name_str.back() == '/' || archive_entry_filetype(file_entry) == AE_IFDIR;
+            if(is_folder) { folder_count++; } else { file_count++; }
+            if(streaming) { continue; }
+            if(is_folder) {
                 //std::cout << "folder in root: " << name_str << std::endl;
-                folders.push_back(name_str);
+                folders.add(name_str);
             } else {
-                files.push_back(name_str);
+                files.add(name_str);
             }
+            if(files.size() + folders.size() > streaming_threshold) { startStreaming(); }
         }
-        archive_read_data_skip(a);
+        archive_read_data_skip(reader);
     }
+    Stats::add(Stats::ArchiveBytesRead, archive_filter_bytes(reader, -1));
+    Stats::add(Stats::ArchiveBytesDecompressed, archive_filter_bytes(reader, 0));
 
     if(has_manifest) {
         // We now parse the manifest (mostly to find the package name)
@@ -0,0 +1,94 @@
+#include <algorithm>
+#include <cstring>
+#include <PathTable.h>
+#include <Hash.h>
+
+static constexpr size_t min_chunk_size = 4 * 1024;
+
+const char* PathTable::store(std::string_view data) {
+    if(chunks.empty() || chunk_used + data.size() > chunk_size) {
+        // Chunks double in size, so that large tables need few of them
+        chunk_size = std::max({min_chunk_size, chunk_size * 2, data.size()});
+        chunks.emplace_back(new char[chunk_size]);
+        chunk_used = 0;
+    }
+    char* ptr = chunks.back().get() + chunk_used;
+    memcpy(ptr, data.data(), data.size());
+    chunk_used += data.size();
+    return ptr;
+}
+
+void PathTable::add(std::string_view path) {
+    size_t slash = path.rfind('/');
+    std::string_view directory = slash == std::string_view::npos ? std::string_view() : path.substr(0, slash + 1);
+    std::string_view name = slash == std::string_view::npos ? path : path.substr(slash + 1);
+
+    // Files of one folder are usually next to each other, so check the last directory before hashing
+    uint32_t directory_number;
+    if(!entries.empty() && directories[entries.back().directory] == directory) {
+        directory_number = entries.back().directory;
+    } else {
+        auto it = directory_index.find(directory);
+        if(it != directory_index.end()) {
+            directory_number = it->second;
+        } else {
+            std::string_view stored(store(directory), directory.size());
+            directory_number = directories.size();
+            directories.push_back(stored);
+            directory_index.emplace(stored, directory_number);
+        }
+    }
+    entries.push_back({store(name), (uint32_t)name.size(), directory_number});
+}
+
+void PathTable::clear() {
+    entries.clear();
+    directories.clear();
+    directory_index.clear();
+    chunks.clear();
+    chunk_used = 0;
+    chunk_size = 0;
+}
+
+void PathTable::get(size_t i, std::string& out) const {
+    const Entry& entry = entries[i];
+    const std::string_view& directory = directories[entry.directory];
+    out.assign(directory.data(), directory.size());
+    out.append(entry.name, entry.name_length);
+}
+
+std::string PathTable::get(size_t i) const {
+    std::string ret;
+    get(i, ret);
+    return ret;
+}
+
+static int hexValue(char c) {
+    if(c >= '0' && c <= '9') { return c - '0'; }
+    if(c >= 'a' && c <= 'f') { return c - 'a' + 10; }
+    if(c >= 'A' && c <= 'F') { return c - 'A' + 10; }
+    return -1;
+}
+
+bool FileDigests::add(std::string_view path, std::string_view hex) {
+    if(hex.empty() || hex.size() % 2 != 0) { return false; }
+    if(digest_size == 0) { digest_size = hex.size() / 2; }
+    if(hex.size() / 2 != digest_size) { return false; }
+    size_t offset = digests.size();
+    digests.resize(offset + digest_size);
+    for(size_t i = 0; i < digest_size; i++) {
+        int high = hexValue(hex[i * 2]);
+        int low = hexValue(hex[i * 2 + 1]);
+        if(high < 0 || low < 0) {
+            digests.resize(offset);
+            return false;
+        }
+        digests[offset + i] = (uint8_t)(high << 4 | low);
+    }
+    paths.add(path);
+    return true;
+}
+
+std::string FileDigests::hex(size_t i) const {
+    return Sha256::toHex(digest(i), digest_size);
+}
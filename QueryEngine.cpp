@@ -0,0 +1,247 @@
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <tuple>
+#include <fnmatch.h>
+#include <unistd.h>
+#include <QueryEngine.h>
+#include <OwnerIndex.h>
+#include <RepositoryEngine.h>
+#include <Stats.h>
+
+namespace fs = std::filesystem;
+
+std::string QueryEngine::jsonString(const std::string& value) {
+    std::string ret = "\"";
+    for(unsigned char c : value) {
+        switch(c) {
+            case '"': ret += "\\\""; break;
+            case '\\': ret += "\\\\"; break;
+            case '\n': ret += "\\n"; break;
+            case '\t': ret += "\\t"; break;
+            default:
+                if(c < 0x20) {
+                    char escaped[8];
+                    snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                    ret += escaped;
+                } else {
+                    ret += (char)c;
+                }
+        }
+    }
+    return ret + "\"";
+}
+
+std::string QueryEngine::literalPrefix(const std::string& pattern) {
+    return pattern.substr(0, pattern.find_first_of("*?[\\"));
+}
+
+bool QueryEngine::isGlob(const std::string& pattern) {
+    return pattern.find_first_of("*?[\\") != std::string::npos;
+}
+
+/// Call found(name) for every name in a sorted list that matches the pattern.
+template<typename Found>
+static void matchSorted(const std::vector<std::string>& sorted, const std::string& pattern, Found found) {
+    const std::string prefix = QueryEngine::literalPrefix(pattern);
+    const bool glob = QueryEngine::isGlob(pattern);
+    for(auto it = std::lower_bound(sorted.begin(), sorted.end(), prefix); it != sorted.end() && it->compare(0, prefix.size(), prefix) == 0; ++it) {
+        if(glob && fnmatch(pattern.c_str(), it->c_str(), 0) != 0) { continue; }
+        found(*it);
+    }
+}
+
+bool QueryEngine::parseFormat(const std::string& name, Format& format) {
+    if(name == "text") { format = Format::Text; }
+    else if(name == "tsv") { format = Format::TSV; }
+    else if(name == "json") { format = Format::JSON; }
+    else { return false; }
+    return true;
+}
+
+const std::vector<std::string>& QueryEngine::InstalledNames() {
+    if(installed_names_loaded) { return installed_names; }
+    installed_names_loaded = true;
+    // Package folders are named after their package, so listing the folder is enough; no manifest has to be read
+    std::error_code ec;
+    for(auto& p : fs::directory_iterator(install_root + "/etc/bvpm/packages", ec)) {
+        if(p.is_directory(ec)) { installed_names.push_back(p.path().filename().string()); }
+    }
+    std::sort(installed_names.begin(), installed_names.end());
+    return installed_names;
+}
+
+bool QueryEngine::ReadInstalledVersion(const std::string& name, std::string& version) {
+    ConfigFile manifest = Config::readConfigFile(install_root + "/etc/bvpm/packages/" + name + "/manifest");
+    if(manifest.values.find("failed") != manifest.values.end()) { return false; }
+    Stats::add(Stats::ManifestsParsed);
+    auto package = manifest.values.find("PACKAGE");
+    if(package == manifest.values.end() || package->second != name) { return false; }
+    auto version_entry = manifest.values.find("VERSION");
+    version = version_entry != manifest.values.end() ? version_entry->second : "";
+    return true;
+}
+
+void QueryEngine::PrintMatches(const std::vector<Match>& matches) {
+    if(format == Format::JSON) {
+        out << "[";
+        for(size_t i = 0; i < matches.size(); i++) {
+            out << (i ? ", " : "") << "{\"name\": " << jsonString(matches[i].name) << ", \"version\": " << jsonString(matches[i].version)
+                << ", \"source\": " << jsonString(matches[i].source) << "}";
+        }
+        out << "]\n";
+        return;
+    }
+    for(const Match& match : matches) {
+        if(format == Format::TSV) {
+            out << match.name << '\t' << match.version << '\t' << match.source << '\n';
+        } else if(match.source == "installed") {
+            out << match.name << ": " << match.version << '\n';
+        } else {
+            out << match.name << ": " << match.version << " (available from " << match.source << ")\n";
+        }
+    }
+}
+
+int QueryEngine::Query(const std::vector<std::string>& packages) {
+    std::vector<Match> matches;
+    int num_notfound = 0;
+    for(const std::string& package : packages) {
+        std::string version;
+        if(ReadInstalledVersion(package, version)) {
+            matches.push_back({package, version, "installed"});
+            continue;
+        }
+        num_notfound++;
+        // Keep the machine readable formats parseable; the misses go to stderr there
+        if(format != Format::Text) {
+            std::cerr << "package " << package << " not installed" << std::endl;
+            continue;
+        }
+        PrintMatches(matches);
+        matches.clear();
+        out << "package " << package << " not installed" << '\n';
+    }
+    PrintMatches(matches);
+    out.flush();
+    return num_notfound;
+}
+
+int QueryEngine::Search(const std::vector<std::string>& patterns, bool include_repositories) {
+    std::vector<Match> matches;
+    const std::vector<std::string>& installed = InstalledNames();
+    std::vector<std::string> matched_installed;
+    for(const std::string& pattern : patterns) {
+        matchSorted(installed, pattern, [&](const std::string& name) { matched_installed.push_back(name); });
+    }
+    std::sort(matched_installed.begin(), matched_installed.end());
+    matched_installed.erase(std::unique(matched_installed.begin(), matched_installed.end()), matched_installed.end());
+    for(const std::string& name : matched_installed) {
+        std::string version;
+        if(ReadInstalledVersion(name, version)) { matches.push_back({name, version, "installed"}); }
+    }
+
+    if(include_repositories) {
+        RepositoryEngine repositoryEngine(config, install_root);
+        std::vector<std::tuple<std::string, std::string, std::string>> available;
+        repositoryEngine.listPackages(available);
+        std::sort(available.begin(), available.end());
+        std::vector<std::string> available_names;
+        available_names.reserve(available.size());
+        for(const auto& package : available) { available_names.push_back(std::get<0>(package)); }
+        std::vector<size_t> matched_available;
+        for(const std::string& pattern : patterns) {
+            matchSorted(available_names, pattern, [&](const std::string& name) {
+                matched_available.push_back(&name - available_names.data());
+            });
+        }
+        std::sort(matched_available.begin(), matched_available.end());
+        matched_available.erase(std::unique(matched_available.begin(), matched_available.end()), matched_available.end());
+        for(size_t i : matched_available) {
+            matches.push_back({std::get<0>(available[i]), std::get<1>(available[i]), std::get<2>(available[i])});
+        }
+        std::stable_sort(matches.begin(), matches.end(), [](const Match& a, const Match& b) { return a.name < b.name; });
+    }
+
+    PrintMatches(matches);
+    out.flush();
+    return matches.empty() ? 1 : 0;
+}
+
+int QueryEngine::ListFiles(const std::vector<std::string>& packages) {
+    int num_notfound = 0;
+    bool first = true;
+    if(format == Format::JSON) { out << "{"; }
+    for(const std::string& package : packages) {
+        std::ifstream file(install_root + "/etc/bvpm/packages/" + package + "/owned-files");
+        if(!file.is_open()) {
+            (format == Format::Text ? out : std::cerr) << "package " << package << " not installed" << '\n';
+            num_notfound++;
+            continue;
+        }
+        Stats::add(Stats::ManifestsParsed);
+        if(format == Format::JSON) { out << (first ? "" : ", ") << jsonString(package) << ": ["; }
+        bool first_file = true;
+        std::string line;
+        while(std::getline(file, line, '\n')) {
+            if(line.empty()) { continue; }
+            if(format == Format::JSON) {
+                out << (first_file ? "" : ", ") << jsonString(line);
+            } else if(format == Format::TSV) {
+                out << package << '\t' << line << '\n';
+            } else {
+                out << package << ' ' << line << '\n';
+            }
+            first_file = false;
+        }
+        if(format == Format::JSON) { out << "]"; }
+        first = false;
+    }
+    if(format == Format::JSON) { out << "}\n"; }
+    out.flush();
+    return num_notfound;
+}
+
+int QueryEngine::Owns(const std::vector<std::string>& paths) {
+    // Paths inside owned-files are absolute, relative to the install root
+    std::vector<std::string> needles;
+    std::error_code ec;
+    const fs::path root = fs::absolute(install_root, ec).lexically_normal();
+    for(const std::string& path : paths) {
+        fs::path p(path);
+        if(p.is_relative()) {
+            p = fs::absolute(p, ec).lexically_normal();
+            fs::path inside_root = p.lexically_relative(root);
+            if(!inside_root.empty() && *inside_root.begin() != "..") { p = fs::path("/") / inside_root; }
+        }
+        std::string needle = p.lexically_normal().generic_string();
+        while(needle.size() > 1 && needle.back() == '/') { needle.pop_back(); }
+        needles.push_back(needle);
+    }
+
+    // The owner index of the root has every owned path sorted, so a path is a binary search, whatever is installed
+    OwnerIndex index(install_root);
+    std::vector<std::vector<std::string>> owners;
+    for(const std::string& needle : needles) { owners.push_back(index.owners(needle)); }
+
+    int num_unowned = 0;
+    if(format == Format::JSON) { out << "{"; }
+    for(size_t i = 0; i < needles.size(); i++) {
+        if(owners[i].empty()) { num_unowned++; }
+        if(format == Format::JSON) {
+            out << (i ? ", " : "") << jsonString(needles[i]) << ": [";
+            for(size_t j = 0; j < owners[i].size(); j++) { out << (j ? ", " : "") << jsonString(owners[i][j]); }
+            out << "]";
+        } else if(format == Format::TSV) {
+            for(const std::string& owner : owners[i]) { out << needles[i] << '\t' << owner << '\n'; }
+        } else if(owners[i].empty()) {
+            out << needles[i] << " is not owned by any package" << '\n';
+        } else {
+            for(const std::string& owner : owners[i]) { out << needles[i] << " is owned by " << owner << '\n'; }
+        }
+    }
+    if(format == Format::JSON) { out << "}\n"; }
+    out.flush();
+    return num_unowned;
+}
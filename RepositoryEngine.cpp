@@ -4,37 +4,97 @@
 
 #include <iostream>
 #include <filesystem>
+#include <algorithm>
+#include <cstring>
 #include <utility>
 #include <RepositoryEngine.h>
 #include <LocalFolderRepository.h>
+#ifdef BVPM_ENABLE_HTTP
+#include <HttpRepository.h>
+#endif
 #include "human-readable.h"
 
 namespace fs = std::filesystem;
 
 RepositoryEngine::RepositoryEngine(const ConfigFile& globalConfigFile, std::string _install_root) : install_root(std::move(_install_root)) {
+    // Downloaded packages go into CACHE_DIR, relative to the install root
+    cache_path = install_root + "/var/cache/bvpm";
+    auto cache_dir = globalConfigFile.values.find("CACHE_DIR");
+    if(cache_dir != globalConfigFile.values.end()) { cache_path = install_root + "/" + cache_dir->second; }
+    auto parallel = globalConfigFile.values.find("HTTP_PARALLEL_DOWNLOADS");
+    if(parallel != globalConfigFile.values.end()) { parallel_downloads = std::max(1ll, std::atoll(parallel->second.c_str())); }
+
     // We look through the config file to find repository references
     // The name after the _ is only for humans, we ignore it and use the name referenced in
     // the manifest file
+    // The URL scheme picks the repository type; plain paths and file:// are local folders
+    // PRIORITY_<name>=N gives REPOSITORY_<name> a priority; higher priorities win, the default is 0
+    std::vector<std::pair<long long, Repository*>> prioritized;
     for(const std::pair<std::string, std::string> config : globalConfigFile.values) {
         if(config.first.rfind("REPOSITORY_", 0) == 0) {
-            Repository* repo = new LocalFolderRepository("local-folder-repo", config.second);
+            const std::string& location = config.second;
+            Repository* repo;
+            if(location.rfind("http://", 0) == 0 || location.rfind("https://", 0) == 0) {
+#ifdef BVPM_ENABLE_HTTP
+                repo = new HttpRepository("http-repo", location, cache_path, parallel_downloads);
+#else
+                std::cerr << "error: repository " << location << " needs http support, which this bvpm was built without" << std::endl;
+                continue;
+#endif
+            } else if(location.rfind("file://", 0) == 0) {
+                repo = new LocalFolderRepository("local-folder-repo", location.substr(strlen("file://")));
+            } else {
+                repo = new LocalFolderRepository("local-folder-repo", location);
+            }
             if(!repo->good()) {
                 delete repo; continue;
             }
-            repositories.push_back(repo);
+            long long priority = 0;
+            auto priority_entry = globalConfigFile.values.find("PRIORITY_" + config.first.substr(strlen("REPOSITORY_")));
+            if(priority_entry != globalConfigFile.values.end()) { priority = std::atoll(priority_entry->second.c_str()); }
+            prioritized.emplace_back(priority, repo);
         }
     }
+    std::stable_sort(prioritized.begin(), prioritized.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+    for(const auto& entry : prioritized) { repositories.push_back(entry.second); }
+    buildPackageTable();
 }
 
-bool RepositoryEngine::isPackageInRepos(const std::string& package_name) {
+RepositoryEngine::~RepositoryEngine() {
+    for(Repository* repo : repositories) { delete repo; }
+}
+
+void RepositoryEngine::buildPackageTable() {
+    std::vector<std::pair<std::string, std::string>> packages;
     for(Repository* repo : repositories) {
-        if(repo->checkIfPackageIsAvailable(package_name)) { return true; }
+        packages.clear();
+        if(!repo->listPackages(packages)) {
+            unlisted_repositories.push_back(repo);
+            continue;
+        }
+        package_table.reserve(package_table.size() + packages.size());
+        for(auto& package : packages) {
+            // Repositories are sorted by priority, so the first one to claim a package keeps it
+            package_table.emplace(std::move(package.first), PackageLocation{repo, std::move(package.second)});
+        }
     }
-    return false;
+}
+
+void RepositoryEngine::listPackages(std::vector<std::tuple<std::string, std::string, std::string>>& packages) {
+    packages.reserve(packages.size() + package_table.size());
+    for(const auto& package : package_table) {
+        packages.emplace_back(package.first, package.second.version, package.second.repository->getName());
+    }
+}
+
+bool RepositoryEngine::isPackageInRepos(const std::string& package_name) {
+    return findBestRepoForPackage(package_name) != nullptr;
 }
 
 Repository* RepositoryEngine::findBestRepoForPackage(const std::string& package_name) {
-    for(Repository* repo : repositories) {
+    auto it = package_table.find(package_name);
+    if(it != package_table.end()) { return it->second.repository; }
+    for(Repository* repo : unlisted_repositories) {
         if(repo->checkIfPackageIsAvailable(package_name)) { return repo; }
     }
     return nullptr;
@@ -46,6 +106,29 @@ bool RepositoryEngine::preparePackage(const std::string& package_name) {
     return repo->preparePackage(package_name);
 }
 
+bool RepositoryEngine::preparePackages(const std::vector<std::string>& packages) {
+    // Group the packages by repository, so that every repository can fetch its packages in one go
+    std::vector<std::pair<Repository*, std::vector<std::string>>> per_repo;
+    for(const std::string& package_name : packages) {
+        Repository* repo = findBestRepoForPackage(package_name);
+        if(!repo) {
+            std::cerr << "error preparing package " << package_name << ": not in repos" << std::endl;
+            return false;
+        }
+        auto it = std::find_if(per_repo.begin(), per_repo.end(), [repo](const auto& entry) { return entry.first == repo; });
+        if(it == per_repo.end()) {
+            per_repo.emplace_back(repo, std::vector<std::string>{package_name});
+        } else {
+            it->second.push_back(package_name);
+        }
+    }
+    bool ret = true;
+    for(auto& entry : per_repo) {
+        ret = entry.first->preparePackages(entry.second) && ret;
+    }
+    return ret;
+}
+
 std::string RepositoryEngine::getBVPFileForPackage(const std::string& package_name) {
     Repository* repo = findBestRepoForPackage(package_name);
     if(!repo) { return ""; }
@@ -78,6 +161,8 @@ bool RepositoryEngine::GetUserPermission(const std::vector<std::string>& package
 }
 
 std::string RepositoryEngine::getPackageVersion(const std::string& package_name) {
+    auto it = package_table.find(package_name);
+    if(it != package_table.end()) { return it->second.version; }
     Repository* repo = findBestRepoForPackage(package_name);
     if(!repo) { return ""; }
     return repo->getPackageVersion(package_name);
@@ -102,6 +187,7 @@ SimplePackageData RepositoryEngine::getSimplePackageData(const std::string& pack
     ret.dependencies = getPackageDependencies(package_name);
     ret.total_package_bytes = getPackageTotalSize(package_name);
     ret.total_package_file_bytes = getPackageFileSize(package_name);
+    ret.file_hash = getPackageHash(package_name);
     return ret;
 }
 
@@ -110,3 +196,24 @@ std::vector<std::string> RepositoryEngine::getPackageDependencies(const std::str
     if(!repo) { return {}; }
     return repo->getPackageDependencies(package_name);
 }
+
+
+bool RepositoryEngine::getPackageClosure(const std::string& package_name, std::vector<std::string>& closure) {
+    Repository* repo = findBestRepoForPackage(package_name);
+    if(!repo || !repo->getPackageClosure(package_name, closure)) { return false; }
+    for(const std::string& member : closure) {
+        if(findBestRepoForPackage(member) != repo) { return false; }
+    }
+    return true;
+}
+
+bool RepositoryEngine::getPackageFiles(const std::string& package_name, std::vector<RepositoryFile>& files) {
+    Repository* repo = findBestRepoForPackage(package_name);
+    return repo && repo->getPackageFiles(package_name, files);
+}
+
+std::string RepositoryEngine::getPackageHash(const std::string& package_name) {
+    Repository* repo = findBestRepoForPackage(package_name);
+    if(!repo) { return ""; }
+    return repo->getPackageHash(package_name);
+}
@@ -0,0 +1,121 @@
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <RepositoryFileIndex.h>
+#include <Stats.h>
+
+namespace fs = std::filesystem;
+
+static const char* files_header = "BVPM-FILES 1";
+
+bool RepositoryFileIndex::readFromStream(std::istream& stream) {
+    packages.clear();
+    std::string line;
+    if(!std::getline(stream, line) || line != files_header) {
+        std::cerr << "error reading repository file index: unknown format" << std::endl;
+        return false;
+    }
+    // The file lines stay front coded until a package's files are asked for
+    Package* package = nullptr;
+    while(std::getline(stream, line)) {
+        if(line.empty()) { continue; }
+        if(line[0] != '@') {
+            if(package) { package->lines.append(line).append("\n"); }
+            continue;
+        }
+        size_t first = line.find('\t');
+        size_t second = first == std::string::npos ? first : line.find('\t', first + 1);
+        if(second == std::string::npos) {
+            std::cerr << "found invalid repository file index line \"" << line << "\"; ignoring the package" << std::endl;
+            package = nullptr;
+            continue;
+        }
+        package = &packages[line.substr(1, first - 1)];
+        package->sha256 = line.substr(first + 1, second - first - 1);
+        package->count = std::strtoull(line.c_str() + second + 1, nullptr, 10);
+        package->lines.clear();
+    }
+    Stats::add(Stats::ManifestsParsed);
+    return true;
+}
+
+bool RepositoryFileIndex::readFromFile(const std::string& file) {
+    std::ifstream stream(file);
+    if(!stream.is_open()) { return false; }
+    return readFromStream(stream);
+}
+
+bool RepositoryFileIndex::writeToFile(const std::string& file, const RepositoryIndex& index) const {
+    // Write to a temporary file first, so that readers never see a half-written file index
+    std::string temp_file = file + ".new";
+    {
+        std::ofstream stream(temp_file, std::ios::trunc);
+        if(!stream.is_open()) { return false; }
+        stream << files_header << "\n";
+        for(const auto& package : packages) {
+            const RepositoryIndexEntry* entry = index.find(package.first);
+            if(!entry || entry->sha256 != package.second.sha256) { continue; }
+            stream << "@" << package.first << "\t" << package.second.sha256 << "\t" << package.second.count << "\n" << package.second.lines;
+        }
+        if(!stream.good()) { return false; }
+    }
+    std::error_code ec;
+    fs::rename(temp_file, file, ec);
+    return !ec;
+}
+
+void RepositoryFileIndex::setFiles(const std::string& name, const std::string& package_sha256, std::vector<RepositoryFile> files) {
+    std::sort(files.begin(), files.end(), [](const RepositoryFile& a, const RepositoryFile& b) { return a.path < b.path; });
+    Package& package = packages[name];
+    package.sha256 = package_sha256;
+    package.count = files.size();
+    package.lines.clear();
+    // Sorted paths share most of their folders with the path before them, which is then only stored once
+    const std::string* previous = nullptr;
+    for(const RepositoryFile& file : files) {
+        size_t shared = 0;
+        if(previous) {
+            size_t max = std::min(previous->size(), file.path.size());
+            while(shared < max && (*previous)[shared] == file.path[shared]) { shared++; }
+        }
+        package.lines.append(std::to_string(shared)).append("\t").append(file.path, shared).append("\t").append(file.sha256).append("\n");
+        previous = &file.path;
+    }
+}
+
+void RepositoryFileIndex::setPackageHash(const std::string& name, const std::string& package_sha256) {
+    auto package = packages.find(name);
+    if(package != packages.end()) { package->second.sha256 = package_sha256; }
+}
+
+bool RepositoryFileIndex::getFiles(const std::string& name, const std::string& package_sha256, std::vector<RepositoryFile>& files) const {
+    files.clear();
+    auto package = packages.find(name);
+    if(package == packages.end() || package->second.sha256 != package_sha256) { return false; }
+    files.reserve(package->second.count);
+    const std::string& lines = package->second.lines;
+    std::string path;
+    for(size_t start = 0, end; start < lines.size(); start = end + 1) {
+        end = lines.find('\n', start);
+        if(end == std::string::npos) { end = lines.size(); }
+        size_t first = lines.find('\t', start);
+        size_t second = first < end ? lines.find('\t', first + 1) : std::string::npos;
+        size_t shared = std::strtoull(lines.c_str() + start, nullptr, 10);
+        if(second >= end || shared > path.size()) {
+            std::cerr << "found invalid file list for package " << name << " in the repository file index; ignoring it" << std::endl;
+            files.clear();
+            return false;
+        }
+        path.resize(shared);
+        path.append(lines, first + 1, second - first - 1);
+        files.push_back({path, lines.substr(second + 1, end - second - 1)});
+    }
+    if(files.size() != package->second.count) {
+        std::cerr << "found incomplete file list for package " << name << " in the repository file index; ignoring it" << std::endl;
+        files.clear();
+        return false;
+    }
+    return true;
+}
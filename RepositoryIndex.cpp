@@ -0,0 +1,231 @@
+#include <charconv>
+#include <cstdlib>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+#include <unordered_map>
+#include <RepositoryIndex.h>
+#include <Stats.h>
+
+namespace fs = std::filesystem;
+
+static const char* index_header = "BVPM-INDEX 2";
+static const char* index_header_v1 = "BVPM-INDEX 1";
+
+static std::vector<uint32_t> parseIDs(const std::string& field) {
+    std::vector<uint32_t> ids;
+    const char* p = field.c_str();
+    while(*p) {
+        char* end;
+        ids.push_back((uint32_t)std::strtoul(p, &end, 10));
+        if(end == p) { return {}; }
+        p = *end == ',' ? end + 1 : end;
+    }
+    return ids;
+}
+
+static constexpr uint32_t no_id = UINT32_MAX;
+
+/// Map the IDs of names_by_id to those in ids, or to no_id for packages that are gone or dropped
+static std::vector<uint32_t> remapIDs(const std::vector<std::string>& names_by_id, const std::unordered_map<std::string, uint32_t>& ids,
+                                      const std::set<std::string>& dropped) {
+    std::vector<uint32_t> remap(names_by_id.size(), no_id);
+    for(size_t old_id = 0; old_id < names_by_id.size(); old_id++) {
+        auto current = ids.find(names_by_id[old_id]);
+        if(current != ids.end() && !dropped.count(current->first)) { remap[old_id] = current->second; }
+    }
+    return remap;
+}
+
+bool RepositoryIndex::readFromStream(std::istream& stream) {
+    packages.clear();
+    names_by_id.clear();
+    std::string line;
+    if(!std::getline(stream, line) || (line != index_header && line != index_header_v1)) {
+        std::cerr << "error reading repository index: unknown index format" << std::endl;
+        return false;
+    }
+    // Closures may refer to packages further down, so they are only resolved once every line has been read
+    std::vector<std::pair<RepositoryIndexEntry*, std::string>> closures;
+    while(std::getline(stream, line)) {
+        if(line.empty()) { continue; }
+        std::vector<std::string> fields;
+        std::istringstream ss(line);
+        std::string field;
+        while(std::getline(ss, field, '\t')) { fields.push_back(field); }
+        // Trailing empty fields (no hash, no closure) do not produce one
+        if(!line.empty() && line.back() == '\t') { fields.emplace_back(); }
+        while(fields.size() >= 6 && fields.size() < 8) { fields.emplace_back(); }
+        if(fields.size() != 8) {
+            std::cerr << "found invalid repository index line \"" << line << "\"; ignoring it" << std::endl;
+            continue;
+        }
+        RepositoryIndexEntry entry;
+        entry.name = fields[0];
+        entry.version = fields[1];
+        entry.installed_size = std::atoll(fields[2].c_str());
+        entry.file_size = std::atoll(fields[3].c_str());
+        if(!fields[4].empty()) {
+            std::stringstream deps(fields[4]);
+            std::string dep;
+            while(std::getline(deps, dep, ',')) { entry.dependencies.push_back(dep); }
+        }
+        entry.filename = fields[5];
+        entry.sha256 = fields[6];
+        names_by_id.push_back(entry.name);
+        RepositoryIndexEntry& stored = packages[entry.name] = std::move(entry);
+        if(!fields[7].empty()) { closures.emplace_back(&stored, std::move(fields[7])); }
+    }
+    for(auto& closure : closures) {
+        closure.first->closure = parseIDs(closure.second);
+        for(uint32_t id : closure.first->closure) {
+            if(id >= names_by_id.size()) {
+                closure.first->closure.clear();
+                break;
+            }
+        }
+    }
+    Stats::add(Stats::ManifestsParsed);
+    return true;
+}
+
+bool RepositoryIndex::readFromFile(const std::string& file) {
+    std::ifstream stream(file);
+    if(!stream.is_open()) { return false; }
+    return readFromStream(stream);
+}
+
+bool RepositoryIndex::writeToFile(const std::string& file) const {
+    // Write to a temporary file first, so that readers never see a half-written index
+    std::string temp_file = file + ".new";
+    {
+        std::ofstream stream(temp_file, std::ios::trunc);
+        if(!stream.is_open()) { return false; }
+        stream << index_header << "\n";
+        std::unordered_map<std::string, uint32_t> ids;
+        for(const auto& package : packages) { ids.emplace(package.first, (uint32_t)ids.size()); }
+        const std::vector<uint32_t> remap = remapIDs(names_by_id, ids, {});
+        std::vector<uint32_t> closure;
+        std::string closure_field;
+        for(const auto& package : packages) {
+            const RepositoryIndexEntry& entry = package.second;
+            stream << entry.name << "\t" << entry.version << "\t" << entry.installed_size << "\t" << entry.file_size << "\t";
+            for(size_t i = 0; i < entry.dependencies.size(); i++) {
+                stream << entry.dependencies[i];
+                if(i < (entry.dependencies.size() - 1)) { stream << ","; }
+            }
+            stream << "\t" << entry.filename << "\t" << entry.sha256 << "\t";
+            // Packages may have come and gone since the closures were numbered; a closure that lost a package is dropped
+            closure.clear();
+            for(uint32_t id : entry.closure) {
+                if(id >= remap.size() || remap[id] == no_id) {
+                    closure.clear();
+                    break;
+                }
+                closure.push_back(remap[id]);
+            }
+            // Closures are most of the index, so they are formatted by hand rather than through the stream
+            closure_field.clear();
+            char number[16];
+            for(size_t i = 0; i < closure.size(); i++) {
+                if(i) { closure_field += ','; }
+                closure_field.append(number, std::to_chars(number, number + sizeof(number), closure[i]).ptr);
+            }
+            closure_field += '\n';
+            stream << closure_field;
+        }
+        if(!stream.good()) { return false; }
+    }
+    fs::rename(temp_file, file);
+    return true;
+}
+
+const RepositoryIndexEntry* RepositoryIndex::find(const std::string& name) const {
+    auto it = packages.find(name);
+    if(it == packages.end()) { return nullptr; }
+    return &it->second;
+}
+
+bool RepositoryIndex::getClosure(const std::string& name, std::vector<std::string>& closure) const {
+    const RepositoryIndexEntry* entry = find(name);
+    if(!entry || entry->closure.empty()) { return false; }
+    closure.clear();
+    closure.reserve(entry->closure.size());
+    for(uint32_t id : entry->closure) { closure.push_back(names_by_id[id]); }
+    return true;
+}
+
+namespace {
+/// Computes closures depth first, reusing the closures that are known already
+struct ClosureBuilder {
+    std::vector<RepositoryIndexEntry*> by_id;
+    std::unordered_map<std::string, uint32_t> ids;
+    /// Whether the closure of a package is up to date, and can be reused
+    std::vector<char> done;
+    /// Packages already in the closure being built are marked with its stamp
+    std::vector<uint32_t> marks;
+    uint32_t stamp = 0;
+
+    bool visit(uint32_t id, uint32_t root, std::vector<uint32_t>& closure) {
+        if(marks[id] == stamp) { return true; }
+        const RepositoryIndexEntry& entry = *by_id[id];
+        if(id != root && done[id]) {
+            if(entry.closure.empty()) { return false; }
+            // Its closure is in install order already; what we have from it is in ours, before it
+            for(uint32_t member : entry.closure) {
+                if(marks[member] == stamp) { continue; }
+                marks[member] = stamp;
+                closure.push_back(member);
+            }
+            return true;
+        }
+        // Marked before going into the dependencies, so that a dependency cycle ends here
+        marks[id] = stamp;
+        for(const std::string& dependency : entry.dependencies) {
+            auto dependency_id = ids.find(dependency);
+            if(dependency_id == ids.end() || !visit(dependency_id->second, root, closure)) { return false; }
+        }
+        closure.push_back(id);
+        return true;
+    }
+};
+}
+
+void RepositoryIndex::updateClosures(const std::set<std::string>& changed) {
+    ClosureBuilder builder;
+    builder.by_id.reserve(packages.size());
+    for(auto& package : packages) {
+        builder.ids.emplace(package.first, (uint32_t)builder.by_id.size());
+        builder.by_id.push_back(&package.second);
+    }
+    builder.done.assign(packages.size(), 0);
+    builder.marks.assign(packages.size(), 0);
+
+    // Renumber the closures that stay as they are, and find the ones that do not
+    const std::vector<uint32_t> remap = remapIDs(names_by_id, builder.ids, changed);
+    std::vector<uint32_t> renumbered;
+    for(uint32_t id = 0; id < builder.by_id.size(); id++) {
+        RepositoryIndexEntry& entry = *builder.by_id[id];
+        bool affected = entry.closure.empty() || changed.count(entry.name);
+        renumbered.clear();
+        for(size_t i = 0; !affected && i < entry.closure.size(); i++) {
+            const uint32_t old_id = entry.closure[i];
+            affected = old_id >= remap.size() || remap[old_id] == no_id;
+            if(!affected) { renumbered.push_back(remap[old_id]); }
+        }
+        entry.closure = affected ? std::vector<uint32_t>() : renumbered;
+        builder.done[id] = !affected;
+    }
+    names_by_id.clear();
+    names_by_id.reserve(packages.size());
+    for(const auto& package : packages) { names_by_id.push_back(package.first); }
+
+    for(uint32_t id = 0; id < builder.by_id.size(); id++) {
+        if(builder.done[id]) { continue; }
+        builder.stamp++;
+        std::vector<uint32_t> closure;
+        if(builder.visit(id, id, closure)) { builder.by_id[id]->closure = std::move(closure); }
+        builder.done[id] = 1;
+    }
+}
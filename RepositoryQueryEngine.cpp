@@ -0,0 +1,128 @@
+#include <algorithm>
+#include <iostream>
+#include <fnmatch.h>
+#include <RepositoryQueryEngine.h>
+#include <human-readable.h>
+
+using Format = QueryEngine::Format;
+
+static std::string json(std::string_view value) {
+    return QueryEngine::jsonString(std::string(value));
+}
+
+void RepositoryQueryEngine::PrintList(const std::vector<size_t>& matches) {
+    if(format == Format::JSON) {
+        out << "[";
+        for(size_t i = 0; i < matches.size(); i++) {
+            RepositoryQueryIndex::Package package = index.package(matches[i]);
+            out << (i ? ", " : "") << "{\"name\": " << json(package.name) << ", \"version\": " << json(package.version) << "}";
+        }
+        out << "]\n";
+        return;
+    }
+    for(size_t match : matches) {
+        RepositoryQueryIndex::Package package = index.package(match);
+        out << package.name << (format == Format::TSV ? "\t" : ": ") << package.version << '\n';
+    }
+}
+
+void RepositoryQueryEngine::NotFound(const std::string& package) {
+    // Keep the machine readable formats parseable; the misses go to stderr there
+    (format == Format::Text ? out : std::cerr) << "package " << package << " not in repository" << '\n';
+}
+
+int RepositoryQueryEngine::List() {
+    std::vector<size_t> matches(index.size());
+    for(size_t i = 0; i < matches.size(); i++) { matches[i] = i; }
+    PrintList(matches);
+    out.flush();
+    return 0;
+}
+
+int RepositoryQueryEngine::Search(const std::vector<std::string>& patterns) {
+    std::vector<size_t> matches;
+    for(const std::string& pattern : patterns) {
+        // Only the names starting with the literal part of the pattern have to be matched against it
+        auto range = index.prefixRange(QueryEngine::literalPrefix(pattern));
+        const bool glob = QueryEngine::isGlob(pattern);
+        for(size_t i = range.first; i < range.second; i++) {
+            if(glob && fnmatch(pattern.c_str(), std::string(index.package(i).name).c_str(), 0) != 0) { continue; }
+            matches.push_back(i);
+        }
+    }
+    // Package numbers follow the names, so sorting them sorts the matches by name
+    std::sort(matches.begin(), matches.end());
+    matches.erase(std::unique(matches.begin(), matches.end()), matches.end());
+    PrintList(matches);
+    out.flush();
+    return matches.empty() ? 1 : 0;
+}
+
+int RepositoryQueryEngine::Show(const std::vector<std::string>& packages) {
+    int num_notfound = 0;
+    bool first = true;
+    if(format == Format::JSON) { out << "["; }
+    for(const std::string& name : packages) {
+        size_t i = index.find(name);
+        if(i == RepositoryQueryIndex::npos) {
+            NotFound(name);
+            num_notfound++;
+            continue;
+        }
+        RepositoryQueryIndex::Package package = index.package(i);
+        const size_t dependency_count = index.dependencyCount(i);
+        if(format == Format::JSON) {
+            out << (first ? "" : ", ") << "{\"name\": " << json(package.name) << ", \"version\": " << json(package.version)
+                << ", \"installed_size\": " << package.installed_size << ", \"file_size\": " << package.file_size << ", \"dependencies\": [";
+            for(size_t d = 0; d < dependency_count; d++) { out << (d ? ", " : "") << json(index.dependency(i, d)); }
+            out << "], \"filename\": " << json(package.filename) << ", \"sha256\": " << json(package.sha256) << "}";
+        } else if(format == Format::TSV) {
+            // The same fields as a repo.index line
+            out << package.name << '\t' << package.version << '\t' << package.installed_size << '\t' << package.file_size << '\t';
+            for(size_t d = 0; d < dependency_count; d++) { out << (d ? "," : "") << index.dependency(i, d); }
+            out << '\t' << package.filename << '\t' << package.sha256 << '\n';
+        } else {
+            out << package.name << ": " << package.version << '\n';
+            out << "    installed size: " << humanSize(package.installed_size) << '\n';
+            out << "    file size: " << humanSize(package.file_size) << '\n';
+            out << "    dependencies:";
+            for(size_t d = 0; d < dependency_count; d++) { out << ' ' << index.dependency(i, d); }
+            out << '\n';
+            out << "    file: " << package.filename << '\n';
+            out << "    sha256: " << package.sha256 << '\n';
+        }
+        first = false;
+    }
+    if(format == Format::JSON) { out << "]\n"; }
+    out.flush();
+    return num_notfound;
+}
+
+int RepositoryQueryEngine::ReverseDependencies(const std::vector<std::string>& packages) {
+    int num_notfound = 0;
+    bool first = true;
+    if(format == Format::JSON) { out << "{"; }
+    for(const std::string& name : packages) {
+        size_t i = index.find(name);
+        if(i == RepositoryQueryIndex::npos) {
+            NotFound(name);
+            num_notfound++;
+            continue;
+        }
+        if(format == Format::JSON) { out << (first ? "" : ", ") << QueryEngine::jsonString(name) << ": ["; }
+        const size_t count = index.reverseDependencyCount(i);
+        for(size_t r = 0; r < count; r++) {
+            std::string_view dependent = index.package(index.reverseDependency(i, r)).name;
+            if(format == Format::JSON) {
+                out << (r ? ", " : "") << json(dependent);
+            } else {
+                out << name << (format == Format::TSV ? '\t' : ' ') << dependent << '\n';
+            }
+        }
+        if(format == Format::JSON) { out << "]"; }
+        first = false;
+    }
+    if(format == Format::JSON) { out << "}\n"; }
+    out.flush();
+    return num_notfound;
+}
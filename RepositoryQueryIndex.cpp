@@ -0,0 +1,243 @@
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <RepositoryQueryIndex.h>
+
+namespace fs = std::filesystem;
+
+static const char query_magic[8] = {'B', 'V', 'P', 'M', 'R', 'Q', '1', '\0'};
+
+struct RepositoryQueryIndex::Header {
+    char magic[8];
+    /// Which repo.index this file was made from
+    uint64_t index_size;
+    int64_t index_mtime;
+    uint64_t index_inode;
+    uint32_t package_count;
+    uint32_t dependency_count;
+    uint32_t reverse_dependency_count;
+    uint32_t strings_size;
+};
+
+struct RepositoryQueryIndex::StringRef {
+    uint32_t offset;
+    uint32_t length;
+};
+
+struct RepositoryQueryIndex::Record {
+    StringRef name;
+    StringRef version;
+    StringRef filename;
+    StringRef sha256;
+    uint64_t installed_size;
+    uint64_t file_size;
+    uint32_t first_dependency;
+    uint32_t dependency_count;
+    uint32_t first_reverse_dependency;
+    uint32_t reverse_dependency_count;
+};
+
+static bool stampOf(const std::string& index_file, uint64_t& size, int64_t& mtime, uint64_t& inode) {
+    struct stat st{};
+    if(stat(index_file.c_str(), &st) != 0) { return false; }
+    size = st.st_size;
+    mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    inode = st.st_ino;
+    return true;
+}
+
+bool RepositoryQueryIndex::write(const RepositoryIndex& index, const std::string& index_file, const std::string& file) {
+    Header header{};
+    memcpy(header.magic, query_magic, sizeof(query_magic));
+    if(!stampOf(index_file, header.index_size, header.index_mtime, header.index_inode)) { return false; }
+
+    std::string string_data;
+    auto addString = [&string_data](const std::string& value) {
+        StringRef ref{(uint32_t)string_data.size(), (uint32_t)value.size()};
+        string_data += value;
+        return ref;
+    };
+
+    // The index is a std::map, so the packages already come sorted by name
+    std::unordered_map<std::string, uint32_t> numbers;
+    std::vector<const RepositoryIndexEntry*> entries;
+    entries.reserve(index.packages.size());
+    for(const auto& package : index.packages) {
+        numbers.emplace(package.first, (uint32_t)entries.size());
+        entries.push_back(&package.second);
+    }
+    std::vector<std::vector<uint32_t>> reverse(entries.size());
+    for(uint32_t i = 0; i < entries.size(); i++) {
+        for(const std::string& dependency : entries[i]->dependencies) {
+            auto it = numbers.find(dependency);
+            // A package listing the same dependency twice is still only one reverse dependency
+            if(it != numbers.end() && (reverse[it->second].empty() || reverse[it->second].back() != i)) { reverse[it->second].push_back(i); }
+        }
+    }
+
+    std::vector<Record> records;
+    std::vector<StringRef> dependencies;
+    std::vector<uint32_t> reverse_dependencies;
+    records.reserve(entries.size());
+    for(uint32_t i = 0; i < entries.size(); i++) {
+        const RepositoryIndexEntry& entry = *entries[i];
+        Record record{};
+        record.name = addString(entry.name);
+        record.version = addString(entry.version);
+        record.filename = addString(entry.filename);
+        record.sha256 = addString(entry.sha256);
+        record.installed_size = entry.installed_size;
+        record.file_size = entry.file_size;
+        record.first_dependency = dependencies.size();
+        record.dependency_count = entry.dependencies.size();
+        for(const std::string& dependency : entry.dependencies) { dependencies.push_back(addString(dependency)); }
+        record.first_reverse_dependency = reverse_dependencies.size();
+        record.reverse_dependency_count = reverse[i].size();
+        reverse_dependencies.insert(reverse_dependencies.end(), reverse[i].begin(), reverse[i].end());
+        records.push_back(record);
+    }
+    // Offsets are 32 bit; an index with more than 4 GiB of names is not something we expect
+    if(string_data.size() > UINT32_MAX) { return false; }
+    header.package_count = records.size();
+    header.dependency_count = dependencies.size();
+    header.reverse_dependency_count = reverse_dependencies.size();
+    header.strings_size = string_data.size();
+
+    // Write to a temporary file first, so that readers never see a half-written file
+    std::string temp_file = file + ".new";
+    {
+        std::ofstream stream(temp_file, std::ios::binary | std::ios::trunc);
+        if(!stream.is_open()) { return false; }
+        stream.write((const char*)&header, sizeof(header));
+        stream.write((const char*)records.data(), records.size() * sizeof(Record));
+        stream.write((const char*)dependencies.data(), dependencies.size() * sizeof(StringRef));
+        stream.write((const char*)reverse_dependencies.data(), reverse_dependencies.size() * sizeof(uint32_t));
+        stream.write(string_data.data(), string_data.size());
+        if(!stream.good()) { return false; }
+    }
+    std::error_code ec;
+    fs::rename(temp_file, file, ec);
+    return !ec;
+}
+
+RepositoryQueryIndex::~RepositoryQueryIndex() {
+    if(data) { munmap((void*)data, data_size); }
+}
+
+bool RepositoryQueryIndex::open(const std::string& file, const std::string& index_file) {
+    if(data) { return false; }
+    int fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0) { return false; }
+    struct stat st{};
+    if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(Header)) {
+        close(fd);
+        return false;
+    }
+    void* mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(mapped == MAP_FAILED) { return false; }
+    data = (const char*)mapped;
+    data_size = st.st_size;
+
+    auto fail = [this]() {
+        munmap((void*)data, data_size);
+        data = nullptr;
+        data_size = 0;
+        return false;
+    };
+    Header header{};
+    memcpy(&header, data, sizeof(header));
+    uint64_t index_size;
+    int64_t index_mtime;
+    uint64_t index_inode;
+    if(memcmp(header.magic, query_magic, sizeof(query_magic)) != 0 || !stampOf(index_file, index_size, index_mtime, index_inode)
+       || header.index_size != index_size || header.index_mtime != index_mtime || header.index_inode != index_inode) {
+        return fail();
+    }
+    const uint64_t records_offset = sizeof(Header);
+    const uint64_t dependencies_offset = records_offset + (uint64_t)header.package_count * sizeof(Record);
+    const uint64_t reverse_offset = dependencies_offset + (uint64_t)header.dependency_count * sizeof(StringRef);
+    const uint64_t strings_offset = reverse_offset + (uint64_t)header.reverse_dependency_count * sizeof(uint32_t);
+    if(strings_offset + header.strings_size != data_size) { return fail(); }
+    package_count = header.package_count;
+    records = (const Record*)(data + records_offset);
+    dependencies = (const StringRef*)(data + dependencies_offset);
+    reverse_dependencies = (const uint32_t*)(data + reverse_offset);
+    strings = data + strings_offset;
+    strings_size = header.strings_size;
+
+    // Everything is checked once here, so that the accessors can trust the file
+    auto valid = [this](const StringRef& ref) { return (uint64_t)ref.offset + ref.length <= strings_size; };
+    for(size_t i = 0; i < package_count; i++) {
+        const Record& r = records[i];
+        if(!valid(r.name) || !valid(r.version) || !valid(r.filename) || !valid(r.sha256)
+           || (uint64_t)r.first_dependency + r.dependency_count > header.dependency_count
+           || (uint64_t)r.first_reverse_dependency + r.reverse_dependency_count > header.reverse_dependency_count) {
+            return fail();
+        }
+    }
+    for(size_t i = 0; i < header.dependency_count; i++) {
+        if(!valid(dependencies[i])) { return fail(); }
+    }
+    for(size_t i = 0; i < header.reverse_dependency_count; i++) {
+        if(reverse_dependencies[i] >= package_count) { return fail(); }
+    }
+    madvise(mapped, data_size, MADV_RANDOM);
+    return true;
+}
+
+std::string_view RepositoryQueryIndex::string(const StringRef& ref) const {
+    return {strings + ref.offset, ref.length};
+}
+
+const RepositoryQueryIndex::Record& RepositoryQueryIndex::record(size_t i) const {
+    return records[i];
+}
+
+RepositoryQueryIndex::Package RepositoryQueryIndex::package(size_t i) const {
+    const Record& r = record(i);
+    return {string(r.name), string(r.version), r.installed_size, r.file_size, string(r.filename), string(r.sha256)};
+}
+
+size_t RepositoryQueryIndex::find(std::string_view name) const {
+    size_t i = prefixRange(name).first;
+    return i < package_count && string(records[i].name) == name ? i : npos;
+}
+
+std::pair<size_t, size_t> RepositoryQueryIndex::prefixRange(std::string_view prefix) const {
+    // The names starting with prefix are the ones from the first name >= prefix on, for as long as they start with it
+    size_t low = 0, high = package_count;
+    while(low < high) {
+        size_t middle = low + (high - low) / 2;
+        if(string(records[middle].name) < prefix) { low = middle + 1; } else { high = middle; }
+    }
+    const size_t first = low;
+    high = package_count;
+    while(low < high) {
+        size_t middle = low + (high - low) / 2;
+        if(string(records[middle].name).substr(0, prefix.size()) == prefix) { low = middle + 1; } else { high = middle; }
+    }
+    return {first, low};
+}
+
+size_t RepositoryQueryIndex::dependencyCount(size_t i) const {
+    return record(i).dependency_count;
+}
+
+std::string_view RepositoryQueryIndex::dependency(size_t i, size_t n) const {
+    return string(dependencies[record(i).first_dependency + n]);
+}
+
+size_t RepositoryQueryIndex::reverseDependencyCount(size_t i) const {
+    return record(i).reverse_dependency_count;
+}
+
+size_t RepositoryQueryIndex::reverseDependency(size_t i, size_t n) const {
+    return reverse_dependencies[record(i).first_reverse_dependency + n];
+}
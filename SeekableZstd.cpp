@@ -0,0 +1,204 @@
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <zstd.h>
+#include <SeekableZstd.h>
+
+static constexpr uint32_t skippable_magic = 0x184D2A5E;
+static constexpr uint32_t seekable_magic = 0x8F92EAB1;
+static constexpr size_t footer_size = 9;
+static constexpr uint8_t checksum_flag = 0x80;
+static constexpr uint8_t reserved_bits = 0x7c;
+
+static uint32_t readLE32(const char* p) {
+    auto* u = (const unsigned char*)p;
+    return (uint32_t)u[0] | (uint32_t)u[1] << 8 | (uint32_t)u[2] << 16 | (uint32_t)u[3] << 24;
+}
+
+static void appendLE32(std::string& out, uint32_t value) {
+    for(int i = 0; i < 4; i++) { out += (char)(value >> (i * 8) & 0xff); }
+}
+
+bool SeekTable::parse(const char* data, size_t size) {
+    frames.clear();
+    decompressed_size = 0;
+    if(size < 8 + footer_size) { return false; }
+    const char* footer = data + size - footer_size;
+    const uint64_t frame_count = readLE32(footer);
+    const uint8_t descriptor = footer[4];
+    if(readLE32(footer + 5) != seekable_magic || (descriptor & reserved_bits)) { return false; }
+    const uint64_t entry_size = descriptor & checksum_flag ? 12 : 8;
+    const uint64_t table_size = frame_count * entry_size + footer_size;
+    if(8 + table_size > size) { return false; }
+    const char* table = data + size - table_size - 8;
+    if(readLE32(table) != skippable_magic || readLE32(table + 4) != table_size) { return false; }
+
+    // The frames have to fill everything in front of the table exactly
+    const uint64_t frames_end = table - data;
+    uint64_t compressed_offset = 0;
+    frames.reserve(frame_count);
+    for(uint64_t i = 0; i < frame_count; i++) {
+        const char* entry = table + 8 + i * entry_size;
+        Frame frame{compressed_offset, readLE32(entry), decompressed_size, readLE32(entry + 4)};
+        compressed_offset += frame.compressed_size;
+        decompressed_size += frame.decompressed_size;
+        if(compressed_offset > frames_end) { break; }
+        frames.push_back(frame);
+    }
+    if(frames.size() != frame_count || compressed_offset != frames_end) {
+        frames.clear();
+        decompressed_size = 0;
+        return false;
+    }
+    return true;
+}
+
+ParallelZstdReader::ParallelZstdReader(const char* _data, SeekTable _table, unsigned threads)
+    : data(_data), table(std::move(_table)), slots(table.frames.size()) {
+    threads = std::min<size_t>(threads, table.frames.size());
+    // Two frames per worker keep every worker busy while the reader works through the oldest one
+    window = std::max(threads, 1u) * 2;
+    if(threads <= 1) { return; }
+    for(unsigned i = 0; i < threads; i++) { workers.emplace_back(&ParallelZstdReader::work, this); }
+}
+
+ParallelZstdReader::~ParallelZstdReader() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    work_available.notify_all();
+    for(std::thread& worker : workers) { worker.join(); }
+}
+
+bool ParallelZstdReader::decompress(size_t frame, std::vector<char>& out) {
+    static thread_local std::unique_ptr<ZSTD_DCtx, size_t(*)(ZSTD_DCtx*)> context(ZSTD_createDCtx(), ZSTD_freeDCtx);
+    const SeekTable::Frame& f = table.frames[frame];
+    out.resize(f.decompressed_size);
+    size_t result = ZSTD_decompressDCtx(context.get(), out.data(), out.size(), data + f.compressed_offset, f.compressed_size);
+    return !ZSTD_isError(result) && result == f.decompressed_size;
+}
+
+void ParallelZstdReader::work() {
+    for(;;) {
+        size_t frame;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            work_available.wait(lock, [this]() {
+                // Frames the reader has skipped past are not worth decompressing anymore
+                next_to_start = std::max(next_to_start, next_frame);
+                return stop || (next_to_start < slots.size() && next_to_start < next_frame + window);
+            });
+            if(stop) { return; }
+            frame = next_to_start++;
+        }
+        std::vector<char> out;
+        bool ok = decompress(frame, out);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if(frame >= next_frame) {
+                slots[frame].data = std::move(out);
+                slots[frame].failed = !ok;
+            }
+            slots[frame].done = true;
+        }
+        frame_done.notify_all();
+    }
+}
+
+int64_t ParallelZstdReader::read(const char** block) {
+    std::unique_lock<std::mutex> lock(mutex);
+    if(held_frame != SIZE_MAX) {
+        std::vector<char>().swap(slots[held_frame].data);
+        held_frame = SIZE_MAX;
+    }
+    // Empty frames are passed over; returning an empty block would end the stream
+    while(next_frame < slots.size()) {
+        const size_t frame = next_frame;
+        Slot& slot = slots[frame];
+        if(workers.empty()) {
+            slot.failed = !decompress(frame, slot.data);
+            slot.done = true;
+        } else {
+            frame_done.wait(lock, [&slot]() { return slot.done; });
+        }
+        if(slot.failed) { return -1; }
+        const uint64_t offset = next_offset;
+        next_frame++;
+        next_offset = 0;
+        work_available.notify_all();
+        if(offset >= slot.data.size()) {
+            std::vector<char>().swap(slot.data);
+            continue;
+        }
+        held_frame = frame;
+        *block = slot.data.data() + offset;
+        return (int64_t)(slot.data.size() - offset);
+    }
+    return 0;
+}
+
+uint64_t ParallelZstdReader::skip(uint64_t request) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if(held_frame != SIZE_MAX) {
+        std::vector<char>().swap(slots[held_frame].data);
+        held_frame = SIZE_MAX;
+    }
+    const std::vector<SeekTable::Frame>& frames = table.frames;
+    const uint64_t position = next_frame < frames.size() ? frames[next_frame].decompressed_offset + next_offset : table.decompressed_size;
+    const uint64_t target = std::min(position + request, table.decompressed_size);
+    while(next_frame < frames.size() && frames[next_frame].decompressed_offset + frames[next_frame].decompressed_size <= target) {
+        std::vector<char>().swap(slots[next_frame].data);
+        next_frame++;
+    }
+    next_offset = next_frame < frames.size() ? target - frames[next_frame].decompressed_offset : 0;
+    work_available.notify_all();
+    return target - position;
+}
+
+bool SeekableZstd::compressFile(const std::string& input, const std::string& output, size_t frame_size, int level) {
+    std::ifstream in(input, std::ios::binary);
+    std::ofstream out(output, std::ios::binary | std::ios::trunc);
+    if(!in.is_open() || !out.is_open()) {
+        std::cerr << "error compressing " << input << " into " << output << ": could not open the files" << std::endl;
+        return false;
+    }
+    std::unique_ptr<ZSTD_CCtx, size_t(*)(ZSTD_CCtx*)> context(ZSTD_createCCtx(), ZSTD_freeCCtx);
+    ZSTD_CCtx_setParameter(context.get(), ZSTD_c_compressionLevel, level);
+    ZSTD_CCtx_setParameter(context.get(), ZSTD_c_checksumFlag, 1);
+
+    std::vector<char> buffer(frame_size);
+    std::vector<char> compressed(ZSTD_compressBound(frame_size));
+    std::string table;
+    uint32_t frame_count = 0;
+    for(;;) {
+        in.read(buffer.data(), buffer.size());
+        size_t read = in.gcount();
+        if(read == 0) { break; }
+        size_t size = ZSTD_compress2(context.get(), compressed.data(), compressed.size(), buffer.data(), read);
+        if(ZSTD_isError(size)) {
+            std::cerr << "error compressing " << input << ": " << ZSTD_getErrorName(size) << std::endl;
+            return false;
+        }
+        out.write(compressed.data(), size);
+        appendLE32(table, size);
+        appendLE32(table, read);
+        frame_count++;
+    }
+
+    // The seek table is a skippable frame, so that plain zstd decoders read past it
+    std::string seek_table;
+    appendLE32(seek_table, skippable_magic);
+    appendLE32(seek_table, table.size() + footer_size);
+    seek_table += table;
+    appendLE32(seek_table, frame_count);
+    seek_table += (char)0;
+    appendLE32(seek_table, seekable_magic);
+    out.write(seek_table.data(), seek_table.size());
+    out.close();
+    if(!out) {
+        std::cerr << "error writing " << output << std::endl;
+        return false;
+    }
+    return true;
+}
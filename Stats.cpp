@@ -0,0 +1,141 @@
+#include <Stats.h>
+#include <human-readable.h>
+#include <cstdlib>
+#include <cstddef>
+#include <iomanip>
+#include <new>
+#include <sys/resource.h>
+
+std::atomic<uint64_t> Stats::counters[Stats::CounterCount];
+
+static std::atomic<uint64_t> allocation_count;
+static std::atomic<uint64_t> allocated_bytes;
+static std::atomic<uint64_t> free_count;
+
+static const struct {
+    const char* key;
+    const char* description;
+    bool bytes;
+} counter_names[Stats::CounterCount] = {
+    {"archives_opened", "archives opened", false},
+    {"archive_bytes_read", "archive bytes read", true},
+    {"archive_bytes_decompressed", "archive bytes decompressed", true},
+    {"stored_bytes_copied", "stored bytes copied", true},
+    {"files_created", "files created", false},
+    {"directories_created", "directories created", false},
+    {"stat_calls", "stat calls", false},
+    {"unlink_calls", "unlink calls", false},
+    {"manifests_parsed", "manifests parsed", false},
+    {"repository_lookups", "repository lookups", false},
+    {"dependency_checks", "dependency checks", false},
+    {"files_hashed", "files hashed", false},
+    {"verify_cache_hits", "verify cache hits", false},
+    {"buffers_allocated", "buffers allocated", false},
+    {"triggers_run", "triggers run", false},
+};
+
+uint64_t Stats::allocationCount() { return allocation_count.load(std::memory_order_relaxed); }
+uint64_t Stats::allocatedBytes() { return allocated_bytes.load(std::memory_order_relaxed); }
+uint64_t Stats::liveAllocations() {
+    // Frees are read first, so a free racing with this can not make the count go below zero
+    const uint64_t freed = free_count.load(std::memory_order_relaxed);
+    return allocation_count.load(std::memory_order_relaxed) - freed;
+}
+
+uint64_t Stats::peakRSS() {
+    struct rusage usage{};
+    if(getrusage(RUSAGE_SELF, &usage) != 0) { return 0; }
+    // ru_maxrss is in kilobytes on Linux
+    return (uint64_t)usage.ru_maxrss * 1024;
+}
+
+void Stats::printTable(std::ostream& out) {
+    out << "Execution statistics:" << std::endl;
+    for(int i = 0; i < CounterCount; i++) {
+        out << "\t" << std::left << std::setw(30) << counter_names[i].description;
+        if(counter_names[i].bytes) {
+            out << humanSize(get((Counter)i)) << " (" << get((Counter)i) << ")";
+        } else {
+            out << get((Counter)i);
+        }
+        out << std::endl;
+    }
+    out << "\t" << std::left << std::setw(30) << "allocations" << allocationCount() << std::endl;
+    out << "\t" << std::left << std::setw(30) << "allocated bytes" << humanSize(allocatedBytes()) << " (" << allocatedBytes() << ")" << std::endl;
+    out << "\t" << std::left << std::setw(30) << "peak rss" << humanSize(peakRSS()) << " (" << peakRSS() << ")" << std::endl;
+}
+
+void Stats::printJSON(std::ostream& out) {
+    out << "{";
+    for(int i = 0; i < CounterCount; i++) {
+        out << "\"" << counter_names[i].key << "\": " << get((Counter)i) << ", ";
+    }
+    out << "\"allocations\": " << allocationCount() << ", \"allocated_bytes\": " << allocatedBytes()
+        << ", \"peak_rss_bytes\": " << peakRSS() << "}" << std::endl;
+}
+
+// Count every allocation made through operator new, in all its forms, so that none goes by uncounted. Allocations
+// libarchive makes with malloc are not included.
+static void* allocate(std::size_t size, std::size_t alignment) {
+    const std::size_t requested = size;
+    if(size == 0) { size = 1; }
+    // Like the default operator new, the new handler gets to free memory until it gives up
+    while(true) {
+        void* ptr = nullptr;
+        if(alignment <= alignof(std::max_align_t)) {
+            ptr = std::malloc(size);
+        } else if(posix_memalign(&ptr, alignment, size) != 0) {
+            ptr = nullptr;
+        }
+        if(ptr) {
+            // Only allocations that happened count, so that every one is matched by a delete
+            allocation_count.fetch_add(1, std::memory_order_relaxed);
+            allocated_bytes.fetch_add(requested, std::memory_order_relaxed);
+            return ptr;
+        }
+        std::new_handler handler = std::get_new_handler();
+        if(!handler) { throw std::bad_alloc(); }
+        handler();
+    }
+}
+
+static void* allocateNoThrow(std::size_t size, std::size_t alignment) noexcept {
+    try {
+        return allocate(size, alignment);
+    } catch(...) {
+        return nullptr;
+    }
+}
+
+void* operator new(std::size_t size) { return allocate(size, 0); }
+void* operator new[](std::size_t size) { return allocate(size, 0); }
+void* operator new(std::size_t size, std::align_val_t alignment) { return allocate(size, (std::size_t)alignment); }
+void* operator new[](std::size_t size, std::align_val_t alignment) { return allocate(size, (std::size_t)alignment); }
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept { return allocateNoThrow(size, 0); }
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept { return allocateNoThrow(size, 0); }
+void* operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return allocateNoThrow(size, (std::size_t)alignment);
+}
+void* operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return allocateNoThrow(size, (std::size_t)alignment);
+}
+
+// malloc and posix_memalign memory are both given back with free. Deleting nullptr frees nothing, and is not counted.
+static void deallocate(void* ptr) noexcept {
+    if(!ptr) { return; }
+    free_count.fetch_add(1, std::memory_order_relaxed);
+    std::free(ptr);
+}
+
+void operator delete(void* ptr) noexcept { deallocate(ptr); }
+void operator delete[](void* ptr) noexcept { deallocate(ptr); }
+void operator delete(void* ptr, std::size_t) noexcept { deallocate(ptr); }
+void operator delete[](void* ptr, std::size_t) noexcept { deallocate(ptr); }
+void operator delete(void* ptr, std::align_val_t) noexcept { deallocate(ptr); }
+void operator delete[](void* ptr, std::align_val_t) noexcept { deallocate(ptr); }
+void operator delete(void* ptr, std::size_t, std::align_val_t) noexcept { deallocate(ptr); }
+void operator delete[](void* ptr, std::size_t, std::align_val_t) noexcept { deallocate(ptr); }
+void operator delete(void* ptr, const std::nothrow_t&) noexcept { deallocate(ptr); }
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept { deallocate(ptr); }
+void operator delete(void* ptr, std::align_val_t, const std::nothrow_t&) noexcept { deallocate(ptr); }
+void operator delete[](void* ptr, std::align_val_t, const std::nothrow_t&) noexcept { deallocate(ptr); }
@@ -0,0 +1,202 @@
+#include <iostream>
+#include <sstream>
+#include <fstream>
+#include <filesystem>
+#include <algorithm>
+#include <fnmatch.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <Triggers.h>
+#include <Stats.h>
+#include <debug.h>
+
+namespace fs = std::filesystem;
+
+static const std::string trigger_prefix = "TRIGGER_";
+static const char* index_header = "BVPM-TRIGGERS 1";
+
+namespace {
+/// A TRIGGER_ entry of a package manifest, as the trigger index keeps it
+struct Declaration {
+    std::string package;
+    std::string name;
+    /// <patterns>:<command>
+    std::string value;
+};
+}
+
+/// The triggers of the installed packages of a root, so that a transaction does not have to read every installed
+/// manifest to find them. A line per TRIGGER_ entry: the package, the trigger name and the entry's value, separated
+/// by tabs, after a "BVPM-TRIGGERS 1" line.
+static std::string indexPath(const std::string& root) {
+    return root + "/var/lib/bvpm/triggers";
+}
+
+static void addDeclarations(const ConfigFile& manifest, std::vector<Declaration>& declarations) {
+    auto package = manifest.values.find("PACKAGE");
+    const std::string package_name = package != manifest.values.end() ? package->second : "";
+    for(auto entry = manifest.values.lower_bound(trigger_prefix); entry != manifest.values.end(); ++entry) {
+        if(entry->first.compare(0, trigger_prefix.size(), trigger_prefix) != 0) { break; }
+        declarations.push_back({package_name, entry->first.substr(trigger_prefix.size()), entry->second});
+    }
+}
+
+/// \return If false, the root has no valid trigger index.
+static bool readIndex(const std::string& root, std::vector<Declaration>& declarations) {
+    std::ifstream stream(indexPath(root));
+    std::string line;
+    if(!stream.is_open() || !std::getline(stream, line) || line != index_header) { return false; }
+    while(std::getline(stream, line)) {
+        size_t first = line.find('\t');
+        size_t second = first == std::string::npos ? first : line.find('\t', first + 1);
+        if(second == std::string::npos) { return false; }
+        declarations.push_back({line.substr(0, first), line.substr(first + 1, second - first - 1), line.substr(second + 1)});
+    }
+    Stats::add(Stats::ManifestsParsed);
+    return true;
+}
+
+/// Find the triggers in every installed manifest, for roots installed before the trigger index existed.
+static std::vector<Declaration> scanInstalled(const std::string& root) {
+    std::vector<Declaration> declarations;
+    std::error_code ec;
+    for(fs::directory_iterator it(root + "/etc/bvpm/packages", ec), end; !ec && it != end; it.increment(ec)) {
+        ConfigFile manifest = Config::readConfigFile(it->path().string() + "/manifest");
+        if(manifest.values.find("failed") != manifest.values.end()) { continue; }
+        Stats::add(Stats::ManifestsParsed);
+        addDeclarations(manifest, declarations);
+    }
+    return declarations;
+}
+
+static bool writeIndex(const std::string& root, const std::vector<Declaration>& declarations) {
+    const std::string file = indexPath(root);
+    const std::string temp_file = file + ".new";
+    std::error_code ec;
+    fs::create_directories(fs::path(file).parent_path(), ec);
+    {
+        std::ofstream stream(temp_file, std::ios::trunc);
+        if(!stream.is_open()) { return false; }
+        stream << index_header << "\n";
+        for(const Declaration& declaration : declarations) {
+            stream << declaration.package << "\t" << declaration.name << "\t" << declaration.value << "\n";
+        }
+        if(!stream.good()) { return false; }
+    }
+    fs::rename(temp_file, file, ec);
+    return !ec;
+}
+
+void TriggerSet::updateInstalled(const std::string& root, const std::vector<const ConfigFile*>& installed, const std::set<std::string>& removed) {
+    std::vector<Declaration> declarations;
+    if(!readIndex(root, declarations)) {
+        declarations = scanInstalled(root);
+    }
+    std::vector<Declaration> added;
+    std::set<std::string> replaced = removed;
+    for(const ConfigFile* manifest : installed) {
+        auto package = manifest->values.find("PACKAGE");
+        if(package != manifest->values.end()) { replaced.insert(package->second); }
+        addDeclarations(*manifest, added);
+    }
+    declarations.erase(std::remove_if(declarations.begin(), declarations.end(),
+                                      [&](const Declaration& declaration) { return replaced.count(declaration.package) != 0; }),
+                       declarations.end());
+    declarations.insert(declarations.end(), added.begin(), added.end());
+    if(!writeIndex(root, declarations)) {
+        std::cout << "warning: could not write the trigger index " << indexPath(root) << std::endl;
+    }
+}
+
+void TriggerSet::addManifest(const ConfigFile& manifest) {
+    std::vector<Declaration> declarations;
+    addDeclarations(manifest, declarations);
+    for(const Declaration& declaration : declarations) { addTrigger(declaration.package, declaration.name, declaration.value); }
+}
+
+void TriggerSet::addTrigger(const std::string& package_name, const std::string& name, const std::string& value) {
+    size_t colon = value.find(':');
+    if(name.empty() || colon == std::string::npos || colon + 1 == value.size()) {
+        std::cout << "package " << package_name << " has an invalid trigger \"" << trigger_prefix << name << "\"; ignoring it" << std::endl;
+        return;
+    }
+    const std::string command = value.substr(colon + 1);
+    Trigger* trigger = nullptr;
+    for(Trigger& existing : triggers) {
+        if(existing.name == name && existing.command == command) { trigger = &existing; }
+    }
+    if(!trigger) {
+        triggers.emplace_back();
+        trigger = &triggers.back();
+        trigger->name = name;
+        trigger->command = command;
+    }
+    // Several packages declaring the same trigger may each name the paths they care about
+    std::istringstream patterns(value.substr(0, colon));
+    std::string pattern;
+    while(std::getline(patterns, pattern, ',')) {
+        if(pattern.empty()) { continue; }
+        if(pattern[0] != '/') { pattern = "/" + pattern; }
+        bool known = false;
+        for(const std::string& existing : trigger->patterns) { known = known || existing == pattern; }
+        if(!known) { trigger->patterns.push_back(pattern); }
+    }
+}
+
+void TriggerSet::addInstalled(const std::string& root, const std::set<std::string>& skip) {
+    std::vector<Declaration> declarations;
+    if(!readIndex(root, declarations)) {
+        // Written once, so that later transactions on this root read the index instead
+        declarations = scanInstalled(root);
+        writeIndex(root, declarations);
+    }
+    for(const Declaration& declaration : declarations) {
+        if(skip.count(declaration.package)) { continue; }
+        addTrigger(declaration.package, declaration.name, declaration.value);
+    }
+}
+
+void TriggerSet::match(const std::string& path) {
+    if(matched == triggers.size()) { return; }
+    const std::string absolute = !path.empty() && path[0] == '/' ? path : "/" + path;
+    for(Trigger& trigger : triggers) {
+        if(trigger.matched) { continue; }
+        for(const std::string& pattern : trigger.patterns) {
+            if(fnmatch(pattern.c_str(), absolute.c_str(), 0) == 0) {
+                PRINT_DEBUG("trigger " << trigger.name << " matched by " << absolute << std::endl);
+                trigger.matched = true;
+                matched++;
+                break;
+            }
+        }
+    }
+}
+
+void TriggerSet::run(const std::string& root) {
+    for(Trigger& trigger : triggers) {
+        if(!trigger.matched) { continue; }
+        std::cout << "Running trigger " << trigger.name << std::endl;
+        std::cout.flush();
+        Stats::add(Stats::TriggersRun);
+        // Generic fork/exec/wait, like the after install scripts
+        pid_t pid = fork();
+        if(pid == 0) {
+            if(root != "/" && chroot(root.c_str())) {
+                perror("failed to chroot to fakeroot");
+                _exit(-1);
+            }
+            chdir("/");
+            execl("/bin/sh", "sh", "-c", trigger.command.c_str(), (char*)nullptr);
+            perror(("couldnt execute trigger " + trigger.name).c_str());
+            _exit(-1);
+        }
+        int status = 0;
+        if(pid < 0 || waitpid(pid, &status, 0) < 0) {
+            perror(("couldnt run trigger " + trigger.name).c_str());
+        } else if(!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            std::cout << "trigger " << trigger.name << " failed" << std::endl;
+        }
+        trigger.matched = false;
+    }
+    matched = 0;
+}
@@ -6,6 +6,9 @@
 #include <UninstallEngine.h>
 #include <human-readable.h>
 #include <debug.h>
+#include <Stats.h>
+#include <Triggers.h>
+#include <OwnerIndex.h>
 #include <filesystem>
 
 namespace fs = std::filesystem;
@@ -65,6 +68,11 @@ bool UninstallEngine::GetUserPermission() {
 }
 
 bool UninstallEngine::Execute() {
+    // The triggers of the packages that stay installed; those being removed take their commands with them
+    std::set<std::string> removed;
+    for(const auto& package : uninstall_list) { removed.insert(package.first); }
+    TriggerSet triggers;
+    triggers.addInstalled(install_root, removed);
     for(std::pair<std::string, std::vector<std::string>> package : uninstall_list) {
         const std::string& name = package.first;
         std::cout << "Operating on " << name;
@@ -73,18 +81,22 @@ bool UninstallEngine::Execute() {
         for(std::string file : package.second) {
             std::cout << "\33[2K\rOperating on " << name << ": " << ++count << "/" << file_count << '\r';
             try {
-                fs::remove(install_root + file);
+                if(fs::remove(install_root + file)) { Stats::add(Stats::UnlinkCalls); }
+                triggers.match(file);
             } catch(fs::filesystem_error& e) {
                 std::cout << "Failed to remove file " << install_root + file << ": " << e.what() << std::endl;
             }
         }
         // Remove the package folder
         try {
-            fs::remove_all(fs::path(install_root + "/etc/bvpm/packages/" + name));
+            Stats::add(Stats::UnlinkCalls, fs::remove_all(fs::path(install_root + "/etc/bvpm/packages/" + name)));
         } catch(fs::filesystem_error& e) {
             std::cout << "Failed to remove package folder " << install_root + "/etc/bvpm/packages/" + name << ": " << e.what() << std::endl;
         }
         std::cout << "\33[2K\rDone operating on " << name << std::endl;
     }
+    TriggerSet::updateInstalled(install_root, {}, removed);
+    OwnerIndex::updateInstalled(install_root, {}, removed);
+    triggers.run(install_root);
     return true;
 }
\ No newline at end of file
@@ -0,0 +1,384 @@
+#include <iostream>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <UringDiskWriter.h>
+
+namespace fs = std::filesystem;
+
+static constexpr unsigned ring_entries = 256;
+/// Files in flight at once, and so the number of fixed file slots
+static constexpr unsigned max_chains = 32;
+/// Longest chain: open, fallocate, write, close, rename
+static constexpr unsigned max_chain_length = 5;
+/// Submit once this many SQEs are queued, so that the kernel has work while the next files are decompressed
+static constexpr unsigned submit_batch = 64;
+static constexpr size_t max_buffered_size = 16 * 1024 * 1024;
+static constexpr size_t max_bytes_in_flight = 64 * 1024 * 1024;
+static constexpr size_t fallocate_min_size = 1024 * 1024;
+static constexpr size_t max_directories = 512;
+
+static int ioUringSetup(unsigned entries, struct io_uring_params* params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int ioUringEnter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0);
+}
+
+static int ioUringRegister(int fd, unsigned opcode, void* arg, unsigned nr_args) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static uint64_t userData(size_t slot, uint8_t op) {
+    return (uint64_t)slot << 8 | op;
+}
+
+UringDiskWriter::UringDiskWriter() {
+    if(!setup()) { teardown(); }
+}
+
+UringDiskWriter::~UringDiskWriter() {
+    drain();
+    for(auto& directory : directories) { close(directory.second); }
+    teardown();
+}
+
+bool UringDiskWriter::setup() {
+    struct io_uring_params params{};
+    ring_fd = ioUringSetup(ring_entries, &params);
+    if(ring_fd < 0) { return false; }
+    // Direct descriptors (opening into and closing fixed file slots) came in 5.15; CQE_SKIP in 5.17 is the
+    // closest feature flag that proves they are there
+    if(!(params.features & IORING_FEAT_CQE_SKIP)) { return false; }
+
+    // Seccomp filters and older kernels can leave out single operations, so check every one that is used
+    const unsigned probe_ops = 256;
+    std::vector<char> probe_buffer(sizeof(struct io_uring_probe) + probe_ops * sizeof(struct io_uring_probe_op), 0);
+    auto* probe = (struct io_uring_probe*)probe_buffer.data();
+    if(ioUringRegister(ring_fd, IORING_REGISTER_PROBE, probe, probe_ops) < 0) { return false; }
+    for(uint8_t op : {IORING_OP_OPENAT, IORING_OP_FALLOCATE, IORING_OP_WRITE, IORING_OP_CLOSE, IORING_OP_RENAMEAT}) {
+        if(op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) { return false; }
+    }
+
+    // The fixed file table starts out empty; every open puts its file into the slot of its chain
+    std::vector<int> slots(max_chains, -1);
+    if(ioUringRegister(ring_fd, IORING_REGISTER_FILES, slots.data(), max_chains) < 0) { return false; }
+
+    sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if(params.features & IORING_FEAT_SINGLE_MMAP) { sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size); }
+    sq_ring = mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+    if(sq_ring == MAP_FAILED) {
+        sq_ring = nullptr;
+        return false;
+    }
+    if(params.features & IORING_FEAT_SINGLE_MMAP) {
+        cq_ring = sq_ring;
+    } else {
+        cq_ring = mmap(nullptr, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+        if(cq_ring == MAP_FAILED) {
+            cq_ring = nullptr;
+            return false;
+        }
+    }
+    sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    void* sqes_map = mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+    if(sqes_map == MAP_FAILED) { return false; }
+    sqes = (struct io_uring_sqe*)sqes_map;
+
+    char* sq = (char*)sq_ring;
+    sq_head = (unsigned*)(sq + params.sq_off.head);
+    sq_tail = (unsigned*)(sq + params.sq_off.tail);
+    sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+    sq_array = (unsigned*)(sq + params.sq_off.array);
+    char* cq = (char*)cq_ring;
+    cq_head = (unsigned*)(cq + params.cq_off.head);
+    cq_tail = (unsigned*)(cq + params.cq_off.tail);
+    cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+    cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+    sq_entries = params.sq_entries;
+    // SQEs are used in ring order, so the indirection array never changes
+    for(unsigned i = 0; i < sq_entries; i++) { sq_array[i] = i; }
+
+    chains.resize(max_chains);
+    return true;
+}
+
+void UringDiskWriter::teardown() {
+    if(sqes) { munmap(sqes, sqes_size); }
+    if(cq_ring && cq_ring != sq_ring) { munmap(cq_ring, cq_ring_size); }
+    if(sq_ring) { munmap(sq_ring, sq_ring_size); }
+    sqes = nullptr;
+    cq_ring = sq_ring = nullptr;
+    if(ring_fd >= 0) { close(ring_fd); }
+    ring_fd = -1;
+}
+
+struct io_uring_sqe* UringDiskWriter::getSqe() {
+    unsigned tail = *sq_tail;
+    struct io_uring_sqe* sqe = &sqes[tail & *sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    // The kernel only looks at the ring during io_uring_enter(), so the tail can move before the SQE is filled in
+    __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+    queued++;
+    return sqe;
+}
+
+bool UringDiskWriter::submit(unsigned min_complete) {
+    for(;;) {
+        int ret = ioUringEnter(ring_fd, queued, min_complete, min_complete ? IORING_ENTER_GETEVENTS : 0);
+        if(ret >= 0) {
+            queued -= std::min<unsigned>(ret, queued);
+            break;
+        }
+        if(errno == EINTR) { continue; }
+        std::cerr << "error submitting to io_uring: " << strerror(errno) << std::endl;
+        return false;
+    }
+    reap();
+    return true;
+}
+
+void UringDiskWriter::reap() {
+    unsigned head = *cq_head;
+    unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+    for(; head != tail; head++) {
+        const struct io_uring_cqe& cqe = cqes[head & *cq_mask];
+        Chain& chain = chains[cqe.user_data >> 8];
+        uint8_t op = cqe.user_data & 0xff;
+        // Preallocating is only an optimization; filesystems without fallocate still get the file
+        if(op != IORING_OP_FALLOCATE && chain.error == 0) {
+            if(cqe.res < 0) { chain.error = -cqe.res; }
+            else if(op == IORING_OP_WRITE && (size_t)cqe.res != chain.size) { chain.error = EIO; }
+        }
+        if(--chain.pending == 0) { complete(chain); }
+    }
+    __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+}
+
+void UringDiskWriter::complete(Chain& chain) {
+    if(chain.error) {
+        std::cerr << "error writing " << chain.path << ": " << strerror(chain.error) << std::endl;
+        // Whatever step failed, the temporary file must not stay behind
+        unlinkat(chain.dirfd, chain.temporary.c_str(), 0);
+        failed = true;
+    } else {
+        addMetadata(chain.dirfd, chain.base, chain.mode, chain.times);
+    }
+    bytes_in_flight -= chain.size;
+    chain.data.reset();
+    chain.in_use = false;
+    chains_in_use--;
+}
+
+void UringDiskWriter::drain() {
+    if(!available()) { return; }
+    while(queued > 0 || chains_in_use > 0) {
+        if(!submit(chains_in_use > 0 ? 1 : 0)) { break; }
+    }
+}
+
+void UringDiskWriter::addMetadata(int dirfd, const std::string& base, mode_t mode, const struct timespec times[2]) {
+    bool set_times = times[0].tv_nsec != UTIME_OMIT || times[1].tv_nsec != UTIME_OMIT;
+    // open() gave the file its mode minus the umask; only files the umask took something from need a chmod
+    if(!set_times && !(mode & umask_bits)) { return; }
+    metadata.push_back({dirfd, base, mode, {times[0], times[1]}});
+}
+
+void UringDiskWriter::applyMetadata() {
+    for(const Metadata& entry : metadata) {
+        if((entry.mode & umask_bits) && fchmodat(entry.dirfd, entry.base.c_str(), entry.mode, 0) != 0) {
+            std::cerr << "warning: could not set the permissions of " << entry.base << ": " << strerror(errno) << std::endl;
+        }
+        if((entry.times[0].tv_nsec != UTIME_OMIT || entry.times[1].tv_nsec != UTIME_OMIT)
+           && utimensat(entry.dirfd, entry.base.c_str(), entry.times, AT_SYMLINK_NOFOLLOW) != 0) {
+            std::cerr << "warning: could not set the times of " << entry.base << ": " << strerror(errno) << std::endl;
+        }
+    }
+    metadata.clear();
+}
+
+int UringDiskWriter::directory(const std::string& path) {
+    auto it = directories.find(path);
+    if(it != directories.end()) { return it->second; }
+    if(directories.size() >= max_directories) {
+        // Chains and metadata refer to the cached fds, so everything has to be done before they can be closed
+        drain();
+        applyMetadata();
+        for(auto& directory : directories) { close(directory.second); }
+        directories.clear();
+    }
+    std::error_code ec;
+    fs::create_directories(path, ec);
+    int fd = open(path.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if(fd < 0) { return -1; }
+    directories.emplace(path, fd);
+    return fd;
+}
+
+bool UringDiskWriter::readData(struct archive* a, struct archive_entry* entry, char* data, size_t size) {
+    const void* buff;
+    size_t length;
+    la_int64_t offset;
+    size_t filled = 0;
+    for(;;) {
+        int r = archive_read_data_block(a, &buff, &length, &offset);
+        if(r == ARCHIVE_EOF) { break; }
+        if(r < ARCHIVE_OK || offset < (la_int64_t)filled || (size_t)offset + length > size) { return false; }
+        // Holes of sparse files are not in the archive
+        memset(data + filled, 0, offset - filled);
+        memcpy(data + offset, buff, length);
+        filled = offset + length;
+    }
+    memset(data + filled, 0, size - filled);
+    return true;
+}
+
+bool UringDiskWriter::writeEntry(struct archive* a, struct archive_entry* entry) {
+    const std::string path = archive_entry_pathname(entry);
+    std::string folder, base;
+    splitPath(path, folder, base);
+    if(!isPlainFile(entry, base)) {
+        // Links may point at files that are still in flight, so those have to be on the disk first
+        drain();
+        if(fallback.writeEntry(a, entry)) { return true; }
+        failed = true;
+        return false;
+    }
+    mode_t mode = entryMode(entry);
+    struct timespec times[2];
+    entryTimes(entry, times);
+
+    int dirfd = directory(folder);
+    if(dirfd < 0) {
+        std::cerr << "error writing " << path << ": could not create " << folder << ": " << strerror(errno) << std::endl;
+        failed = true;
+        return false;
+    }
+    std::string temporary = "." + base + ".bvpm" + std::to_string(temporary_counter++);
+    const size_t size = archive_entry_size(entry);
+
+    // Stored members are copied inside the kernel, and files too large to buffer are streamed; both directly
+    int64_t stored_offset = -1;
+    if(storedOffset(a, entry, stored_offset) || size > max_buffered_size) {
+        if(!writeDirect(a, entry, dirfd, base, temporary, mode, stored_offset, nullptr)) {
+            std::cerr << "error writing " << path << ": " << strerror(errno) << std::endl;
+            failed = true;
+            return false;
+        }
+        addMetadata(dirfd, base, mode, times);
+        return true;
+    }
+
+    // Wait for a free slot, and keep the memory of buffered files bounded
+    while(chains_in_use == chains.size() || (bytes_in_flight > 0 && bytes_in_flight + size > max_bytes_in_flight)) {
+        if(!submit(1)) {
+            failed = true;
+            return false;
+        }
+    }
+    // A chain must not be split over two submissions, or its link would be cut
+    unsigned head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+    if(sq_entries - (*sq_tail - head) < max_chain_length && !submit(0)) {
+        failed = true;
+        return false;
+    }
+
+    size_t slot = 0;
+    while(chains[slot].in_use) { slot++; }
+    Chain& chain = chains[slot];
+    chain.data.reset(new char[size ? size : 1]);
+    if(!readData(a, entry, chain.data.get(), size)) {
+        const char* error = archive_error_string(a);
+        std::cerr << "error reading " << path << ": " << (error ? error : "archive data does not match its size") << std::endl;
+        chain.data.reset();
+        failed = true;
+        return false;
+    }
+    chain.in_use = true;
+    chain.error = 0;
+    chain.dirfd = dirfd;
+    chain.base = std::move(base);
+    chain.temporary = std::move(temporary);
+    chain.path = path;
+    chain.size = size;
+    chain.mode = mode;
+    chain.times[0] = times[0];
+    chain.times[1] = times[1];
+    chains_in_use++;
+    bytes_in_flight += size;
+
+    // Writing to a temporary name and renaming it makes the replacement atomic, and works for running executables
+    struct io_uring_sqe* sqe = getSqe();
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->flags = IOSQE_IO_LINK;
+    sqe->fd = dirfd;
+    sqe->addr = (uint64_t)chain.temporary.c_str();
+    sqe->len = mode;
+    sqe->open_flags = O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW;
+    sqe->file_index = slot + 1;
+    sqe->user_data = userData(slot, IORING_OP_OPENAT);
+    chain.pending = 1;
+
+    if(size >= fallocate_min_size) {
+        sqe = getSqe();
+        sqe->opcode = IORING_OP_FALLOCATE;
+        // A hard link keeps the chain going if the filesystem can not fallocate
+        sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_HARDLINK;
+        sqe->fd = slot;
+        sqe->off = 0;
+        sqe->addr = size;
+        sqe->user_data = userData(slot, IORING_OP_FALLOCATE);
+        chain.pending++;
+    }
+    if(size > 0) {
+        sqe = getSqe();
+        sqe->opcode = IORING_OP_WRITE;
+        sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_LINK;
+        sqe->fd = slot;
+        sqe->addr = (uint64_t)chain.data.get();
+        sqe->len = size;
+        sqe->off = 0;
+        sqe->user_data = userData(slot, IORING_OP_WRITE);
+        chain.pending++;
+    }
+
+    sqe = getSqe();
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->flags = IOSQE_IO_LINK;
+    sqe->file_index = slot + 1;
+    sqe->user_data = userData(slot, IORING_OP_CLOSE);
+    chain.pending++;
+
+    sqe = getSqe();
+    sqe->opcode = IORING_OP_RENAMEAT;
+    sqe->fd = dirfd;
+    sqe->addr = (uint64_t)chain.temporary.c_str();
+    sqe->len = dirfd;
+    sqe->addr2 = (uint64_t)chain.base.c_str();
+    sqe->user_data = userData(slot, IORING_OP_RENAMEAT);
+    chain.pending++;
+
+    if(queued >= submit_batch && !submit(0)) {
+        failed = true;
+        return false;
+    }
+    return true;
+}
+
+bool UringDiskWriter::finish() {
+    drain();
+    bool ok = fallback.finish();
+    applyMetadata();
+    for(auto& directory : directories) { close(directory.second); }
+    directories.clear();
+    return ok && !failed;
+}
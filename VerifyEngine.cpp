@@ -0,0 +1,356 @@
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <unordered_set>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <VerifyEngine.h>
+#include <PathTable.h>
+#include <Hash.h>
+#include <Stats.h>
+
+namespace fs = std::filesystem;
+
+static const char* cache_header = "BVPM-VERIFY-CACHE 1";
+/// Smaller files are read; mapping them costs more than it saves
+static constexpr size_t mmap_min_size = 256 * 1024;
+
+using Format = QueryEngine::Format;
+
+VerifyEngine::VerifyEngine(std::string root, const ConfigFile& config, QueryEngine::Format _format, std::ostream& _out)
+    : install_root(std::move(root)), format(_format), out(_out) {
+    // The cache lives next to the downloaded packages, in CACHE_DIR relative to the install root
+    std::string cache_path = install_root + "/var/cache/bvpm";
+    auto cache_dir = config.values.find("CACHE_DIR");
+    if(cache_dir != config.values.end()) { cache_path = install_root + "/" + cache_dir->second; }
+    cache_file = cache_path + "/verify.cache";
+
+    threads = std::max(1u, std::thread::hardware_concurrency());
+    auto verify_threads = config.values.find("VERIFY_THREADS");
+    if(verify_threads != config.values.end()) { threads = std::max(1ll, std::atoll(verify_threads->second.c_str())); }
+}
+
+static std::string readWholeFile(const std::string& path, bool& ok) {
+    std::ifstream stream(path, std::ios::binary);
+    ok = stream.is_open();
+    if(!ok) { return ""; }
+    std::ostringstream contents;
+    contents << stream.rdbuf();
+    return contents.str();
+}
+
+/// Call on_line for every non-empty line of data
+template<typename F>
+static void forEachLine(std::string_view data, F on_line) {
+    while(!data.empty()) {
+        size_t end = data.find('\n');
+        std::string_view line = data.substr(0, end);
+        if(!line.empty()) { on_line(line); }
+        if(end == std::string_view::npos) { break; }
+        data.remove_prefix(end + 1);
+    }
+}
+
+static std::string parentFolder(const std::string& path) {
+    size_t slash = path.rfind('/');
+    return slash == std::string::npos ? "" : path.substr(0, slash);
+}
+
+void VerifyEngine::loadCache() {
+    std::ifstream stream(cache_file);
+    std::string line;
+    if(!stream.is_open() || !std::getline(stream, line) || line != cache_header) { return; }
+    while(std::getline(stream, line)) {
+        // size, mtime, ctime, inode, digest and path, separated by tabs; the path goes last, as it may have tabs in it
+        std::string_view rest(line);
+        std::string_view fields[5];
+        bool ok = true;
+        for(std::string_view& field : fields) {
+            size_t tab = rest.find('\t');
+            if(tab == std::string_view::npos) {
+                ok = false;
+                break;
+            }
+            field = rest.substr(0, tab);
+            rest.remove_prefix(tab + 1);
+        }
+        if(!ok || rest.empty()) { continue; }
+        CacheEntry entry;
+        entry.size = std::strtoull(std::string(fields[0]).c_str(), nullptr, 10);
+        entry.mtime = std::strtoll(std::string(fields[1]).c_str(), nullptr, 10);
+        entry.ctime = std::strtoll(std::string(fields[2]).c_str(), nullptr, 10);
+        entry.inode = std::strtoull(std::string(fields[3]).c_str(), nullptr, 10);
+        FileDigests digest;
+        if(!digest.add(rest, fields[4]) || digest.digestSize() != 32) { continue; }
+        entry.digest.assign((const char*)digest.digest(0), 32);
+        cache[std::string(rest)] = std::move(entry);
+    }
+}
+
+void VerifyEngine::saveCache(const std::vector<Check>& checks) {
+    bool changed = false;
+    for(const Check& check : checks) {
+        if(check.result == Check::Missing) {
+            changed |= cache.erase(check.path) > 0;
+        } else if(check.hashed) {
+            cache[check.path] = check.entry;
+            changed = true;
+        }
+    }
+    if(!changed) { return; }
+
+    // Write to a temporary file first, so that an interrupted run never leaves a half-written cache
+    std::error_code ec;
+    fs::create_directories(parentFolder(cache_file), ec);
+    // Runs of --verify on the same root only lock it shared, so each writes its own temporary file
+    std::string temp_file = cache_file + "." + std::to_string(getpid()) + ".new";
+    {
+        std::ofstream stream(temp_file, std::ios::trunc);
+        if(stream.is_open()) {
+            stream << cache_header << "\n";
+            for(const auto& file : cache) {
+                if(file.first.find('\n') != std::string::npos) { continue; }
+                const CacheEntry& entry = file.second;
+                stream << entry.size << '\t' << entry.mtime << '\t' << entry.ctime << '\t' << entry.inode << '\t'
+                       << Sha256::toHex((const uint8_t*)entry.digest.data(), entry.digest.size()) << '\t' << file.first << '\n';
+            }
+        }
+        if(!stream.is_open() || !stream.good()) {
+            std::cerr << "warning: could not write " << cache_file << "; the next --verify will hash every file again" << std::endl;
+            fs::remove(temp_file, ec);
+            return;
+        }
+    }
+    fs::rename(temp_file, cache_file, ec);
+}
+
+static bool hashOpenFile(int fd, uint64_t size, uint8_t digest[32]) {
+    Sha256 hash;
+    if(size >= mmap_min_size) {
+        void* map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(map != MAP_FAILED) {
+            madvise(map, size, MADV_SEQUENTIAL);
+            hash.update(map, size);
+            munmap(map, size);
+            hash.finish(digest);
+            return true;
+        }
+    }
+    static thread_local char buffer[256 * 1024];
+    ssize_t read_size;
+    while((read_size = read(fd, buffer, sizeof(buffer))) > 0) { hash.update(buffer, read_size); }
+    if(read_size < 0) { return false; }
+    hash.finish(digest);
+    return true;
+}
+
+void VerifyEngine::runCheck(Check& check) const {
+    int fd = open((install_root + check.path).c_str(), O_RDONLY | O_CLOEXEC | O_NOCTTY | O_NONBLOCK);
+    struct stat st{};
+    if(fd < 0) {
+        check.result = errno == ENOENT || errno == ENOTDIR ? Check::Missing : Check::Modified;
+        return;
+    }
+    Stats::add(Stats::StatCalls);
+    if(fstat(fd, &st) != 0) {
+        close(fd);
+        check.result = Check::Modified;
+        return;
+    }
+    if(!S_ISREG(st.st_mode)) {
+        close(fd);
+        check.result = Check::Modified;
+        return;
+    }
+    check.entry.size = st.st_size;
+    check.entry.mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    check.entry.ctime = (int64_t)st.st_ctim.tv_sec * 1000000000 + st.st_ctim.tv_nsec;
+    check.entry.inode = st.st_ino;
+
+    // The ctime is part of the key too: tools that restore mtimes can not restore it
+    auto cached = cache.find(check.path);
+    if(cached != cache.end() && cached->second.size == check.entry.size && cached->second.mtime == check.entry.mtime
+       && cached->second.ctime == check.entry.ctime && cached->second.inode == check.entry.inode) {
+        close(fd);
+        Stats::add(Stats::VerifyCacheHits);
+        check.cached = true;
+        check.result = cached->second.digest == check.expected ? Check::Ok : Check::Modified;
+        return;
+    }
+
+    uint8_t digest[32];
+    bool ok = hashOpenFile(fd, st.st_size, digest);
+    close(fd);
+    if(!ok) {
+        check.result = Check::Modified;
+        return;
+    }
+    Stats::add(Stats::FilesHashed);
+    check.hashed = true;
+    check.entry.digest.assign((const char*)digest, sizeof(digest));
+    check.result = check.entry.digest == check.expected ? Check::Ok : Check::Modified;
+}
+
+int VerifyEngine::Verify(const std::vector<std::string>& packages) {
+    const std::string packages_path = install_root + "/etc/bvpm/packages";
+    std::vector<std::string> installed;
+    std::error_code ec;
+    for(auto& p : fs::directory_iterator(packages_path, ec)) {
+        if(p.is_directory(ec)) { installed.push_back(p.path().filename().string()); }
+    }
+    std::sort(installed.begin(), installed.end());
+
+    int num_problems = 0;
+    std::vector<std::string> selected;
+    if(packages.empty()) {
+        selected = installed;
+    } else {
+        for(const std::string& package : packages) {
+            if(std::binary_search(installed.begin(), installed.end(), package)) {
+                selected.push_back(package);
+                continue;
+            }
+            // Keep the machine readable formats parseable; the misses go to stderr there
+            (format == Format::Text ? out : std::cerr) << "package " << package << " not installed" << '\n';
+            num_problems++;
+        }
+    }
+
+    // Extra files can only be told apart with what every installed package owns, and which folders they share
+    std::unordered_set<std::string> owned;
+    std::unordered_map<std::string, std::string> folder_owner;
+    for(const std::string& package : installed) {
+        bool ok;
+        std::string list = readWholeFile(packages_path + "/" + package + "/owned-files", ok);
+        if(!ok) { continue; }
+        Stats::add(Stats::ManifestsParsed);
+        forEachLine(list, [&](std::string_view line) {
+            std::string path(line);
+            std::string folder = parentFolder(path);
+            auto it = folder_owner.emplace(folder, package).first;
+            // An empty owner marks a folder shared by several packages
+            if(it->second != package) { it->second.clear(); }
+            owned.insert(std::move(path));
+        });
+    }
+
+    std::vector<Check> checks;
+    for(size_t i = 0; i < selected.size(); i++) {
+        bool ok;
+        std::string sums = readWholeFile(packages_path + "/" + selected[i] + "/sums", ok);
+        if(!ok) {
+            std::cerr << "warning verifying " << selected[i] << ": package has no sums file" << std::endl;
+            continue;
+        }
+        Stats::add(Stats::ManifestsParsed);
+        // The same format PackageFile reads from the package: sha256sum output, run inside root/
+        FileDigests digests;
+        forEachLine(sums, [&](std::string_view line) {
+            size_t space = line.find(' ');
+            if(space == std::string_view::npos) { return; }
+            std::string_view hash = line.substr(0, space);
+            std::string_view file_str = line.substr(space);
+            while(!file_str.empty() && file_str[0] == ' ') { file_str.remove_prefix(1); }
+            if(!file_str.empty() && file_str[0] == '*') { file_str.remove_prefix(1); }
+            if(!file_str.empty() && file_str[0] == '.') { file_str.remove_prefix(1); }
+            digests.add(file_str, hash);
+        });
+        if(digests.size() && digests.digestSize() != 32) {
+            std::cerr << "warning verifying " << selected[i] << ": sums file does not have SHA-256 digests" << std::endl;
+            continue;
+        }
+        for(size_t d = 0; d < digests.size(); d++) {
+            Check check;
+            check.package = i;
+            check.path = digests.paths.get(d);
+            if(check.path.empty() || check.path[0] != '/') { check.path.insert(0, "/"); }
+            check.expected.assign((const char*)digests.digest(d), 32);
+            checks.push_back(std::move(check));
+        }
+    }
+
+    loadCache();
+    // Workers take files one at a time, so that a few large files do not hold everything up
+    const unsigned workers_count = std::max(1u, std::min<unsigned>(threads, checks.size()));
+    if(workers_count == 1) {
+        for(Check& check : checks) { runCheck(check); }
+    } else {
+        std::atomic<size_t> next{0};
+        std::vector<std::thread> workers;
+        for(unsigned i = 0; i < workers_count; i++) {
+            workers.emplace_back([&]() {
+                for(size_t n; (n = next.fetch_add(1)) < checks.size();) { runCheck(checks[n]); }
+            });
+        }
+        for(std::thread& worker : workers) { worker.join(); }
+    }
+
+    struct Problems {
+        std::vector<std::string> modified;
+        std::vector<std::string> missing;
+        std::vector<std::string> extra;
+    };
+    std::vector<Problems> problems(selected.size());
+    size_t hashed = 0;
+    size_t cached = 0;
+    for(const Check& check : checks) {
+        if(check.hashed) { hashed++; }
+        if(check.cached) { cached++; }
+        if(check.result == Check::Modified) { problems[check.package].modified.push_back(check.path); }
+        if(check.result == Check::Missing) { problems[check.package].missing.push_back(check.path); }
+    }
+    std::unordered_map<std::string, size_t> selected_index;
+    for(size_t i = 0; i < selected.size(); i++) { selected_index.emplace(selected[i], i); }
+    for(const auto& folder : folder_owner) {
+        auto package = selected_index.find(folder.second);
+        if(folder.first.empty() || package == selected_index.end()) { continue; }
+        for(auto& p : fs::directory_iterator(install_root + folder.first, ec)) {
+            if(p.is_directory(ec)) { continue; }
+            std::string path = folder.first + "/" + p.path().filename().string();
+            if(owned.find(path) == owned.end()) { problems[package->second].extra.push_back(path); }
+        }
+    }
+    for(Problems& package_problems : problems) { std::sort(package_problems.extra.begin(), package_problems.extra.end()); }
+
+    static const char* kinds[] = {"modified", "missing", "extra"};
+    if(format == Format::JSON) { out << "{"; }
+    for(size_t i = 0; i < selected.size(); i++) {
+        const std::vector<std::string>* lists[] = {&problems[i].modified, &problems[i].missing, &problems[i].extra};
+        bool has_problems = !lists[0]->empty() || !lists[1]->empty() || !lists[2]->empty();
+        if(has_problems) { num_problems++; }
+        if(format == Format::JSON) {
+            out << (i ? ", " : "") << QueryEngine::jsonString(selected[i]) << ": {";
+            for(int k = 0; k < 3; k++) {
+                out << (k ? ", " : "") << "\"" << kinds[k] << "\": [";
+                for(size_t j = 0; j < lists[k]->size(); j++) { out << (j ? ", " : "") << QueryEngine::jsonString((*lists[k])[j]); }
+                out << "]";
+            }
+            out << "}";
+            continue;
+        }
+        for(int k = 0; k < 3; k++) {
+            for(const std::string& path : *lists[k]) {
+                if(format == Format::TSV) {
+                    out << selected[i] << '\t' << kinds[k] << '\t' << path << '\n';
+                } else {
+                    out << selected[i] << ": " << kinds[k] << " " << path << '\n';
+                }
+            }
+        }
+    }
+    if(format == Format::JSON) { out << "}\n"; }
+    if(format == Format::Text) {
+        out << "Verified " << checks.size() << " files of " << selected.size() << " packages (" << hashed << " hashed, " << cached
+            << " unchanged since the last run): " << num_problems << " with problems" << '\n';
+    }
+    out.flush();
+
+    saveCache(checks);
+    return num_problems;
+}
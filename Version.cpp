@@ -0,0 +1,56 @@
+#include <cctype>
+#include <Version.h>
+
+/// The weight of a character in a non-digit run; the end of a run weighs 0
+static int order(char c) {
+    if(c == '~') { return -1; }
+    if(isalpha((unsigned char)c)) { return c; }
+    return c + 256;
+}
+
+static int compareParts(std::string_view a, std::string_view b) {
+    size_t i = 0, j = 0;
+    while(i < a.size() || j < b.size()) {
+        // The non-digit runs
+        while((i < a.size() && !isdigit((unsigned char)a[i])) || (j < b.size() && !isdigit((unsigned char)b[j]))) {
+            int ac = i < a.size() && !isdigit((unsigned char)a[i]) ? order(a[i]) : 0;
+            int bc = j < b.size() && !isdigit((unsigned char)b[j]) ? order(b[j]) : 0;
+            if(ac != bc) { return ac - bc; }
+            if(i < a.size() && !isdigit((unsigned char)a[i])) { i++; }
+            if(j < b.size() && !isdigit((unsigned char)b[j])) { j++; }
+        }
+        // The digit runs, compared as numbers of any length
+        while(i < a.size() && a[i] == '0') { i++; }
+        while(j < b.size() && b[j] == '0') { j++; }
+        int first_difference = 0;
+        while(i < a.size() && isdigit((unsigned char)a[i]) && j < b.size() && isdigit((unsigned char)b[j])) {
+            if(!first_difference) { first_difference = a[i] - b[j]; }
+            i++;
+            j++;
+        }
+        if(i < a.size() && isdigit((unsigned char)a[i])) { return 1; }
+        if(j < b.size() && isdigit((unsigned char)b[j])) { return -1; }
+        if(first_difference) { return first_difference; }
+    }
+    return 0;
+}
+
+/// Split off the epoch; a version without one, or with something other than digits before the colon, has epoch 0
+static unsigned long long epoch(std::string_view& version) {
+    size_t colon = version.find(':');
+    if(colon == std::string_view::npos || colon == 0) { return 0; }
+    unsigned long long value = 0;
+    for(size_t i = 0; i < colon; i++) {
+        if(!isdigit((unsigned char)version[i])) { return 0; }
+        value = value * 10 + (version[i] - '0');
+    }
+    version.remove_prefix(colon + 1);
+    return value;
+}
+
+int Version::compare(std::string_view a, std::string_view b) {
+    unsigned long long a_epoch = epoch(a);
+    unsigned long long b_epoch = epoch(b);
+    if(a_epoch != b_epoch) { return a_epoch < b_epoch ? -1 : 1; }
+    return compareParts(a, b);
+}
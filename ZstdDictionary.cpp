@@ -0,0 +1,110 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <zstd.h>
+#include <zdict.h>
+#include <ZstdDictionary.h>
+#include <debug.h>
+
+namespace {
+/// The folders and loaded dictionaries of the process; packages may be read on several threads at once
+struct Registry {
+    std::mutex mutex;
+    std::vector<std::string> folders;
+    std::map<uint32_t, std::unique_ptr<ZSTD_DDict, size_t(*)(ZSTD_DDict*)>> dictionaries;
+};
+}
+
+static Registry& registry() {
+    static Registry instance;
+    return instance;
+}
+
+void ZstdDictionaries::addFolder(const std::string& folder) {
+    Registry& r = registry();
+    std::lock_guard<std::mutex> guard(r.mutex);
+    for(const std::string& existing : r.folders) {
+        if(existing == folder) { return; }
+    }
+    r.folders.push_back(folder);
+}
+
+const ZSTD_DDict* ZstdDictionaries::find(uint32_t id) {
+    Registry& r = registry();
+    std::lock_guard<std::mutex> guard(r.mutex);
+    auto loaded = r.dictionaries.find(id);
+    if(loaded != r.dictionaries.end()) { return loaded->second.get(); }
+    // Misses are not remembered, as a repository with the dictionary may still be added
+    for(const std::string& folder : r.folders) {
+        std::ifstream stream(folder + "/" + std::to_string(id) + ".zdict", std::ios::binary);
+        if(!stream.is_open()) { continue; }
+        std::ostringstream data;
+        data << stream.rdbuf();
+        const std::string dictionary = data.str();
+        if(dictionaryID(dictionary) != id) {
+            std::cerr << "warning: " << folder << "/" << id << ".zdict is not zstd dictionary " << id << "; ignoring it" << std::endl;
+            continue;
+        }
+        ZSTD_DDict* ddict = ZSTD_createDDict(dictionary.data(), dictionary.size());
+        if(!ddict) { continue; }
+        PRINT_DEBUG("loaded zstd dictionary " << id << " from " << folder << std::endl);
+        return r.dictionaries.emplace(id, std::unique_ptr<ZSTD_DDict, size_t(*)(ZSTD_DDict*)>(ddict, ZSTD_freeDDict)).first->second.get();
+    }
+    return nullptr;
+}
+
+uint32_t ZstdDictionaries::frameDictionaryID(const void* data, size_t size) {
+    return ZSTD_getDictID_fromFrame(data, size);
+}
+
+uint32_t ZstdDictionaries::dictionaryID(const std::string& dictionary) {
+    return ZDICT_getDictID(dictionary.data(), dictionary.size());
+}
+
+std::string ZstdDictionaries::train(const std::vector<std::string>& samples, size_t capacity) {
+    // ZDICT wants the samples back to back, with their sizes next to them
+    std::string buffer;
+    std::vector<size_t> sizes;
+    sizes.reserve(samples.size());
+    for(const std::string& sample : samples) {
+        buffer += sample;
+        sizes.push_back(sample.size());
+    }
+    std::string dictionary(capacity, '\0');
+    size_t size = ZDICT_trainFromBuffer(dictionary.data(), dictionary.size(), buffer.data(), sizes.data(), (unsigned)sizes.size());
+    if(ZDICT_isError(size)) {
+        std::cerr << "error training zstd dictionary on " << samples.size() << " samples: " << ZDICT_getErrorName(size) << std::endl;
+        return "";
+    }
+    dictionary.resize(size);
+    return dictionary;
+}
+
+ZstdCompressor::ZstdCompressor(const std::string& _dictionary, int level) : context(ZSTD_createCCtx()) {
+    ZSTD_CCtx_setParameter(context, ZSTD_c_compressionLevel, level);
+    ZSTD_CCtx_setParameter(context, ZSTD_c_checksumFlag, 1);
+    if(!_dictionary.empty()) {
+        dictionary = ZSTD_createCDict(_dictionary.data(), _dictionary.size(), level);
+        ZSTD_CCtx_refCDict(context, dictionary);
+    }
+}
+
+ZstdCompressor::~ZstdCompressor() {
+    ZSTD_freeCCtx(context);
+    ZSTD_freeCDict(dictionary);
+}
+
+bool ZstdCompressor::compress(const std::string& data, std::string& out) {
+    out.resize(ZSTD_compressBound(data.size()));
+    size_t size = ZSTD_compress2(context, out.data(), out.size(), data.data(), data.size());
+    if(ZSTD_isError(size)) {
+        std::cerr << "error compressing with zstd: " << ZSTD_getErrorName(size) << std::endl;
+        out.clear();
+        return false;
+    }
+    out.resize(size);
+    return true;
+}
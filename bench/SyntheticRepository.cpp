@@ -0,0 +1,182 @@
+#include <iostream>
+#include <filesystem>
+#include <fstream>
+#include <cmath>
+#include <algorithm>
+#include <archive.h>
+#include <archive_entry.h>
+#include <SyntheticRepository.h>
+#include <LocalFolderRepository.h>
+#include <Hash.h>
+#ifdef BVPM_ENABLE_ZSTD
+#include <SeekableZstd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+// Files are spread over a few folders per package, so that the install has some folders to create
+static const size_t files_per_folder = 16;
+
+SyntheticRepository::SyntheticRepository(std::string _path, SyntheticRepositoryOptions _options)
+    : path(std::move(_path)), options(_options), rng(_options.seed) {
+    // The file contents come out of a fixed block of text-like data, so that compression has something to do
+    // but generating the data does not dominate the generator run time
+    filler.resize(1024 * 1024);
+    std::uniform_int_distribution<int> words(0, 25);
+    for(size_t i = 0; i < filler.size(); i++) {
+        filler[i] = (i % 8 == 7) ? ' ' : (char)('a' + words(rng));
+    }
+}
+
+size_t SyntheticRepository::nextFileSize() {
+    switch(options.size_distribution) {
+        case SizeDistribution::Fixed:
+            return options.file_size;
+        case SizeDistribution::Uniform: {
+            std::uniform_int_distribution<size_t> dist(0, options.file_size * 2);
+            return dist(rng);
+        }
+        case SizeDistribution::LogNormal: {
+            // Pick mu so that the mean of the distribution is file_size
+            const double sigma = 1.0;
+            double mu = std::log((double)std::max<size_t>(options.file_size, 1)) - (sigma * sigma) / 2;
+            std::lognormal_distribution<double> dist(mu, sigma);
+            return (size_t)dist(rng);
+        }
+    }
+    return options.file_size;
+}
+
+std::vector<std::string> SyntheticRepository::dependenciesFor(size_t index) {
+    std::vector<std::string> ret;
+    if(index == 0) { return ret; }
+    switch(options.dependency_shape) {
+        case DependencyShape::None:
+            break;
+        case DependencyShape::Chain:
+            ret.push_back(package_names[index - 1]);
+            break;
+        case DependencyShape::Tree:
+            ret.push_back(package_names[(index - 1) / std::max<size_t>(options.max_dependencies, 1)]);
+            break;
+        case DependencyShape::Random: {
+            std::uniform_int_distribution<size_t> count_dist(0, options.max_dependencies);
+            std::uniform_int_distribution<size_t> package_dist(0, index - 1);
+            size_t count = std::min(count_dist(rng), index);
+            for(size_t i = 0; i < count; i++) {
+                const std::string& dep = package_names[package_dist(rng)];
+                if(std::find(ret.begin(), ret.end(), dep) == ret.end()) { ret.push_back(dep); }
+            }
+            break;
+        }
+    }
+    return ret;
+}
+
+static bool writeEntry(struct archive* a, const std::string& name, const char* data, size_t size) {
+    struct archive_entry* entry = archive_entry_new();
+    archive_entry_set_pathname(entry, name.c_str());
+    archive_entry_set_size(entry, (la_int64_t)size);
+    archive_entry_set_filetype(entry, AE_IFREG);
+    archive_entry_set_perm(entry, 0644);
+    archive_entry_set_mtime(entry, 1652832000, 0);
+    bool ok = archive_write_header(a, entry) == ARCHIVE_OK;
+    if(ok && size) { ok = archive_write_data(a, data, size) == (la_ssize_t)size; }
+    archive_entry_free(entry);
+    if(!ok) { std::cerr << "error writing " << name << ": " << archive_error_string(a) << std::endl; }
+    return ok;
+}
+
+bool SyntheticRepository::writePackage(const std::string& file, const std::string& name,
+                                       const std::vector<std::string>& dependencies, size_t file_count) {
+    // Seekable packages are written as a plain tar first, and compressed frame by frame afterwards
+    const bool seekable = options.compress && options.seekable;
+    const std::string tar_file = seekable ? file + ".tar" : file;
+    struct archive* a = archive_write_new();
+    archive_write_set_format_pax_restricted(a);
+    if(options.compress && !seekable) { archive_write_add_filter_zstd(a); }
+    if(archive_write_open_filename(a, tar_file.c_str()) != ARCHIVE_OK) {
+        std::cerr << "error creating package " << file << ": " << archive_error_string(a) << std::endl;
+        archive_write_free(a);
+        return false;
+    }
+
+    std::string manifest = "PACKAGE=" + name + "\nVERSION=1.0.0\nDEPENDENCY=";
+    for(size_t i = 0; i < dependencies.size(); i++) {
+        manifest += dependencies[i];
+        if(i < (dependencies.size() - 1)) { manifest += ","; }
+    }
+    manifest += "\n";
+
+    std::vector<std::string> paths;
+    for(size_t i = 0; i < file_count; i++) {
+        paths.push_back("usr/share/synthetic/" + name + "/d" + std::to_string(i / files_per_folder) + "/file" + std::to_string(i));
+    }
+    std::string owned_files;
+    for(const std::string& p : paths) { owned_files += "/" + p + "\n"; }
+
+    // Pick the contents up front, so that the sums file (in sha256sum format) can go before them
+    std::vector<std::pair<size_t, size_t>> contents;
+    std::string sums;
+    for(const std::string& p : paths) {
+        size_t size = std::min(nextFileSize(), filler.size());
+        std::uniform_int_distribution<size_t> offset_dist(0, filler.size() - size);
+        contents.emplace_back(offset_dist(rng), size);
+        Sha256 hash;
+        hash.update(filler.data() + contents.back().first, size);
+        sums += hash.finishHex() + "  ./" + p + "\n";
+    }
+
+    bool ok = writeEntry(a, "manifest", manifest.data(), manifest.size());
+    ok = ok && writeEntry(a, "owned-files", owned_files.data(), owned_files.size());
+    ok = ok && writeEntry(a, "sums", sums.data(), sums.size());
+    for(size_t i = 0; i < paths.size() && ok; i++) {
+        ok = writeEntry(a, "root/" + paths[i], filler.data() + contents[i].first, contents[i].second);
+        total_payload_bytes += contents[i].second;
+    }
+
+    archive_write_close(a);
+    archive_write_free(a);
+    if(seekable) {
+#ifdef BVPM_ENABLE_ZSTD
+        ok = ok && SeekableZstd::compressFile(tar_file, file);
+#else
+        std::cerr << "error creating package " << file << ": this bvpm was built without zstd support" << std::endl;
+        ok = false;
+#endif
+        fs::remove(tar_file);
+    }
+    return ok;
+}
+
+bool SyntheticRepository::generate() {
+    fs::create_directories(packagesPath());
+    fs::create_directories(repositoryPath());
+    fs::create_directories(rootPath() + "/etc/bvpm/packages");
+    {
+        std::ofstream repo_manifest(repositoryPath() + "/repo.manifest");
+        repo_manifest << "NAME=synthetic\n";
+    }
+    {
+        std::ofstream config(configPath());
+        config << "REPOSITORY_synthetic=" << repositoryPath() << "\n";
+    }
+
+    package_names.clear();
+    package_files.clear();
+    char name_buffer[32];
+    for(size_t i = 0; i < options.package_count; i++) {
+        snprintf(name_buffer, sizeof(name_buffer), "pkg%06zu", i);
+        package_names.emplace_back(name_buffer);
+    }
+
+    LocalFolderRepository repo("synthetic", repositoryPath(), true);
+    if(!repo.good()) { return false; }
+    for(size_t i = 0; i < options.package_count; i++) {
+        std::string file = packagesPath() + "/" + package_names[i] + ".bvp";
+        if(!writePackage(file, package_names[i], dependenciesFor(i), options.files_per_package)) { return false; }
+        if(!repo.addPackageFileToRepository(file)) { return false; }
+        package_files.push_back(file);
+    }
+    return true;
+}
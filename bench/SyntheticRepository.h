@@ -0,0 +1,69 @@
+#ifndef BVPM_SYNTHETICREPOSITORY_H
+#define BVPM_SYNTHETICREPOSITORY_H
+
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+
+enum class SizeDistribution {
+    Fixed,      // Every file is exactly file_size bytes
+    Uniform,    // Uniform between 0 and 2 * file_size
+    LogNormal   // Log-normal with a mean of file_size; a few large files, lots of small ones
+};
+
+enum class DependencyShape {
+    None,       // No package depends on anything
+    Chain,      // pkg N depends on pkg N-1
+    Tree,       // pkg N depends on its parent in a tree with max_dependencies children per node
+    Random      // pkg N depends on up to max_dependencies random packages below it (always a DAG)
+};
+
+struct SyntheticRepositoryOptions {
+    size_t package_count = 100;
+    size_t files_per_package = 20;
+    size_t file_size = 4096;
+    SizeDistribution size_distribution = SizeDistribution::LogNormal;
+    DependencyShape dependency_shape = DependencyShape::Random;
+    size_t max_dependencies = 3;
+    /// Compress the generated .bvp files with zstd; otherwise they are plain tar files.
+    bool compress = true;
+    /// With compress, write the seekable zstd format (independent frames and a seek table) instead of one zstd stream.
+    bool seekable = false;
+    uint32_t seed = 1;
+};
+
+/// Generates a set of synthetic .bvp packages, a local folder repository containing them,
+/// and an empty install root. The layout below the output folder is:
+///   packages/  the generated .bvp files
+///   repo/      a LocalFolderRepository with all packages added
+///   root/      an install root with an empty package database
+///   bvpm.cfg   a config file pointing at repo/
+class SyntheticRepository {
+public:
+    SyntheticRepository(std::string _path, SyntheticRepositoryOptions _options);
+    bool generate();
+
+    /// Write a single package file. The files are placed below usr/share/synthetic/<name>/.
+    bool writePackage(const std::string& file, const std::string& name, const std::vector<std::string>& dependencies,
+                      size_t file_count);
+
+    std::string packagesPath() const { return path + "/packages"; }
+    std::string repositoryPath() const { return path + "/repo"; }
+    std::string rootPath() const { return path + "/root"; }
+    std::string configPath() const { return path + "/bvpm.cfg"; }
+
+    std::vector<std::string> package_names;
+    std::vector<std::string> package_files;
+    size_t total_payload_bytes = 0;
+private:
+    std::vector<std::string> dependenciesFor(size_t index);
+    size_t nextFileSize();
+
+    std::string path;
+    SyntheticRepositoryOptions options;
+    std::mt19937_64 rng;
+    std::string filler;
+};
+
+#endif //BVPM_SYNTHETICREPOSITORY_H
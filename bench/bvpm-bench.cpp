@@ -0,0 +1,645 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+#include <thread>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <args.hxx>
+#include <archive.h>
+#include <archive_entry.h>
+#include <config.h>
+#include <PackageFile.h>
+#include <ArchiveReader.h>
+#include <DiskWriter.h>
+#include <InstallEngine.h>
+#include <UninstallEngine.h>
+#include <DependencyEngine.h>
+#include <RepositoryEngine.h>
+#include <RepositoryQueryEngine.h>
+#include <LocalFolderRepository.h>
+#include <Stats.h>
+#include <SyntheticRepository.h>
+
+namespace fs = std::filesystem;
+
+// The engines print progress to std::cout; while measuring we throw that away
+class NullBuffer : public std::streambuf {
+protected:
+    int overflow(int c) override { return c; }
+    std::streamsize xsputn(const char* s, std::streamsize n) override { return n; }
+};
+
+class SilenceStdout {
+public:
+    SilenceStdout() : old(std::cout.rdbuf(&null)) { }
+    ~SilenceStdout() { std::cout.rdbuf(old); }
+private:
+    NullBuffer null;
+    std::streambuf* old;
+};
+
+struct BenchResult {
+    explicit BenchResult(std::string _name, size_t _items = 0, size_t _bytes = 0) : name(std::move(_name)), items(_items), bytes(_bytes) { }
+    std::string name;
+    size_t items = 0;
+    size_t bytes = 0;
+    /// How far the resident set grew during the measurement; 0 if not measured
+    size_t peak_memory_bytes = 0;
+    /// operator new calls made during the measurement; 0 if not measured
+    size_t allocations = 0;
+    std::vector<double> samples_ms;
+};
+
+class Timer {
+public:
+    Timer() : start(std::chrono::steady_clock::now()) { }
+    double elapsed_ms() const {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+private:
+    std::chrono::steady_clock::time_point start;
+};
+
+static std::string jsonEscape(const std::string& in) {
+    std::string out;
+    for(char c : in) {
+        if(c == '"' || c == '\\') { out += '\\'; }
+        out += c;
+    }
+    return out;
+}
+
+static void writeResults(std::ostream& out, const SyntheticRepositoryOptions& options, const std::string& size_distribution,
+                         const std::string& dependency_shape, const std::vector<BenchResult>& results) {
+    out << "{\n";
+    out << "  \"config\": {\"packages\": " << options.package_count << ", \"files_per_package\": " << options.files_per_package
+        << ", \"file_size\": " << options.file_size << ", \"size_distribution\": \"" << size_distribution
+        << "\", \"dependency_shape\": \"" << dependency_shape << "\"" << ", \"max_dependencies\": " << options.max_dependencies
+        << ", \"compress\": " << (options.compress ? "true" : "false") << ", \"seekable\": " << (options.seekable ? "true" : "false")
+        << ", \"seed\": " << options.seed << "},\n";
+    out << "  \"results\": [\n";
+    for(size_t i = 0; i < results.size(); i++) {
+        const BenchResult& result = results[i];
+        std::vector<double> sorted = result.samples_ms;
+        std::sort(sorted.begin(), sorted.end());
+        double mean = sorted.empty() ? 0 : std::accumulate(sorted.begin(), sorted.end(), 0.0) / sorted.size();
+        double median = sorted.empty() ? 0 : sorted[sorted.size() / 2];
+        out << "    {\"name\": \"" << jsonEscape(result.name) << "\", \"iterations\": " << sorted.size()
+            << ", \"items\": " << result.items << ", \"bytes\": " << result.bytes
+            << ", \"min_ms\": " << (sorted.empty() ? 0 : sorted.front()) << ", \"median_ms\": " << median
+            << ", \"mean_ms\": " << mean << ", \"max_ms\": " << (sorted.empty() ? 0 : sorted.back());
+        if(result.peak_memory_bytes) { out << ", \"peak_memory_bytes\": " << result.peak_memory_bytes; }
+        if(result.allocations) { out << ", \"allocations_per_item\": " << (double)result.allocations / std::max<size_t>(result.items, 1); }
+        out << "}";
+        out << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    out << "  ]\n}\n";
+}
+
+/// Evict files from the page cache, so that the next read has to go to the disk.
+static void dropFromPageCache(const std::vector<std::string>& files) {
+    for(const std::string& file : files) {
+        int fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+        if(fd < 0) { continue; }
+        // Dirty pages can not be dropped
+        fdatasync(fd);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+}
+
+static size_t currentRSS() {
+    std::ifstream statm("/proc/self/statm");
+    size_t size = 0, resident = 0;
+    statm >> size >> resident;
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+/// Run f in a child process, so that its peak memory use can be measured on its own: a child starts out
+/// with its peak set to what it inherited, which is then subtracted.
+/// \return If false, f failed, or the child could not be run.
+template<typename F>
+static bool measureInChild(F f, double& elapsed_ms, size_t& peak_memory_bytes) {
+    int fds[2];
+    if(pipe(fds) != 0) { return false; }
+    std::cout.flush();
+    pid_t pid = fork();
+    if(pid == 0) {
+        close(fds[0]);
+        size_t baseline = currentRSS();
+        Timer timer;
+        bool ok = f();
+        double result[2] = {timer.elapsed_ms(), (double)(Stats::peakRSS() > baseline ? Stats::peakRSS() - baseline : 0)};
+        ok = ok && write(fds[1], result, sizeof(result)) == sizeof(result);
+        _exit(ok ? 0 : 1);
+    }
+    close(fds[1]);
+    double result[2] = {0, 0};
+    bool ok = pid > 0 && read(fds[0], result, sizeof(result)) == sizeof(result);
+    close(fds[0]);
+    int status = 0;
+    if(pid > 0) { waitpid(pid, &status, 0); }
+    elapsed_ms = result[0];
+    peak_memory_bytes = (size_t)result[1];
+    return ok && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+int main(int argc, char** argv) {
+    args::ArgumentParser parser("bvpm-bench generates a synthetic repository and measures the bvpm engines against it.",
+                                "Results are written as JSON.");
+    args::HelpFlag help(parser, "help", "Display this help menu", { 'h', "help" });
+    args::ValueFlag<size_t> packages_arg(parser, "packages", "Number of packages to generate", {"packages"}, 100);
+    args::ValueFlag<size_t> files_arg(parser, "files", "Files per package", {"files"}, 20);
+    args::ValueFlag<size_t> file_size_arg(parser, "file-size", "Mean file size in bytes", {"file-size"}, 4096);
+    args::ValueFlag<std::string> size_distribution_arg(parser, "size-distribution", "fixed, uniform or lognormal", {"size-distribution"}, "lognormal");
+    args::ValueFlag<std::string> dependency_shape_arg(parser, "dependency-shape", "none, chain, tree or random", {"dependency-shape"}, "random");
+    args::ValueFlag<size_t> max_deps_arg(parser, "max-dependencies", "Maximum dependencies per package (tree fan-out for tree)", {"max-dependencies"}, 3);
+    args::Flag no_compress(parser, "no-compress", "Generate uncompressed packages", {"no-compress"});
+    args::Flag seekable(parser, "seekable", "Generate packages in the seekable zstd format", {"seekable"});
+    args::ValueFlag<uint32_t> seed_arg(parser, "seed", "Random seed", {"seed"}, 1);
+    args::ValueFlag<size_t> iterations_arg(parser, "iterations", "How often every measurement is repeated", {"iterations"}, 3);
+    args::ValueFlag<size_t> scaling_steps_arg(parser, "scaling-steps", "Installed set sizes to time single package operations at (0 to skip)", {"scaling-steps"}, 4);
+    args::ValueFlag<size_t> zstd_package_mb_arg(parser, "zstd-package-mb", "Size of the package read as one zstd stream and as seekable zstd (0 to skip)", {"zstd-package-mb"}, 64);
+    args::ValueFlag<size_t> large_package_files_arg(parser, "large-package-files", "Files in the large package whose metadata memory use is measured (0 to skip)", {"large-package-files"}, 200000);
+    args::ValueFlag<size_t> metadata_reads_arg(parser, "metadata-reads", "How often one package's metadata is read to check that repeated reads do not leak (0 to skip)", {"metadata-reads"}, 10000);
+    args::ValueFlag<size_t> dictionary_packages_arg(parser, "dictionary-packages", "Small packages installed with and without a trained zstd dictionary (0 to skip)", {"dictionary-packages"}, 500);
+    args::ValueFlag<size_t> query_index_packages_arg(parser, "query-index-packages", "Packages in the index that bvpm-repo -q queries are timed against (0 to skip)", {"query-index-packages"}, 50000);
+    args::ValueFlag<std::string> dir_arg(parser, "dir", "Folder to generate the repository in (default: a fresh temporary folder)", {"dir"});
+    args::Flag keep(parser, "keep", "Keep the generated folder", {"keep"});
+    args::ValueFlag<std::string> output_arg(parser, "output", "Write the results to this file instead of stdout", {'o', "output"});
+
+    try {
+        parser.ParseCLI(argc, argv);
+    } catch(args::Help&) {
+        std::cout << parser;
+        exit(0);
+    } catch(args::Error& e) {
+        std::cerr << "Failed parsing arguments: " << e.what() << std::endl;
+        std::cout << parser;
+        exit(1);
+    }
+
+    SyntheticRepositoryOptions options;
+    options.package_count = packages_arg.Get();
+    options.files_per_package = files_arg.Get();
+    options.file_size = file_size_arg.Get();
+    options.max_dependencies = max_deps_arg.Get();
+    options.compress = !no_compress.Get();
+    options.seekable = seekable.Get();
+    options.seed = seed_arg.Get();
+    const std::string& size_distribution = size_distribution_arg.Get();
+    if(size_distribution == "fixed") { options.size_distribution = SizeDistribution::Fixed; }
+    else if(size_distribution == "uniform") { options.size_distribution = SizeDistribution::Uniform; }
+    else if(size_distribution == "lognormal") { options.size_distribution = SizeDistribution::LogNormal; }
+    else { std::cerr << "unknown size distribution " << size_distribution << std::endl; exit(1); }
+    const std::string& dependency_shape = dependency_shape_arg.Get();
+    if(dependency_shape == "none") { options.dependency_shape = DependencyShape::None; }
+    else if(dependency_shape == "chain") { options.dependency_shape = DependencyShape::Chain; }
+    else if(dependency_shape == "tree") { options.dependency_shape = DependencyShape::Tree; }
+    else if(dependency_shape == "random") { options.dependency_shape = DependencyShape::Random; }
+    else { std::cerr << "unknown dependency shape " << dependency_shape << std::endl; exit(1); }
+
+    std::string dir;
+    if(dir_arg) {
+        dir = fs::absolute(dir_arg.Get()).generic_string();
+        fs::create_directories(dir);
+    } else {
+        std::string tmpl = (fs::temp_directory_path() / "bvpm-bench-XXXXXX").generic_string();
+        if(!mkdtemp(tmpl.data())) { perror("failed to create temporary folder"); exit(1); }
+        dir = tmpl;
+    }
+    std::cerr << "generating synthetic repository in " << dir << std::endl;
+
+    std::vector<BenchResult> results;
+    SyntheticRepository synth(dir, options);
+    {
+        BenchResult generate("generate");
+        Timer timer;
+        bool ok;
+        {
+            SilenceStdout silence;
+            ok = synth.generate();
+        }
+        if(!ok) { std::cerr << "failed to generate the synthetic repository" << std::endl; exit(1); }
+        generate.samples_ms.push_back(timer.elapsed_ms());
+        generate.items = options.package_count;
+        generate.bytes = synth.total_payload_bytes;
+        results.push_back(generate);
+    }
+
+    ConfigFile config = Config::readConfigFile(synth.configPath());
+    const std::string root = synth.rootPath();
+    BenchResult metadata_read("metadata_read", synth.package_files.size(), synth.total_payload_bytes);
+    BenchResult resolution("resolution", synth.package_names.size());
+    BenchResult extraction("extraction", synth.package_names.size(), synth.total_payload_bytes);
+    BenchResult db_load("db_load", synth.package_names.size());
+    BenchResult upgrade_check("upgrade_check", synth.package_names.size());
+    BenchResult uninstall("uninstall", synth.package_names.size());
+
+    for(size_t iteration = 0; iteration < iterations_arg.Get(); iteration++) {
+        std::cerr << "iteration " << iteration + 1 << "/" << iterations_arg.Get() << std::endl;
+        SilenceStdout silence;
+        {
+            Timer timer;
+            for(const std::string& file : synth.package_files) {
+                PackageFile package;
+                if(!package.readFile(file)) { std::cerr << "failed to read " << file << std::endl; exit(1); }
+            }
+            metadata_read.samples_ms.push_back(timer.elapsed_ms());
+        }
+        {
+            InstallEngine installEngine(root, config);
+            {
+                Timer timer;
+                for(const std::string& name : synth.package_names) {
+                    if(!installEngine.AddPackage(name)) { std::cerr << "failed to add " << name << std::endl; exit(1); }
+                }
+                if(!installEngine.VerifyPossible()) { std::cerr << "failed to resolve the package set" << std::endl; exit(1); }
+                resolution.samples_ms.push_back(timer.elapsed_ms());
+            }
+            {
+                Timer timer;
+                if(!installEngine.Execute()) { std::cerr << "failed to install the package set" << std::endl; exit(1); }
+                extraction.samples_ms.push_back(timer.elapsed_ms());
+            }
+        }
+        {
+            Timer timer;
+            DependencyEngine dependencyEngine(root);
+            dependencyEngine.GetInstalledPackages();
+            db_load.samples_ms.push_back(timer.elapsed_ms());
+        }
+        {
+            // bvpm --upgrade-all up to the point where it knows there is nothing to upgrade: reading the installed
+            // database and the repository index, and joining them
+            Timer timer;
+            InstallEngine installEngine(root, config);
+            if(installEngine.AddUpgrades() != 0) { std::cerr << "found upgrades for packages that are up to date" << std::endl; exit(1); }
+            upgrade_check.samples_ms.push_back(timer.elapsed_ms());
+        }
+        {
+            Timer timer;
+            UninstallEngine uninstallEngine(root);
+            for(const std::string& name : synth.package_names) {
+                if(!uninstallEngine.AddToList(name, true)) { std::cerr << "failed to select " << name << " for removal" << std::endl; exit(1); }
+            }
+            uninstallEngine.Execute();
+            uninstall.samples_ms.push_back(timer.elapsed_ms());
+        }
+    }
+    results.push_back(metadata_read);
+    results.push_back(resolution);
+    results.push_back(extraction);
+
+    // The same package set written into an image with -i --image, against an empty scratch root
+    BenchResult image("image", synth.package_names.size(), synth.total_payload_bytes);
+    for(size_t iteration = 0; iteration < iterations_arg.Get(); iteration++) {
+        const std::string scratch = dir + "/image-root";
+        const std::string image_file = dir + "/image.tar";
+        fs::create_directories(scratch);
+        SilenceStdout silence;
+        InstallEngine installEngine(scratch, config);
+        installEngine.SetImage(image_file);
+        for(const std::string& name : synth.package_names) {
+            if(!installEngine.AddPackage(name)) { std::cerr << "failed to add " << name << std::endl; exit(1); }
+        }
+        if(!installEngine.VerifyPossible()) { std::cerr << "failed to resolve the package set" << std::endl; exit(1); }
+        Timer timer;
+        if(!installEngine.Execute()) { std::cerr << "failed to write " << image_file << std::endl; exit(1); }
+        image.samples_ms.push_back(timer.elapsed_ms());
+        fs::remove_all(scratch);
+        fs::remove(image_file);
+    }
+    results.push_back(image);
+    results.push_back(db_load);
+    results.push_back(upgrade_check);
+    results.push_back(uninstall);
+
+    // Reading the metadata of every package through each I/O backend; cold drops the files from the page cache first
+    size_t package_file_bytes = 0;
+    for(const std::string& file : synth.package_files) { package_file_bytes += fs::file_size(file); }
+    for(ArchiveIO io : {ArchiveIO::Libarchive, ArchiveIO::Buffered, ArchiveIO::Mmap}) {
+        for(bool cold : {true, false}) {
+            BenchResult result(std::string("archive_io_") + ArchiveReader::backendName(io) + (cold ? "_cold" : "_warm"),
+                               synth.package_files.size(), package_file_bytes);
+            for(size_t iteration = 0; iteration < iterations_arg.Get(); iteration++) {
+                if(cold) { dropFromPageCache(synth.package_files); }
+                SilenceStdout silence;
+                Timer timer;
+                for(const std::string& file : synth.package_files) {
+                    PackageFile package;
+                    package.archive_io = io;
+                    if(!package.readFile(file)) { std::cerr << "failed to read " << file << std::endl; exit(1); }
+                }
+                result.samples_ms.push_back(timer.elapsed_ms());
+            }
+            results.push_back(result);
+        }
+    }
+
+    // Installing the whole set through each disk writer; the packages are removed again after every sample
+    for(DiskWriterBackend backend : {DiskWriterBackend::Libarchive, DiskWriterBackend::IoUring}) {
+        BenchResult result(std::string("extraction_") + DiskWriter::backendName(backend), synth.package_names.size(), synth.total_payload_bytes);
+        ConfigFile writer_config = config;
+        writer_config.values["DISK_WRITER"] = DiskWriter::backendName(backend);
+        for(size_t iteration = 0; iteration < iterations_arg.Get(); iteration++) {
+            SilenceStdout silence;
+            InstallEngine installEngine(root, writer_config);
+            for(const std::string& name : synth.package_names) {
+                if(!installEngine.AddPackage(name)) { std::cerr << "failed to add " << name << std::endl; exit(1); }
+            }
+            if(!installEngine.VerifyPossible()) { std::cerr << "failed to resolve the package set" << std::endl; exit(1); }
+            Timer timer;
+            if(!installEngine.Execute()) { std::cerr << "failed to install the package set" << std::endl; exit(1); }
+            result.samples_ms.push_back(timer.elapsed_ms());
+            UninstallEngine uninstallEngine(root);
+            for(const std::string& name : synth.package_names) { uninstallEngine.AddToList(name, true); }
+            uninstallEngine.Execute();
+        }
+        results.push_back(result);
+    }
+
+    // Single package operations should not get slower as more packages are installed. Install the set in
+    // steps, and after every step time resolving the last installed package (a lookup of it and its dependencies).
+    // Dependencies always point to earlier packages, so installing in order keeps every step self-contained.
+    const size_t steps = std::min<size_t>(scaling_steps_arg.Get(), synth.package_names.size());
+    if(steps) {
+        std::cerr << "measuring single package operations at " << steps << " installed set sizes" << std::endl;
+        RepositoryEngine repositoryEngine(config, root);
+        size_t installed = 0;
+        for(size_t step = 1; step <= steps; step++) {
+            const size_t target = synth.package_names.size() * step / steps;
+            {
+                SilenceStdout silence;
+                InstallEngine installEngine(root, config);
+                for(; installed < target; installed++) {
+                    if(!installEngine.AddPackage(synth.package_names[installed])) { std::cerr << "failed to add " << synth.package_names[installed] << std::endl; exit(1); }
+                }
+                if(!installEngine.VerifyPossible() || !installEngine.Execute()) { std::cerr << "failed to install the package set" << std::endl; exit(1); }
+            }
+            const std::string& name = synth.package_names[installed - 1];
+            BenchResult single("single_package_" + std::to_string(installed) + "_installed", installed);
+            constexpr int operations_per_sample = 100;
+            for(size_t iteration = 0; iteration < iterations_arg.Get(); iteration++) {
+                SilenceStdout silence;
+                Timer timer;
+                for(int i = 0; i < operations_per_sample; i++) {
+                    DependencyEngine dependencyEngine(root);
+                    std::vector<SimplePackageData> packages{repositoryEngine.getSimplePackageData(name)};
+                    if(!dependencyEngine.IsInstalled(name) || !dependencyEngine.CheckDependencies(packages, repositoryEngine)) {
+                        std::cerr << "failed to resolve " << name << std::endl;
+                        exit(1);
+                    }
+                }
+                single.samples_ms.push_back(timer.elapsed_ms() / operations_per_sample);
+            }
+            results.push_back(single);
+        }
+    }
+
+    // Reading the metadata of a single package with a lot of files, to see what its file lists cost in memory
+    if(large_package_files_arg.Get()) {
+        std::cerr << "measuring a package with " << large_package_files_arg.Get() << " files" << std::endl;
+        SyntheticRepositoryOptions large_options = options;
+        large_options.file_size = 16;
+        large_options.size_distribution = SizeDistribution::Fixed;
+        SyntheticRepository large(dir, large_options);
+        const std::string file = synth.packagesPath() + "/large.bvp";
+        if(!large.writePackage(file, "large", {}, large_package_files_arg.Get())) { std::cerr << "failed to generate " << file << std::endl; exit(1); }
+        BenchResult large_metadata("large_package_metadata", large_package_files_arg.Get(), large.total_payload_bytes);
+        for(size_t iteration = 0; iteration < iterations_arg.Get(); iteration++) {
+            double elapsed_ms;
+            size_t peak_memory_bytes;
+            bool ok = measureInChild([&]() {
+                SilenceStdout silence;
+                PackageFile package;
+                if(!package.readFile(file)) { return false; }
+                return package.files.size() == large_package_files_arg.Get();
+            }, elapsed_ms, peak_memory_bytes);
+            if(!ok) { std::cerr << "failed to read " << file << std::endl; exit(1); }
+            large_metadata.samples_ms.push_back(elapsed_ms);
+            large_metadata.peak_memory_bytes = std::max(large_metadata.peak_memory_bytes, peak_memory_bytes);
+        }
+        results.push_back(large_metadata);
+    }
+
+    // The same package's metadata read over and over, as a long bulk operation does: after the first reads have
+    // filled the BufferPool, no more read buffers may be allocated, no file descriptors may be left open, and every
+    // read has to make the same number of allocations (those of the manifest, file lists and strings it returns)
+    if(metadata_reads_arg.Get() && !synth.package_files.empty()) {
+        const size_t reads = metadata_reads_arg.Get();
+        const size_t warmup = std::min<size_t>(reads, 16);
+        const std::string& file = synth.package_files.front();
+        std::cerr << "reading the metadata of one package " << reads << " times" << std::endl;
+        auto openFiles = []() { return (size_t)std::distance(fs::directory_iterator("/proc/self/fd"), fs::directory_iterator()); };
+        auto readMetadata = [&](size_t count) {
+            SilenceStdout silence;
+            for(size_t i = 0; i < count; i++) {
+                PackageFile package;
+                if(!package.readFile(file)) { std::cerr << "failed to read " << file << std::endl; exit(1); }
+            }
+        };
+        readMetadata(warmup);
+        const size_t open_files = openFiles();
+        const uint64_t buffers_allocated = Stats::get(Stats::BuffersAllocated);
+        BenchResult result("metadata_read_repeated", reads - warmup);
+        Timer timer;
+        const uint64_t allocations = Stats::allocationCount();
+        const uint64_t live_allocations = Stats::liveAllocations();
+        readMetadata(reads - warmup);
+        const uint64_t live_after = Stats::liveAllocations();
+        result.samples_ms.push_back(timer.elapsed_ms());
+        result.allocations = Stats::allocationCount() - allocations;
+        results.push_back(result);
+        if(Stats::get(Stats::BuffersAllocated) != buffers_allocated) {
+            std::cerr << "repeated metadata reads allocated " << Stats::get(Stats::BuffersAllocated) - buffers_allocated << " read buffers" << std::endl;
+            exit(1);
+        }
+        if(openFiles() != open_files) {
+            std::cerr << "repeated metadata reads left " << openFiles() - open_files << " files open" << std::endl;
+            exit(1);
+        }
+        // Whatever the reads allocate has to be deleted again by the time they are done: once warmed up, a read that
+        // keeps one allocation alive leaves as many behind as there were reads
+        if(live_after > live_allocations) {
+            std::cerr << "repeated metadata reads left " << live_after - live_allocations << " allocations behind in " << reads - warmup << " reads" << std::endl;
+            exit(1);
+        }
+    }
+
+    // Decompressing one big package: as a single zstd stream libarchive runs on one core, while the frames of a
+    // seekable package are decompressed on all of them
+    if(zstd_package_mb_arg.Get()) {
+        const size_t file_size = 256 * 1024;
+        const size_t file_count = zstd_package_mb_arg.Get() * 1024 * 1024 / file_size;
+        std::cerr << "measuring a " << zstd_package_mb_arg.Get() << " MB package as one zstd stream and as seekable zstd" << std::endl;
+        for(bool seekable_package : {false, true}) {
+#ifndef BVPM_ENABLE_ZSTD
+            if(seekable_package) { continue; }
+#endif
+            SyntheticRepositoryOptions zstd_options = options;
+            zstd_options.compress = true;
+            zstd_options.seekable = seekable_package;
+            zstd_options.file_size = file_size;
+            zstd_options.size_distribution = SizeDistribution::Fixed;
+            SyntheticRepository big(dir, zstd_options);
+            const std::string file = synth.packagesPath() + (seekable_package ? "/big-seekable.bvp" : "/big.bvp");
+            if(!big.writePackage(file, "big", {}, file_count)) { std::cerr << "failed to generate " << file << std::endl; exit(1); }
+            BenchResult result(seekable_package ? "zstd_seekable_read" : "zstd_single_stream_read", file_count, big.total_payload_bytes);
+            std::vector<char> buffer(64 * 1024);
+            for(size_t iteration = 0; iteration < iterations_arg.Get(); iteration++) {
+                Timer timer;
+                ArchiveHandle a = ArchiveReader::open(file);
+                struct archive_entry* entry;
+                size_t bytes = 0;
+                while(a && archive_read_next_header(a.get(), &entry) == ARCHIVE_OK) {
+                    la_ssize_t read;
+                    const bool payload = strncmp(archive_entry_pathname(entry), "root/", 5) == 0;
+                    while((read = archive_read_data(a.get(), buffer.data(), buffer.size())) > 0) { bytes += payload ? read : 0; }
+                }
+                a.reset();
+                result.samples_ms.push_back(timer.elapsed_ms());
+                if(bytes != big.total_payload_bytes) { std::cerr << "failed to read " << file << std::endl; exit(1); }
+            }
+            results.push_back(result);
+        }
+    }
+
+#ifdef BVPM_ENABLE_ZSTD
+    // Installing a repository of small packages, compressed as usual and after bvpm-repo --train-dictionary. The
+    // bytes are those of the package files, so the two results give the compression ratio of the dictionary.
+    if(dictionary_packages_arg.Get()) {
+        std::cerr << "measuring " << dictionary_packages_arg.Get() << " small packages with and without a zstd dictionary" << std::endl;
+        SyntheticRepositoryOptions small_options = options;
+        small_options.package_count = dictionary_packages_arg.Get();
+        small_options.files_per_package = 4;
+        small_options.file_size = 512;
+        small_options.dependency_shape = DependencyShape::None;
+        small_options.compress = true;
+        small_options.seekable = false;
+        SyntheticRepository small(dir + "/dictionary", small_options);
+        bool ok;
+        {
+            SilenceStdout silence;
+            ok = small.generate();
+        }
+        if(!ok) { std::cerr << "failed to generate the small package repository" << std::endl; exit(1); }
+        ConfigFile small_config = Config::readConfigFile(small.configPath());
+        auto repositoryBytes = [&]() {
+            size_t bytes = 0;
+            for(const auto& entry : fs::recursive_directory_iterator(small.repositoryPath() + "/packages")) {
+                if(entry.is_regular_file()) { bytes += entry.file_size(); }
+            }
+            return bytes;
+        };
+        for(bool dictionary : {false, true}) {
+            if(dictionary) {
+                SilenceStdout silence;
+                LocalFolderRepository repo("synthetic", small.repositoryPath(), true);
+                if(!repo.trainDictionary(128 * 1024, 112640, 19, std::thread::hardware_concurrency())) {
+                    std::cerr << "failed to train a zstd dictionary" << std::endl;
+                    exit(1);
+                }
+            }
+            // Reading the metadata is mostly decompressing; installing adds the disk writes
+            std::vector<std::string> files;
+            {
+                RepositoryEngine repositoryEngine(small_config, small.rootPath());
+                for(const std::string& name : small.package_names) { files.push_back(repositoryEngine.getBVPFileForPackage(name)); }
+            }
+            BenchResult read(dictionary ? "dictionary_metadata_read" : "no_dictionary_metadata_read", files.size(), repositoryBytes());
+            BenchResult result(dictionary ? "dictionary_install" : "no_dictionary_install", small.package_names.size(), read.bytes);
+            for(size_t iteration = 0; iteration < iterations_arg.Get(); iteration++) {
+                SilenceStdout silence;
+                Timer timer;
+                for(const std::string& file : files) {
+                    PackageFile package;
+                    if(!package.readFile(file)) { std::cerr << "failed to read " << file << std::endl; exit(1); }
+                }
+                read.samples_ms.push_back(timer.elapsed_ms());
+            }
+            for(size_t iteration = 0; iteration < iterations_arg.Get(); iteration++) {
+                SilenceStdout silence;
+                InstallEngine installEngine(small.rootPath(), small_config);
+                for(const std::string& name : small.package_names) {
+                    if(!installEngine.AddPackage(name)) { std::cerr << "failed to add " << name << std::endl; exit(1); }
+                }
+                if(!installEngine.VerifyPossible()) { std::cerr << "failed to resolve the package set" << std::endl; exit(1); }
+                Timer timer;
+                if(!installEngine.Execute()) { std::cerr << "failed to install the package set" << std::endl; exit(1); }
+                result.samples_ms.push_back(timer.elapsed_ms());
+                UninstallEngine uninstallEngine(small.rootPath());
+                for(const std::string& name : small.package_names) { uninstallEngine.AddToList(name, true); }
+                uninstallEngine.Execute();
+            }
+            results.push_back(read);
+            results.push_back(result);
+        }
+    }
+#endif
+
+    // bvpm-repo -q on a large repository: open repo.query, then a prefix search, a glob search, and details and
+    // reverse dependencies of single packages
+    if(query_index_packages_arg.Get()) {
+        const size_t package_count = query_index_packages_arg.Get();
+        std::cerr << "measuring queries on an index of " << package_count << " packages" << std::endl;
+        RepositoryIndex index;
+        char name_buffer[32];
+        for(size_t i = 0; i < package_count; i++) {
+            RepositoryIndexEntry entry;
+            snprintf(name_buffer, sizeof(name_buffer), "pkg%07zu", i);
+            entry.name = name_buffer;
+            entry.version = "1.0.0";
+            entry.installed_size = 100000 + i;
+            entry.file_size = 50000 + i;
+            for(size_t d = 1; d <= options.max_dependencies && d <= i; d++) {
+                snprintf(name_buffer, sizeof(name_buffer), "pkg%07zu", (i * 7919 + d * 104729) % i);
+                entry.dependencies.emplace_back(name_buffer);
+            }
+            entry.filename = entry.name + ".bvp";
+            entry.sha256 = std::string(64, '0');
+            index.packages[entry.name] = std::move(entry);
+        }
+        const std::string index_file = dir + "/query.index";
+        const std::string query_file = dir + "/query.query";
+        if(!index.writeToFile(index_file) || !RepositoryQueryIndex::write(index, index_file, query_file)) {
+            std::cerr << "failed to write " << query_file << std::endl;
+            exit(1);
+        }
+        BenchResult result("repo_query", package_count);
+        for(size_t iteration = 0; iteration < iterations_arg.Get(); iteration++) {
+            std::ostringstream out;
+            Timer timer;
+            RepositoryQueryIndex query_index;
+            if(!query_index.open(query_file, index_file)) { std::cerr << "failed to open " << query_file << std::endl; exit(1); }
+            RepositoryQueryEngine engine(query_index, QueryEngine::Format::JSON, out);
+            engine.Search({"pkg00001"});
+            engine.Search({"pkg*99"});
+            for(size_t i = 0; i < 100; i++) {
+                snprintf(name_buffer, sizeof(name_buffer), "pkg%07zu", i * package_count / 100);
+                if(engine.Show({name_buffer}) != 0 || engine.ReverseDependencies({name_buffer}) != 0) {
+                    std::cerr << "failed to query " << name_buffer << std::endl;
+                    exit(1);
+                }
+            }
+            result.samples_ms.push_back(timer.elapsed_ms());
+        }
+        results.push_back(result);
+    }
+
+    if(output_arg) {
+        std::ofstream out(output_arg.Get());
+        writeResults(out, options, size_distribution, dependency_shape, results);
+    } else {
+        writeResults(std::cout, options, size_distribution, dependency_shape, results);
+    }
+
+    if(!keep.Get()) { fs::remove_all(dir); }
+    return 0;
+}
@@ -19,9 +19,19 @@ ConfigFile Config::readConfigFile(std::string file) {
 	return readFromStream(ifile);
 }
 
-ConfigFile Config::readFromData(char* data) {
-    std::istringstream ss(std::string(data, strlen(data)));
-    return readFromStream(ss);
+ConfigFile Config::readFromData(std::string_view data) {
+    // The same rules as readFromStream, without copying the data into streams first
+    ConfigFile out;
+    while(!data.empty()) {
+        size_t end = data.find('\n');
+        std::string_view line = data.substr(0, end);
+        data.remove_prefix(end == std::string_view::npos ? data.size() : end + 1);
+        size_t equals = line.find('=');
+        // Lines without a value are skipped, like getline() skips them
+        if(equals == std::string_view::npos || equals + 1 == line.size()) { continue; }
+        out.values[std::string(line.substr(0, equals))] = std::string(line.substr(equals + 1));
+    }
+    return out;
 }
 
 ConfigFile Config::readFromStream(std::istream& stream) {
@@ -0,0 +1,74 @@
+#ifndef BVPM_ARCHIVEREADER_H
+#define BVPM_ARCHIVEREADER_H
+
+#include <string>
+#include <archive.h>
+#include <config.h>
+
+/// How bvp files get from the disk into libarchive.
+enum class ArchiveIO {
+    Auto,       // mmap for files of 1 MiB and up, buffered for smaller ones and anything that can not be mapped
+    Mmap,       // Map the whole file, hinting sequential access (and hugepages for large files)
+    Buffered,   // read() into a 1 MiB page aligned buffer, with the kernel reading the next block ahead
+    Libarchive  // libarchive's own file reader, with 64 KiB reads
+};
+
+/// Owns an archive opened for reading, and frees it (which also closes it) when it goes away.
+class ArchiveHandle {
+public:
+    ArchiveHandle() = default;
+    explicit ArchiveHandle(struct archive* _a) : a(_a) { }
+    ~ArchiveHandle() { reset(); }
+    ArchiveHandle(ArchiveHandle&& other) noexcept : a(other.release()) { }
+    ArchiveHandle& operator=(ArchiveHandle&& other) noexcept {
+        if(this != &other) {
+            reset();
+            a = other.release();
+        }
+        return *this;
+    }
+    ArchiveHandle(const ArchiveHandle&) = delete;
+    ArchiveHandle& operator=(const ArchiveHandle&) = delete;
+
+    struct archive* get() const { return a; }
+    explicit operator bool() const { return a != nullptr; }
+    struct archive* release() {
+        struct archive* ret = a;
+        a = nullptr;
+        return ret;
+    }
+    void reset() {
+        if(a) { archive_read_free(a); }
+        a = nullptr;
+    }
+
+private:
+    struct archive* a = nullptr;
+};
+
+/// The I/O layer between bvpm and libarchive. Every bvp file is opened through here, so that the backend is
+/// picked in one place; it comes from ARCHIVE_IO in the config file (auto, mmap, buffered or libarchive).
+/// A mapped file must not be truncated while it is being read. Packages in the seekable zstd format are
+/// decompressed frame by frame on all cores, with any backend but libarchive. Packages compressed with a zstd
+/// dictionary (see ZstdDictionaries) are decompressed by bvpm with every backend, as libarchive can not read them.
+class ArchiveReader {
+public:
+    static bool parseBackend(const std::string& name, ArchiveIO& io);
+    static const char* backendName(ArchiveIO io);
+    /// \return The backend set with ARCHIVE_IO, or Auto. Unknown values give a warning and Auto.
+    static ArchiveIO backendFromConfig(const ConfigFile& config);
+
+    /// Seekable zstd files (see SeekTable) are decompressed by bvpm, on several threads, and libarchive gets the
+    /// plain tar inside; so the offsets libarchive reports are not offsets in the file.
+    static bool isSeekableZstd(const std::string& path);
+    /// Whether bvpm decompresses the file itself: seekable zstd files, and files that need a zstd dictionary.
+    /// The offsets libarchive reports for those are not offsets in the file.
+    static bool isDecompressedByBvpm(const std::string& path);
+
+    /// Open a file for reading, with every filter enabled.
+    /// \param raw If set, the decompressed file is read as a single entry, instead of with every format enabled.
+    /// \return The archive; empty if the file could not be opened.
+    static ArchiveHandle open(const std::string& path, ArchiveIO io = ArchiveIO::Auto, bool raw = false);
+};
+
+#endif //BVPM_ARCHIVEREADER_H
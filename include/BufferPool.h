@@ -0,0 +1,34 @@
+#ifndef BVPM_BUFFERPOOL_H
+#define BVPM_BUFFERPOOL_H
+
+#include <cstddef>
+
+/// A page aligned buffer taken from a process wide pool, and given back to it when it goes away. Reading the
+/// metadata of one package after another then reuses the same few read buffers instead of allocating (and
+/// page faulting) fresh ones for every package. Sizes are rounded up to a power of two; buffers above
+/// max_pooled_size are allocated and freed as usual. Safe to use from several threads.
+class PooledBuffer {
+public:
+    static constexpr size_t max_pooled_size = 16 * 1024 * 1024;
+
+    PooledBuffer() = default;
+    explicit PooledBuffer(size_t size);
+    ~PooledBuffer();
+    PooledBuffer(PooledBuffer&& other) noexcept;
+    PooledBuffer& operator=(PooledBuffer&& other) noexcept;
+    PooledBuffer(const PooledBuffer&) = delete;
+    PooledBuffer& operator=(const PooledBuffer&) = delete;
+
+    char* data() const { return buffer; }
+    /// At least the size asked for
+    size_t size() const { return capacity; }
+    void swap(PooledBuffer& other) noexcept;
+
+private:
+    void release();
+
+    char* buffer = nullptr;
+    size_t capacity = 0;
+};
+
+#endif //BVPM_BUFFERPOOL_H
@@ -0,0 +1,56 @@
+#ifndef BVPM_DAEMON_H
+#define BVPM_DAEMON_H
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <config.h>
+#include <InstallEngine.h>
+
+/// bvpmd keeps the installed package database and the repository indexes in memory, and answers requests
+/// from bvpm over a Unix socket, so that bvpm does not have to load everything again on every run.
+///
+/// A request is a single line of tab separated words: the command (query, query-all, install or uninstall),
+/// options starting with "--", and package names. The reply is the output the command would have printed,
+/// followed by a NUL byte and the exit code as text. A request may name the config file bvpm read with
+/// --config-file=<path>; if that is not the daemon's own, the reply is a NUL byte and "declined", and bvpm does the
+/// work itself.
+/// Queries are answered from memory. Transactions run in a forked child, so that they start from the
+/// loaded state and a failing transaction cannot take the daemon down with it.
+class Daemon {
+public:
+    /// config_file is the absolute path config was read from.
+    Daemon(std::string _install_root, ConfigFile _config, std::string _config_file, std::string _socket_path);
+    ~Daemon();
+    int run();
+
+    static std::string defaultSocketPath(const std::string& install_root, const ConfigFile& config);
+    /// Send a request to a running daemon and copy its output to stdout.
+    /// \return If false, no daemon could be reached, or it declined the request, and the caller has to do the work
+    /// itself.
+    static bool sendRequest(const std::string& socket_path, const std::vector<std::string>& request, int& exit_code);
+private:
+    void reload();
+    void watch(const std::string& path, uint32_t mask);
+    void handleInotify();
+    void handleClient(int client_fd);
+    int handleQuery(const std::vector<std::string>& request, std::ostream& out);
+    /// Run in the forked child, with the install root locked; the loaded state is reloaded first if someone else
+    /// changed the root since, and for installs when there are remote repositories, whose indexes are not watched.
+    int runTransaction(const std::vector<std::string>& request);
+
+    std::string install_root;
+    ConfigFile config;
+    std::string config_file;
+    std::string socket_path;
+    std::unique_ptr<InstallEngine> engine;
+    bool dirty = true;
+    /// Whether the config has http(s) repositories
+    bool remote_repositories = false;
+    int listen_fd = -1;
+    int inotify_fd = -1;
+    std::map<int, std::string> watches;
+};
+
+#endif //BVPM_DAEMON_H
@@ -16,19 +16,33 @@ class PackageFile;
 
 class DependencyEngine {
 public:
-    DependencyEngine(std::string root) : install_root(root) { LoadInstalledPackages(); };
+    /// Nothing is read up front: single packages are looked up by reading only their own manifest, and the
+    /// whole installed database is only loaded for operations that need all of it.
+    DependencyEngine(std::string root) : install_root(root) { };
 
     bool CheckDependencies(std::vector<SimplePackageData>& packages, RepositoryEngine& repositoryEngine);
-    std::map<std::string, std::string> installed_packages;
+    bool IsInstalled(const std::string& name);
+    /// \return The installed version, or "" if the package is not installed or has no version.
+    std::string GetInstalledVersion(const std::string& name);
+    /// Load every installed package, mapped to its version.
+    const std::map<std::string, std::string>& GetInstalledPackages();
     ConfigFile LoadPackageManifest(std::string name);
     std::vector<std::string> GetPackageOwnedFiles(std::string name);
     std::vector<std::string> GetDependedPackages(std::string name_to_compare);
     size_t GetPackageSize(std::string name);
 private:
+    /// Resolve packages from the closures the repositories have for them, instead of following the dependencies one
+    /// by one. \return If false, some package has no closure, and packages is left as it is.
+    bool ResolveWithClosures(std::vector<SimplePackageData>& packages, RepositoryEngine& repositoryEngine);
     void InsertPackageIntoListSorted(const std::string& name, std::vector<SimplePackageData>& all_packages, std::vector<SimplePackageData>& sorted_packages);
     void LoadInstalledPackages();
+    bool LookupInstalled(const std::string& name, std::string& version);
     std::string install_root;
 
+    /// Installed packages seen so far; all of them once all_installed_loaded is set
+    std::map<std::string, std::string> installed_packages;
+    bool all_installed_loaded = false;
+
     std::map<std::string, ConfigFile> packageManifests;
     std::map<std::string, std::vector<std::string>> packageOwnedFiles;
     std::map<std::string, size_t> packageSize;
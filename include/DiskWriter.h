@@ -0,0 +1,82 @@
+#ifndef BVPM_DISKWRITER_H
+#define BVPM_DISKWRITER_H
+
+#include <memory>
+#include <string>
+#include <ctime>
+#include <sys/types.h>
+#include <archive.h>
+#include <archive_entry.h>
+#include <config.h>
+
+/// How extracted files get written to the disk.
+enum class DiskWriterBackend {
+    Auto,       // io_uring when the kernel supports it and there is more than one CPU, libarchive otherwise
+    IoUring,    // Batched opens, writes, closes and renames through io_uring (see UringDiskWriter)
+    Libarchive  // archive_write_disk, one entry at a time
+};
+
+/// Writes archive entries to the disk. The entry's pathname is where it ends up, and its data is read from the
+/// archive it came from. A writer may finish entries later than writeEntry() returns: everything is only on the
+/// disk, with its permissions and times set, once finish() has returned.
+class DiskWriter {
+public:
+    DiskWriter();
+    virtual ~DiskWriter() = default;
+
+    /// \return If false, the entry could not be written; the error has been printed.
+    virtual bool writeEntry(struct archive* a, struct archive_entry* entry) = 0;
+    /// Create a folder and any missing parents; folders that already exist are left as they are.
+    virtual void writeFolder(const std::string& path);
+    /// Wait for all entries to be written, and apply what is left of their metadata.
+    /// \return If false, at least one entry could not be written; the errors have been printed.
+    virtual bool finish() = 0;
+    /// The package file the archive is read from, or -1. Regular files stored uncompressed in a tar are then
+    /// copied straight from it with a reflink or copy_file_range, and their data never passes through bvpm.
+    void setSource(int fd);
+
+    static bool parseBackend(const std::string& name, DiskWriterBackend& backend);
+    static const char* backendName(DiskWriterBackend backend);
+    /// \return The backend set with DISK_WRITER, or Auto. Unknown values give a warning and Auto.
+    static DiskWriterBackend backendFromConfig(const ConfigFile& config);
+    /// \return A writer for the backend; the libarchive writer if io_uring is not available.
+    static std::unique_ptr<DiskWriter> create(DiskWriterBackend backend);
+
+protected:
+    static void splitPath(const std::string& path, std::string& folder, std::string& base);
+    /// A regular file without links, ACLs or file flags, which can be created with plain system calls
+    static bool isPlainFile(struct archive_entry* entry, const std::string& base);
+    /// The permissions and times archive_write_disk would restore without ARCHIVE_EXTRACT_OWNER
+    static mode_t entryMode(struct archive_entry* entry);
+    static void entryTimes(struct archive_entry* entry, struct timespec times[2]);
+    /// \return If true, the data of the current entry lies uncompressed in the source file, starting at offset.
+    bool storedOffset(struct archive* a, struct archive_entry* entry, int64_t& offset) const;
+    /// Create the file under a temporary name in dirfd, fill it and rename it to base. With a stored_offset of 0 or
+    /// more the data is copied from the source file, otherwise it is read from the archive into a preallocated file.
+    /// If times is given, the times (and permissions the umask took away) are set before the rename.
+    /// \return If false, errno tells why; the temporary file has been removed.
+    bool writeDirect(struct archive* a, struct archive_entry* entry, int dirfd, const std::string& base, const std::string& temporary,
+                     mode_t mode, int64_t stored_offset, const struct timespec* times);
+
+    mode_t umask_bits;
+    int source_fd = -1;
+    uint64_t source_size = 0;
+};
+
+/// The libarchive writer: archive_write_disk, restoring times, ACLs, permissions and file flags.
+class LibarchiveDiskWriter : public DiskWriter {
+public:
+    LibarchiveDiskWriter();
+    ~LibarchiveDiskWriter() override;
+    LibarchiveDiskWriter(const LibarchiveDiskWriter&) = delete;
+    LibarchiveDiskWriter& operator=(const LibarchiveDiskWriter&) = delete;
+
+    bool writeEntry(struct archive* a, struct archive_entry* entry) override;
+    bool finish() override;
+
+private:
+    struct archive* extract;
+    bool failed = false;
+};
+
+#endif //BVPM_DISKWRITER_H
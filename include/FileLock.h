@@ -0,0 +1,37 @@
+#ifndef BVPM_FILELOCK_H
+#define BVPM_FILELOCK_H
+
+#include <string>
+
+/// An flock() on a lock file, released when the FileLock goes away (or the process ends, however it ends).
+/// Shared locks are taken for reading, exclusive ones for changing what the lock file stands for:
+///  - ROOT/var/lib/bvpm/lock, for the installed packages of a root: shared for queries and --verify, exclusive for
+///    transactions. Transactions on different roots never wait for each other.
+///  - repo.lock in a local folder repository: exclusive while bvpm-repo changes the repository, shared while bvpm
+///    reads its index, and from the moment packages are prepared until the transaction is done.
+class FileLock {
+public:
+    enum class Mode { Shared, Exclusive };
+
+    FileLock() = default;
+    ~FileLock() { unlock(); }
+    FileLock(FileLock&& other) noexcept;
+    FileLock& operator=(FileLock&& other) noexcept;
+    FileLock(const FileLock&) = delete;
+    FileLock& operator=(const FileLock&) = delete;
+
+    /// Take the lock, creating the lock file and its folder if they do not exist yet. If another process holds a
+    /// lock that conflicts, a note saying that we wait for what is locked is printed once, and we wait.
+    /// \return If false, the lock file could not be opened or locked, and nothing is locked; errno tells why.
+    bool lock(const std::string& path, Mode mode, const std::string& what);
+    void unlock();
+    bool locked() const { return fd >= 0; }
+
+    /// The lock file of an install root
+    static std::string rootLockPath(const std::string& root) { return root + "/var/lib/bvpm/lock"; }
+
+private:
+    int fd = -1;
+};
+
+#endif //BVPM_FILELOCK_H
@@ -0,0 +1,30 @@
+#ifndef BVPM_HASH_H
+#define BVPM_HASH_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+/// Streaming SHA-256, so that files can be verified while they are being read or downloaded.
+class Sha256 {
+public:
+    Sha256() { reset(); }
+    void reset();
+    void update(const void* data, size_t size);
+    /// Finish the hash and write the 32 byte digest to out. The object has to be reset() before reuse.
+    void finish(uint8_t out[32]);
+    /// Finish the hash and return it as lowercase hex.
+    std::string finishHex();
+
+    /// Hash a whole file. Returns "" if the file could not be read.
+    static std::string hashFile(const std::string& path);
+    static std::string toHex(const uint8_t* data, size_t size);
+private:
+    void transform(const uint8_t block[64]);
+    uint32_t state[8];
+    uint64_t total_bytes;
+    uint8_t buffer[64];
+    size_t buffer_used;
+};
+
+#endif //BVPM_HASH_H
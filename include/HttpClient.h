@@ -0,0 +1,42 @@
+#ifndef BVPM_HTTPCLIENT_H
+#define BVPM_HTTPCLIENT_H
+
+#include <string>
+#include <vector>
+
+struct HttpDownload {
+    std::string url;
+    /// Where the finished file ends up. While downloading, data goes to destination + ".part".
+    std::string destination;
+    /// Expected SHA-256 as hex; may be "", in which case the download is not verified.
+    std::string sha256;
+    /// Expected size in bytes; 0 if unknown.
+    size_t size = 0;
+};
+
+/// Small wrapper around libcurl. All transfers of one client share a connection cache, so requests
+/// to the same server reuse keep-alive connections.
+class HttpClient {
+public:
+    HttpClient();
+    ~HttpClient();
+    HttpClient(const HttpClient&) = delete;
+    HttpClient& operator=(const HttpClient&) = delete;
+
+    /// Fetch a (small) resource into memory.
+    bool fetch(const std::string& url, std::string& out);
+
+    /// Download several files, running at most parallel_limit transfers at once.
+    /// Partial downloads left behind by an earlier run are resumed with range requests, and every file is
+    /// hashed while it streams in; a file whose hash does not match is deleted and reported as failed.
+    /// \return If true, all files are now present at their destination.
+    bool download(const std::vector<HttpDownload>& downloads, size_t parallel_limit);
+private:
+    void* acquireHandle();
+    void releaseHandle(void* handle);
+
+    void* multi;    // CURLM*, which owns the connection cache
+    std::vector<void*> idle_handles; // CURL*, reused between transfers
+};
+
+#endif //BVPM_HTTPCLIENT_H
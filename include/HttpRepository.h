@@ -0,0 +1,43 @@
+#ifndef BVPM_HTTPREPOSITORY_H
+#define BVPM_HTTPREPOSITORY_H
+
+#include <Repository.h>
+#include <RepositoryIndex.h>
+#include <HttpClient.h>
+
+/// A repository served over HTTP(S). The server only has to serve the files of a local folder repository
+/// (repo.manifest, repo.index and packages/), so any static web server pointed at one can stand in for it.
+/// All metadata comes out of repo.index, which is fetched once; bvp files are downloaded into a cache folder.
+class HttpRepository : public Repository {
+public:
+    HttpRepository(std::string name, std::string _url, std::string _cache_path, size_t _parallel_downloads);
+    bool good() override { return _good; }
+    bool checkIfPackageIsAvailable(const std::string& package_name) override;
+    bool preparePackage(const std::string& package) override;
+    bool preparePackages(const std::vector<std::string>& packages) override;
+    bool packageGood(const std::string& package_name) override;
+    std::string getPackageBVPFilePath(const std::string& package_name) override;
+    std::string getPackageVersion(const std::string& package_name) override;
+    size_t getPackageFileSize(const std::string& package_name) override;
+    size_t getPackageTotalSize(const std::string& package_name) override;
+    std::vector<std::string> getPackageDependencies(const std::string& package_name) override;
+    std::string getPackageHash(const std::string& package_name) override;
+    bool getPackageClosure(const std::string& package_name, std::vector<std::string>& closure) override;
+    bool getPackageFiles(const std::string& package_name, std::vector<RepositoryFile>& files) override;
+    bool listPackages(std::vector<std::pair<std::string, std::string>>& packages) override;
+private:
+    std::string packageURL(const RepositoryIndexEntry& entry) const;
+    std::string packageCachePath(const RepositoryIndexEntry& entry) const;
+
+    bool _good = true;
+    std::string url;
+    std::string cache_path;
+    size_t parallel_downloads;
+    RepositoryIndex index;
+    RepositoryFileIndex file_index;
+    /// repo.files is only fetched once, the first time a file list is asked for, whether that worked or not
+    bool file_index_fetched = false;
+    HttpClient client;
+};
+
+#endif //BVPM_HTTPREPOSITORY_H
@@ -0,0 +1,68 @@
+#ifndef BVPM_IMAGEWRITER_H
+#define BVPM_IMAGEWRITER_H
+
+#include <ctime>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <sys/types.h>
+#include <DiskWriter.h>
+#include <BufferPool.h>
+
+/// Writes what would be installed under a root folder into an image archive instead, for bvpm -i --image.
+/// Entries are named relative to the root, and their data is streamed from the package straight into the
+/// image, so nothing is written to the root itself. Every folder in the image gets an entry of its own, even
+/// if no package has one for it. Files are owned by root, as they would be after an install by root.
+///
+/// The format and compression follow the extension of the image: .tar, .tar.gz, .tar.xz, .tar.zst, .cpio,
+/// .iso, .zip and whatever else libarchive knows; anything else is written as a plain tar. The image is written
+/// under a temporary name and only renamed to its own once finish() succeeded.
+class ImageWriter : public DiskWriter {
+public:
+    /// \param root Where the entries given to writeEntry() and writeFolder() would otherwise be installed
+    ImageWriter(const std::string& root, std::string image);
+    ~ImageWriter() override;
+    ImageWriter(const ImageWriter&) = delete;
+    ImageWriter& operator=(const ImageWriter&) = delete;
+
+    /// \return If false, the image could not be created; the error has been printed.
+    bool open();
+    bool writeEntry(struct archive* a, struct archive_entry* entry) override;
+    void writeFolder(const std::string& path) override;
+    /// Remember the state of everything under the root, for addChangedFiles() to compare against.
+    void recordRoot();
+    /// Add everything under the root that was created or changed since recordRoot(), like the files after install
+    /// scripts wrote. They come after the package entries they replace, and win when the image is unpacked.
+    /// Files the scripts removed are still in the image.
+    bool addChangedFiles();
+    /// Finish the image and move it into place.
+    bool finish() override;
+
+private:
+    /// The path of the entry in the image, or "" if it is not under the root
+    std::string imagePath(const std::string& path) const;
+    /// Write an entry for every parent folder of path that is not in the image yet
+    void writeParents(const std::string& path);
+    bool writeHeader(struct archive_entry* entry);
+    bool writeData(const char* data, size_t size);
+
+    std::string root_prefix;
+    std::string image_path;
+    std::string temporary_path;
+    struct archive* out = nullptr;
+    std::unordered_set<std::string> folders;
+    /// What recordRoot() saw of a path. A file that was written again has another ctime, or, within the same clock
+    /// tick, most likely another size, mtime or inode.
+    struct FileState {
+        ino_t inode;
+        mode_t mode;
+        off_t size;
+        struct timespec mtime;
+        struct timespec ctime;
+    };
+    std::unordered_map<std::string, FileState> recorded;
+    PooledBuffer buffer;
+    bool failed = false;
+};
+
+#endif //BVPM_IMAGEWRITER_H
@@ -7,35 +7,77 @@
 
 #include <string>
 #include <vector>
+#include <map>
 #include <archive.h>
 #include <archive_entry.h>
 #include <config.h>
 #include <DependencyEngine.h>
 #include <PackageFile.h>
+#include <ArchiveReader.h>
+#include <DiskWriter.h>
+#include <Triggers.h>
 #include "RepositoryEngine.h"
 
 class InstallEngine {
 public:
-    InstallEngine(const std::string root, ConfigFile global_config_file) : dependencyEngine(root), repositoryEngine(global_config_file, root),
-                                                                           install_root(root) { }
+    InstallEngine(const std::string root, ConfigFile global_config_file);
 
     bool AddPackageFile(std::string package);
     bool AddPackage(const std::string& package_file);
+    /// Add every installed package the repositories have a newer version of (see Version), for bvpm --upgrade-all.
+    /// The upgrades are resolved by VerifyPossible() and installed by Execute() together, like any other install.
+    /// \return The number of packages added.
+    size_t AddUpgrades();
     bool VerifyPossible();
+    /// Write the install VerifyPossible() resolved to a plan file, see InstallPlan.
+    bool WritePlan(const std::string& file);
+    /// Take the packages to install from a plan file instead of AddPackage(), AddPackageFile() and VerifyPossible().
+    /// Nothing is resolved; the packages the plan was resolved against have to be installed as they were then, and the
+    /// repositories and package files have to hold the same packages.
+    /// \return If false, the plan can not be applied here; the reasons have been printed.
+    bool LoadPlan(const std::string& file);
     bool VerifyIntegrity();
     bool Execute();
+    /// Write the packages into an image archive at path instead of installing them, see ImageWriter. The install
+    /// root is then only a scratch root: it has to be empty, and is only written to if after install scripts have
+    /// to be run.
+    void SetImage(const std::string& path) { image_path = path; }
     bool GetUserPermission();
 
-    bool empty() { return package_list.empty() && packages_by_name_list.empty(); }
+    bool empty() { return package_list.empty() && packages_by_name_list.empty() && all_packages_to_install.empty(); }
 
     DependencyEngine dependencyEngine;
     RepositoryEngine repositoryEngine;
 private:
+    bool CheckConflicts(const PackageFile& package);
+    /// Check the packages from the repositories for conflicts, and work out what upgrades change, from the file lists
+    /// in the repositories, before anything is downloaded. Packages without a file list are not checked.
+    bool CheckRepositoryPackages();
+    bool ExecuteImage();
+    /// Write the folders, files and metadata of every package through writer, list those with after install scripts,
+    /// and mark the triggers their files match
+    void WritePackages(DiskWriter& writer, std::vector<const PackageFile*>& afterinstall_script_list);
+    /// Record the triggers and owned files of the packages just written in the trigger and owner indexes of the
+    /// install root
+    void UpdateIndexes();
+    void RunAfterInstallScripts(const std::vector<const PackageFile*>& afterinstall_script_list);
 
     const std::string install_root;
+    /// Packages with more entries than this are installed in streaming mode (see PackageFile::streaming_threshold)
+    size_t streaming_threshold = 100000;
+    ArchiveIO archive_io = ArchiveIO::Auto;
+    DiskWriterBackend disk_writer = DiskWriterBackend::Auto;
+    std::string image_path;
     std::vector<PackageFile> package_list;
     std::vector<std::string> packages_by_name_list;
     std::vector<SimplePackageData> all_packages_to_install;
+    /// Packages that were asked for, but left out as they are installed at the same version already
+    std::vector<std::string> already_installed;
+    /// What installing each package changes in the files of its installed version, for the packages that are
+    /// installed already and whose file list the repository has
+    std::map<std::string, std::string> upgrade_changes;
+    /// The triggers of the installed packages and of those being installed
+    TriggerSet triggers;
 };
 
 
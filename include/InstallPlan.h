@@ -0,0 +1,44 @@
+#ifndef BVPM_INSTALLPLAN_H
+#define BVPM_INSTALLPLAN_H
+
+#include <string>
+#include <vector>
+
+/// An installed package the plan was resolved against: which version it had, or that it was not installed
+struct InstallPlanState {
+    std::string name;
+    bool installed = false;
+    std::string version;
+};
+
+/// One package of the plan, in install order
+struct InstallPlanStep {
+    std::string name;
+    std::string version;
+    size_t installed_size = 0;
+    size_t file_size = 0;
+    std::vector<std::string> dependencies;
+    /// The bvp file the package was given as, or "" if it comes from the repositories
+    std::string file;
+    /// SHA-256 of the bvp file, as hex; "" if the repository had no hash for it
+    std::string sha256;
+};
+
+/// A resolved install, written with bvpm -i --write-plan and run with --apply-plan, so that hosts with the same
+/// packages installed all install exactly the same packages, without resolving dependencies again.
+///
+/// The format is line based, like repo.index: the first line is "BVPM-PLAN 1", followed by tab separated lines.
+/// "state" lines hold the name, whether it was installed (1 or 0) and the version of every package the resolution
+/// depended on: the packages installed, their dependencies that were installed already, and the packages skipped
+/// because they were installed already. "install" lines hold the name, version, installed size, file size, comma
+/// separated dependencies, file and sha256 of every package to install, in install order.
+class InstallPlan {
+public:
+    bool readFromFile(const std::string& file);
+    bool writeToFile(const std::string& file) const;
+
+    std::vector<InstallPlanState> state;
+    std::vector<InstallPlanStep> steps;
+};
+
+#endif //BVPM_INSTALLPLAN_H
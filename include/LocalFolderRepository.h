@@ -6,28 +6,72 @@
 #define BVPM_LOCALFOLDERREPOSITORY_H
 
 #include <Repository.h>
+#include <RepositoryIndex.h>
+#include <RepositoryQueryIndex.h>
+#include <FileLock.h>
 
 #include <utility>
 #include "config.h"
 
 class LocalFolderRepository : public Repository {
 public:
-    LocalFolderRepository(std::string name, std::string _path);
+    /// \param for_writing If set, the repository is locked exclusively for as long as this object lives, so that it can
+    /// be changed. Otherwise it is only locked (shared) while repo.index is read, and from preparePackage() on.
+    LocalFolderRepository(std::string name, std::string _path, bool for_writing = false);
 
     bool good() override;
 
     bool checkIfPackageIsAvailable(const std::string& package_name) override;
-    bool preparePackage(const std::string& package) override { return true; }
+    /// Lock the repository for reading until this object goes away, so that bvpm-repo can not change or remove the
+    /// package files while they are being installed.
+    /// \return If false, repo.index was changed since it was read; the index in memory can not be trusted anymore.
+    bool preparePackage(const std::string& package) override;
     std::string getPackageBVPFilePath(const std::string& package_name) override;
     std::string getPackageVersion(const std::string& package_name) override;
     size_t getPackageFileSize(const std::string& package_name) override;
     size_t getPackageTotalSize(const std::string& package_name) override;
     std::vector<std::string> getPackageDependencies(const std::string& package_name) override;
+    std::string getPackageHash(const std::string& package_name) override;
+    bool getPackageClosure(const std::string& package_name, std::vector<std::string>& closure) override;
+    bool getPackageFiles(const std::string& package_name, std::vector<RepositoryFile>& files) override;
+    bool listPackages(std::vector<std::pair<std::string, std::string>>& packages) override;
 
     bool addPackageFileToRepository(const std::string& package_file) override;
+    /// Add many package files at once. The packages are read and hashed on up to jobs threads, and repo.index is
+    /// written once, after the last one. Package files are stored as a reflink where the filesystem can do that,
+    /// as a hard link to the original if allow_hardlink is set, and copied otherwise.
+    /// If the same package name shows up more than once, the last file wins.
+    /// \return If false, at least one package could not be added; the others have been.
+    bool addPackageFilesToRepository(const std::vector<std::string>& package_files, unsigned jobs, bool allow_hardlink = false);
     bool removePackageFromRepository(const std::string& package_name) override;
     ConfigFile getManifestFile(const std::string& package_name);
+    /// Write the in-memory index out to repo.index, and repo.query and repo.files next to it.
+    bool writeIndex();
+    /// Write repo.query for the current repo.index.
+    bool writeQueryIndex();
+    /// Open the repo.query file of the repository at path, writing it first if it is missing or out of date.
+    static bool openQueryIndex(const std::string& path, RepositoryQueryIndex& query_index);
+    /// Regenerate the in-memory index from the per-package manifests.
+    void rebuildIndex();
+    /// Train a zstd dictionary on the packages whose file is at most max_package_size bytes, store it as
+    /// dictionaries/<ID>.zdict, list it in repo.manifest, and compress those packages again with it at level, on up
+    /// to jobs threads. Packages that would not get smaller keep their file. The sizes with and without the
+    /// dictionary are printed.
+    /// \return If false, the error has been printed; packages that were compressed again before it stay that way.
+    bool trainDictionary(size_t max_package_size, size_t dictionary_size, int level, unsigned jobs);
 private:
+    const RepositoryIndexEntry* findPackage(const std::string& package_name);
+    /// Delete the manifest and package file folders of a package, and drop it from the in-memory index
+    void removePackageFolders(const std::string& package_name);
+    /// Read repo.files, the first time the file lists are needed
+    void loadFileIndex();
+    /// Identifies the repo.index that was read, so that changes to it can be noticed
+    std::string indexIdentity() const;
+    RepositoryIndex index;
+    RepositoryFileIndex file_index;
+    bool file_index_loaded = false;
+    std::string index_identity;
+    FileLock lock;
     bool _good = true; // By default, we consider the repo to be good, and set it to false in case of an error
 
     std::string path_str;
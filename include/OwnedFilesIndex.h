@@ -0,0 +1,31 @@
+#ifndef BVPM_OWNEDFILESINDEX_H
+#define BVPM_OWNEDFILESINDEX_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+/// A sorted view of an installed package's owned-files list, for membership checks. The list is mapped instead
+/// of read, so the paths themselves stay in the page cache, and only 8 bytes per line are kept in memory.
+class OwnedFilesIndex {
+public:
+    /// A missing or unreadable list gives an empty index.
+    explicit OwnedFilesIndex(const std::string& path);
+    ~OwnedFilesIndex();
+    OwnedFilesIndex(const OwnedFilesIndex&) = delete;
+    OwnedFilesIndex& operator=(const OwnedFilesIndex&) = delete;
+
+    bool contains(std::string_view path) const;
+    size_t size() const { return lines.size(); }
+private:
+    std::string_view line(const std::pair<uint32_t, uint32_t>& entry) const { return {data + entry.first, entry.second}; }
+
+    const char* data = nullptr;
+    size_t data_size = 0;
+    /// (offset, length) of every line, sorted by the line
+    std::vector<std::pair<uint32_t, uint32_t>> lines;
+};
+
+#endif //BVPM_OWNEDFILESINDEX_H
@@ -0,0 +1,38 @@
+#ifndef BVPM_OWNERINDEX_H
+#define BVPM_OWNERINDEX_H
+
+#include <set>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/// Which installed packages own which paths, kept in ROOT/var/lib/bvpm/owners, so that finding the owners of a path
+/// does not read the owned-files list of every installed package. A line per owned path: the path and the package,
+/// separated by a tab, sorted by path, after a "BVPM-OWNERS 1" line. It is mapped and binary searched in place.
+///
+/// Roots without one get it from the owned-files lists the first time it is needed.
+class OwnerIndex {
+public:
+    explicit OwnerIndex(std::string _root);
+    ~OwnerIndex();
+    OwnerIndex(const OwnerIndex&) = delete;
+    OwnerIndex& operator=(const OwnerIndex&) = delete;
+
+    /// Get the packages owning path, an absolute path inside the install root, in the order of their names.
+    std::vector<std::string> owners(std::string_view path);
+    /// Record in the owner index of root that the packages in installed were installed or upgraded, and those in
+    /// removed were uninstalled. The owned-files lists of the installed packages have to be in place already.
+    static void updateInstalled(const std::string& root, const std::set<std::string>& installed, const std::set<std::string>& removed);
+private:
+    /// Map the index, writing it first if the root has none.
+    bool load();
+
+    std::string root;
+    bool loaded = false;
+    const char* data = nullptr;
+    size_t data_size = 0;
+    /// Offset of the first line after the header
+    size_t lines_start = 0;
+};
+
+#endif //BVPM_OWNERINDEX_H
@@ -5,10 +5,13 @@
 #ifndef BVPM_PACKAGEFILE_H
 #define BVPM_PACKAGEFILE_H
 
+#include <cstdint>
 #include <string>
 #include <vector>
 #include <map>
 #include <config.h>
+#include <PathTable.h>
+#include <ArchiveReader.h>
 
 
 /// This is a simplified version of PackageFile, without a file actually backing it.
@@ -27,12 +30,31 @@ struct SimplePackageData {
     bool from_file = false;
 };
 
+/// The metadata of a bvp file. The file lists can be very large, so they are kept in PathTables, and a
+/// PackageFile can only be moved, not copied.
 struct PackageFile {
+    PackageFile() = default;
+    PackageFile(PackageFile&&) = default;
+    PackageFile& operator=(PackageFile&&) = default;
+    PackageFile(const PackageFile&) = delete;
+    PackageFile& operator=(const PackageFile&) = delete;
+
     bool readFile(std::string file, std::string display_name = "");
 
-    struct archive* a;
-    std::vector<std::string> folders;
-    std::vector<std::string> files;
+    /// The package's archive while it is being installed; readFile() only opens it for as long as it reads
+    ArchiveHandle a;
+    ArchiveIO archive_io = ArchiveIO::Auto;
+    /// Packages with more entries than this are read in streaming mode: files, folders, owned_files and
+    /// file_hashes are left empty, so that reading the package takes the same memory however large it is.
+    /// Only the counts are kept, and everything else has to be done entry by entry while going through the archive.
+    size_t streaming_threshold = SIZE_MAX;
+    bool streaming = false;
+    /// Print a progress line for every entry; turned off when several packages are read at the same time.
+    bool show_progress = true;
+    size_t file_count = 0;
+    size_t folder_count = 0;
+    PathTable folders;
+    PathTable files;
     std::string name;
     std::string version = "";
     std::string path;
@@ -43,10 +65,12 @@ struct PackageFile {
 
     bool has_after_install = false;
     std::vector<std::string> dependencies;
-    std::vector<std::string> owned_files;
-    std::map<std::string, std::string> file_hashes;
+    PathTable owned_files;
+    FileDigests file_hashes;
 
     [[nodiscard]] SimplePackageData toSimplePackageData() const;
+private:
+    void startStreaming();
 };
 
 #endif //BVPM_PACKAGEFILE_H
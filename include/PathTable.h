@@ -0,0 +1,77 @@
+#ifndef BVPM_PATHTABLE_H
+#define BVPM_PATHTABLE_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/// A list of paths, stored compactly. Every path is split into its directory and its base name; directories
+/// are interned, so a folder shared by thousands of files is stored once. All characters live in a chunked
+/// arena that never moves, and an entry is a pointer into it plus two 32 bit numbers.
+/// A package with 200k files takes a few megabytes this way, instead of 200k separately allocated std::strings.
+/// The table can be moved, but not copied.
+class PathTable {
+public:
+    PathTable() = default;
+    PathTable(PathTable&&) = default;
+    PathTable& operator=(PathTable&&) = default;
+    PathTable(const PathTable&) = delete;
+    PathTable& operator=(const PathTable&) = delete;
+
+    void add(std::string_view path);
+    size_t size() const { return entries.size(); }
+    bool empty() const { return entries.empty(); }
+    void clear();
+
+    /// Write path number i into out, replacing its contents.
+    void get(size_t i, std::string& out) const;
+    std::string get(size_t i) const;
+
+    /// Call f(const std::string& path) for every path, in the order they were added. The string is reused.
+    template<typename F>
+    void forEach(F f) const {
+        std::string path;
+        for(size_t i = 0; i < entries.size(); i++) {
+            get(i, path);
+            f(path);
+        }
+    }
+
+private:
+    const char* store(std::string_view data);
+
+    struct Entry {
+        const char* name;
+        uint32_t name_length;
+        uint32_t directory;
+    };
+    std::vector<Entry> entries;
+    std::vector<std::string_view> directories;
+    std::unordered_map<std::string_view, uint32_t> directory_index;
+
+    std::vector<std::unique_ptr<char[]>> chunks;
+    size_t chunk_used = 0;
+    size_t chunk_size = 0;
+};
+
+/// The file digests from a package's sums file: paths in a PathTable, digests as raw bytes next to it.
+class FileDigests {
+public:
+    /// Add a digest given as hex. All digests of a package have to have the same length.
+    /// \return If false, the hex was malformed, and nothing was added.
+    bool add(std::string_view path, std::string_view hex);
+    size_t size() const { return paths.size(); }
+    size_t digestSize() const { return digest_size; }
+    const uint8_t* digest(size_t i) const { return digests.data() + i * digest_size; }
+    std::string hex(size_t i) const;
+
+    PathTable paths;
+private:
+    std::vector<uint8_t> digests;
+    size_t digest_size = 0;
+};
+
+#endif //BVPM_PATHTABLE_H
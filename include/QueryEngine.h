@@ -0,0 +1,60 @@
+#ifndef BVPM_QUERYENGINE_H
+#define BVPM_QUERYENGINE_H
+
+#include <ostream>
+#include <string>
+#include <vector>
+#include <config.h>
+
+/// Answers -q without an InstallEngine. Nothing is loaded up front: an exact query reads one manifest,
+/// a search lists the package folders and only reads the manifests of the matches, and the repositories
+/// are only opened when a search asks for them.
+class QueryEngine {
+public:
+    enum class Format { Text, TSV, JSON };
+
+    QueryEngine(std::string root, ConfigFile global_config_file, Format _format, std::ostream& _out)
+        : install_root(std::move(root)), config(std::move(global_config_file)), format(_format), out(_out) { }
+
+    static bool parseFormat(const std::string& name, Format& format);
+    static std::string jsonString(const std::string& value);
+    /// Everything in front of the first wildcard; all names matching the pattern start with this.
+    static std::string literalPrefix(const std::string& pattern);
+    static bool isGlob(const std::string& pattern);
+
+    /// Print the versions of installed packages.
+    /// \return The number of packages that are not installed.
+    int Query(const std::vector<std::string>& packages);
+    /// Print the installed packages (and, with include_repositories, the available ones) matching any of the patterns.
+    /// A pattern is a glob; a pattern without wildcards matches every name starting with it.
+    /// \return 0 if anything matched, 1 otherwise.
+    int Search(const std::vector<std::string>& patterns, bool include_repositories);
+    /// Print the files owned by installed packages.
+    /// \return The number of packages that are not installed.
+    int ListFiles(const std::vector<std::string>& packages);
+    /// Print which installed packages own the paths. Absolute paths are inside the install root; relative paths are
+    /// taken from the current directory, and are inside the install root if the resulting path is in it.
+    /// \return The number of paths no package owns.
+    int Owns(const std::vector<std::string>& paths);
+
+private:
+    struct Match {
+        std::string name;
+        std::string version;
+        std::string source;
+    };
+
+    const std::vector<std::string>& InstalledNames();
+    bool ReadInstalledVersion(const std::string& name, std::string& version);
+    void PrintMatches(const std::vector<Match>& matches);
+
+    std::string install_root;
+    ConfigFile config;
+    Format format;
+    std::ostream& out;
+    /// Names of the installed packages, sorted, so that a prefix is a contiguous range
+    std::vector<std::string> installed_names;
+    bool installed_names_loaded = false;
+};
+
+#endif //BVPM_QUERYENGINE_H
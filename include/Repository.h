@@ -8,6 +8,7 @@
 #include <string>
 #include <vector>
 #include <utility>
+#include <RepositoryFileIndex.h>
 
 class Repository {
 public:
@@ -30,6 +31,22 @@ public:
     virtual size_t getPackageFileSize(const std::string& package_name) { return 0; }
 
     virtual std::vector<std::string> getPackageDependencies(const std::string& package_name) { return {}; }
+    /// Get the SHA-256 of the bvp file of a package, as hex.
+    /// \param package_name The package name.
+    /// \return The hash, or "" if the repository does not know it.
+    virtual std::string getPackageHash(const std::string& package_name) { return ""; }
+
+    /// Get every package a package depends on, directly or not, in install order and followed by the package
+    /// itself, as bvpm-repo worked it out when the package was added. This function can be called before preparePackages()
+    /// \param package_name The package name.
+    /// \return If false, the repository does not know the closure; the dependencies have to be followed one by one.
+    virtual bool getPackageClosure(const std::string& package_name, std::vector<std::string>& closure) { return false; }
+
+    /// Get the files a package installs, with their hashes, as bvpm-repo recorded them when the package was added.
+    /// This function can be called before preparePackages(); remote repositories fetch their file index the first time.
+    /// \param package_name The package name.
+    /// \return If false, the repository has no file list for the package.
+    virtual bool getPackageFiles(const std::string& package_name, std::vector<RepositoryFile>& files) { return false; }
 
     /// Get the path to a bvp file for a specific package. Call preparePackages() before using this function.
     /// \param package_name The package name.
@@ -40,6 +57,14 @@ public:
     /// \param packages List of packages to e.g. download
     /// \return If true, the package got prepared successfully. If false, then there was a critical error.
     virtual bool preparePackage(const std::string& package) { return false; }
+    /// Prepare several packages at once. Repositories that can e.g. download in parallel should override this.
+    /// \param packages List of packages to prepare
+    /// \return If true, all packages got prepared successfully.
+    virtual bool preparePackages(const std::vector<std::string>& packages) {
+        bool ret = true;
+        for(const std::string& package : packages) { ret = preparePackage(package) && ret; }
+        return ret;
+    }
 
     /// Check if the repository is not e.g. corrupted, unreachable, or unusable
     /// \return If true, this repository is not bad. This does not mean that packages themselves are not corrupt
@@ -60,6 +85,11 @@ public:
     /// \return If true, the package has been removed from the repository. Network-backed repositories must always return false.
     virtual bool removePackageFromRepository(const std::string& package_name) { return false; }
 
+    /// List every package in this repository with its version, so that the RepositoryEngine can build its lookup table.
+    /// \param packages Gets (name, version) pairs appended to it.
+    /// \return If false, this repository cannot list its packages, and has to be asked about each package instead.
+    virtual bool listPackages(std::vector<std::pair<std::string, std::string>>& packages) { return false; }
+
     std::string getName() { return name; }
 
 protected:
@@ -8,28 +8,56 @@
 #include <config.h>
 #include <Repository.h>
 #include <PackageFile.h>
+#include <tuple>
+#include <unordered_map>
 
 class RepositoryEngine {
 public:
     explicit RepositoryEngine(const ConfigFile& globalConfigFile, std::string _install_root);
+    ~RepositoryEngine();
+    RepositoryEngine(const RepositoryEngine&) = delete;
+    RepositoryEngine& operator=(const RepositoryEngine&) = delete;
 
     bool isPackageInRepos(const std::string& package_name);
     std::string getPackageVersion(const std::string& package_name);
 
     bool preparePackage(const std::string& package_name);
+    bool preparePackages(const std::vector<std::string>& packages);
     std::string getBVPFileForPackage(const std::string& package_name);
     size_t getPackageFileSize(const std::string& package_name);
     size_t getPackageTotalSize(const std::string& package_name);
     std::vector<std::string> getPackageDependencies(const std::string& package_name);
+    std::string getPackageHash(const std::string& package_name);
+    /// Get the closure of a package (see Repository::getPackageClosure()). It is only used if every package in it
+    /// would come from the same repository as the package itself, as the closure is only right for that repository.
+    bool getPackageClosure(const std::string& package_name, std::vector<std::string>& closure);
+    /// Get the files of a package from the repository it would be installed from (see Repository::getPackageFiles()).
+    bool getPackageFiles(const std::string& package_name, std::vector<RepositoryFile>& files);
     SimplePackageData getSimplePackageData(const std::string& package_name);
+    /// Append every package in the lookup table as (name, version, repository name).
+    /// Packages of repositories that cannot list their packages are not included.
+    void listPackages(std::vector<std::tuple<std::string, std::string, std::string>>& packages);
 
     bool GetUserPermission(const std::vector<std::string>& packages);
 private:
     Repository* findBestRepoForPackage(const std::string& package_name);
+    void buildPackageTable();
 
+    struct PackageLocation {
+        Repository* repository;
+        std::string version;
+    };
+
+    /// Repositories, sorted by priority (highest first)
     std::vector<Repository*> repositories;
+    /// Every package any repository can list, mapped to the highest priority repository that has it
+    std::unordered_map<std::string, PackageLocation> package_table;
+    /// Repositories that can not list their packages; these still get asked package by package
+    std::vector<Repository*> unlisted_repositories;
 
     std::string install_root;
+    std::string cache_path;
+    size_t parallel_downloads = 4;
 };
 
 
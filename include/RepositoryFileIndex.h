@@ -0,0 +1,50 @@
+#ifndef BVPM_REPOSITORYFILEINDEX_H
+#define BVPM_REPOSITORYFILEINDEX_H
+
+#include <istream>
+#include <map>
+#include <string>
+#include <vector>
+#include <RepositoryIndex.h>
+
+/// A file a repository package installs
+struct RepositoryFile {
+    /// Relative to the install root, without a leading slash, like the members below root/ in the package
+    std::string path;
+    /// SHA-256 of the contents, as hex, from the package's sums file; "" if the package has no sum for it
+    std::string sha256;
+};
+
+/// The repo.files file: the files every package of a repository installs, with their hashes, so that bvpm can check
+/// for conflicts and work out what an upgrade changes before any package is downloaded or decompressed. It sits next
+/// to repo.index rather than in it, as it is many times bigger and only installs need it.
+///
+/// The format is line based: the first line is "BVPM-FILES 1". Every package starts with a line of "@" followed by
+/// its name, the SHA-256 of its bvp file and its number of files, separated by tabs. A line per file follows, sorted
+/// by path, with the number of leading bytes the path shares with the one before it, the rest of the path, and the
+/// hash of the file. The file list of a package is only used while its bvp file hash matches repo.index.
+class RepositoryFileIndex {
+public:
+    bool readFromStream(std::istream& stream);
+    bool readFromFile(const std::string& file);
+    /// Write the file lists of the packages in index whose bvp file hash matches it; the others are dropped.
+    bool writeToFile(const std::string& file, const RepositoryIndex& index) const;
+
+    /// Set the files of a package, with the SHA-256 of its bvp file.
+    void setFiles(const std::string& name, const std::string& package_sha256, std::vector<RepositoryFile> files);
+    /// The bvp file of a package was replaced by one with the same files in it.
+    void setPackageHash(const std::string& name, const std::string& package_sha256);
+    /// \return If false, there is no file list for the package with this bvp file hash.
+    bool getFiles(const std::string& name, const std::string& package_sha256, std::vector<RepositoryFile>& files) const;
+
+private:
+    struct Package {
+        std::string sha256;
+        size_t count = 0;
+        /// The file lines, front coded as in the file
+        std::string lines;
+    };
+    std::map<std::string, Package> packages;
+};
+
+#endif //BVPM_REPOSITORYFILEINDEX_H
@@ -0,0 +1,53 @@
+#ifndef BVPM_REPOSITORYINDEX_H
+#define BVPM_REPOSITORYINDEX_H
+
+#include <cstdint>
+#include <istream>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+struct RepositoryIndexEntry {
+    std::string name;
+    std::string version;
+    size_t installed_size = 0;
+    size_t file_size = 0;
+    std::vector<std::string> dependencies;
+    /// The bvp file name, relative to packages/<name>/ in the repository.
+    std::string filename;
+    /// SHA-256 of the bvp file, as hex. May be "" for packages added before hashes were recorded.
+    std::string sha256;
+    /// The IDs (see RepositoryIndex::names_by_id) of every package this one depends on, directly or not, in install
+    /// order, followed by this package itself. Empty if some dependency is not in the index, or it was not computed.
+    std::vector<uint32_t> closure;
+};
+
+/// The repo.index file, a single file describing every package in a repository, so that a repository
+/// can be loaded with one read (or one HTTP request) instead of one per package.
+///
+/// The format is line based: the first line is "BVPM-INDEX 2", and each following line is one package, with
+/// the fields name, version, installed size, file size, comma separated dependencies, file name, sha256 and the
+/// comma separated closure separated by tabs. The ID of a package is the number of its line, starting at 0 for
+/// the line after the header. "BVPM-INDEX 1" indexes, without closures, are read as well.
+class RepositoryIndex {
+public:
+    bool readFromStream(std::istream& stream);
+    bool readFromFile(const std::string& file);
+    bool writeToFile(const std::string& file) const;
+
+    const RepositoryIndexEntry* find(const std::string& name) const;
+    /// Get the names of the packages in the closure of a package (see RepositoryIndexEntry::closure).
+    /// \return If false, the closure of the package is not known.
+    bool getClosure(const std::string& name, std::vector<std::string>& closure) const;
+    /// Bring the closures up to date after the packages in changed were added, replaced or removed. Only the
+    /// closures of those packages, of the packages whose closure held one of them, and of the packages that had no
+    /// closure are computed again; the others are only renumbered.
+    void updateClosures(const std::set<std::string>& changed);
+
+    std::map<std::string, RepositoryIndexEntry> packages;
+    /// The package names by ID, as the closures number them
+    std::vector<std::string> names_by_id;
+};
+
+#endif //BVPM_REPOSITORYINDEX_H
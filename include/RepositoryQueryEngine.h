@@ -0,0 +1,38 @@
+#ifndef BVPM_REPOSITORYQUERYENGINE_H
+#define BVPM_REPOSITORYQUERYENGINE_H
+
+#include <ostream>
+#include <string>
+#include <vector>
+#include <QueryEngine.h>
+#include <RepositoryQueryIndex.h>
+
+/// Answers bvpm-repo -q from a repository's repo.query file, without reading repo.index or any manifest.
+class RepositoryQueryEngine {
+public:
+    RepositoryQueryEngine(const RepositoryQueryIndex& _index, QueryEngine::Format _format, std::ostream& _out)
+        : index(_index), format(_format), out(_out) { }
+
+    /// Print the name and version of every package in the repository.
+    int List();
+    /// Print the packages matching any of the patterns. A pattern is a glob; a pattern without wildcards matches
+    /// every name starting with it.
+    /// \return 0 if anything matched, 1 otherwise.
+    int Search(const std::vector<std::string>& patterns);
+    /// Print everything the index knows about the packages.
+    /// \return The number of packages that are not in the repository.
+    int Show(const std::vector<std::string>& packages);
+    /// Print the packages in the repository that depend on the packages.
+    /// \return The number of packages that are not in the repository.
+    int ReverseDependencies(const std::vector<std::string>& packages);
+
+private:
+    void PrintList(const std::vector<size_t>& matches);
+    void NotFound(const std::string& package);
+
+    const RepositoryQueryIndex& index;
+    QueryEngine::Format format;
+    std::ostream& out;
+};
+
+#endif //BVPM_REPOSITORYQUERYENGINE_H
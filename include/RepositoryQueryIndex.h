@@ -0,0 +1,70 @@
+#ifndef BVPM_REPOSITORYQUERYINDEX_H
+#define BVPM_REPOSITORYQUERYINDEX_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <RepositoryIndex.h>
+
+/// The repo.query file: repo.index in a form that can be mapped and searched as it is, for bvpm-repo -q.
+/// Opening it only checks the bounds of what is in it, and nothing is parsed or copied, so that a query takes
+/// milliseconds even for repositories with tens of thousands of packages.
+///
+/// The file is a header, the packages sorted by name, all dependencies, all reverse dependencies (as package
+/// numbers) and finally all strings. The header records the size and time of the repo.index it was made from,
+/// and open() refuses a file that does not match the repo.index next to it anymore.
+class RepositoryQueryIndex {
+public:
+    static constexpr size_t npos = SIZE_MAX;
+
+    struct Package {
+        std::string_view name;
+        std::string_view version;
+        uint64_t installed_size;
+        uint64_t file_size;
+        std::string_view filename;
+        std::string_view sha256;
+    };
+
+    RepositoryQueryIndex() = default;
+    ~RepositoryQueryIndex();
+    RepositoryQueryIndex(const RepositoryQueryIndex&) = delete;
+    RepositoryQueryIndex& operator=(const RepositoryQueryIndex&) = delete;
+
+    /// Write the query file for index, which has been written to index_file.
+    static bool write(const RepositoryIndex& index, const std::string& index_file, const std::string& file);
+    /// \return If false, the file is missing, damaged or older than index_file, and has to be written again.
+    bool open(const std::string& file, const std::string& index_file);
+
+    size_t size() const { return package_count; }
+    Package package(size_t i) const;
+    /// \return The number of the package, or npos.
+    size_t find(std::string_view name) const;
+    /// \return The range of package numbers whose names start with prefix.
+    std::pair<size_t, size_t> prefixRange(std::string_view prefix) const;
+    size_t dependencyCount(size_t i) const;
+    std::string_view dependency(size_t i, size_t n) const;
+    /// The packages in this repository that depend on package i, by number, sorted.
+    size_t reverseDependencyCount(size_t i) const;
+    size_t reverseDependency(size_t i, size_t n) const;
+
+private:
+    struct Header;
+    struct StringRef;
+    struct Record;
+
+    std::string_view string(const StringRef& ref) const;
+    const Record& record(size_t i) const;
+
+    const char* data = nullptr;
+    size_t data_size = 0;
+    size_t package_count = 0;
+    const Record* records = nullptr;
+    const StringRef* dependencies = nullptr;
+    const uint32_t* reverse_dependencies = nullptr;
+    const char* strings = nullptr;
+    size_t strings_size = 0;
+};
+
+#endif //BVPM_REPOSITORYQUERYINDEX_H
@@ -0,0 +1,86 @@
+#ifndef BVPM_SEEKABLEZSTD_H
+#define BVPM_SEEKABLEZSTD_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/// The seek table of a file in the zstd seekable format: independent zstd frames, followed by a skippable frame
+/// listing the compressed and decompressed size of each. Plain zstd decoders (libarchive's too) skip the table and
+/// read such a file like any other multi-frame zstd file, so seekable packages stay installable everywhere.
+struct SeekTable {
+    struct Frame {
+        uint64_t compressed_offset;
+        uint32_t compressed_size;
+        uint64_t decompressed_offset;
+        uint32_t decompressed_size;
+    };
+    std::vector<Frame> frames;
+    uint64_t decompressed_size = 0;
+
+    /// Parse the seek table at the end of data.
+    /// \return If false, the data has no (valid) seek table; plain single-frame zstd files and tar files land here.
+    bool parse(const char* data, size_t size);
+};
+
+/// Decompresses the frames of a seekable zstd file on several threads, and hands the results out in order.
+/// Workers run at most a few frames ahead of the reader, so memory use is bounded by the frame size, not the file
+/// size. Frames that are skipped over before a worker got to them are never decompressed.
+class ParallelZstdReader {
+public:
+    /// The data has to stay valid while the reader exists. With threads at 0 or 1, frames are decompressed on the
+    /// calling thread, as they are read.
+    ParallelZstdReader(const char* data, SeekTable table, unsigned threads);
+    ~ParallelZstdReader();
+    ParallelZstdReader(const ParallelZstdReader&) = delete;
+    ParallelZstdReader& operator=(const ParallelZstdReader&) = delete;
+
+    /// The next block of decompressed data; valid until the next call to read() or skip().
+    /// \return The size of the block, 0 at the end, -1 if a frame could not be decompressed.
+    int64_t read(const char** block);
+    /// Skip up to request bytes of decompressed data.
+    /// \return The number of bytes skipped.
+    uint64_t skip(uint64_t request);
+
+private:
+    struct Slot {
+        std::vector<char> data;
+        bool done = false;
+        bool failed = false;
+    };
+
+    void work();
+    bool decompress(size_t frame, std::vector<char>& out);
+
+    const char* data;
+    SeekTable table;
+    std::vector<Slot> slots;
+    /// The frame read() returns next, and the offset into it that skip() left
+    size_t next_frame = 0;
+    uint64_t next_offset = 0;
+    /// The frame the last read() returned; its data stays alive until the next call
+    size_t held_frame = SIZE_MAX;
+    size_t next_to_start = 0;
+    size_t window;
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable work_available;
+    std::condition_variable frame_done;
+    bool stop = false;
+};
+
+class SeekableZstd {
+public:
+    static constexpr size_t default_frame_size = 1024 * 1024;
+
+    /// Compress a file into the seekable format, in independent frames of frame_size bytes of input.
+    /// \return If false, the error has been printed.
+    static bool compressFile(const std::string& input, const std::string& output, size_t frame_size = default_frame_size, int level = 3);
+};
+
+#endif //BVPM_SEEKABLEZSTD_H
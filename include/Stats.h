@@ -0,0 +1,49 @@
+#ifndef BVPM_STATS_H
+#define BVPM_STATS_H
+
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+
+/// Counters for how much work a run did. These are cheap enough to always be collected;
+/// --stats only controls whether they get printed. They count what actually happened: calls that were made, and
+/// files that were really created, removed or parsed, so that runs can be compared.
+class Stats {
+public:
+    enum Counter {
+        ArchivesOpened,
+        ArchiveBytesRead,       // Bytes read from the (possibly compressed) archive files
+        ArchiveBytesDecompressed, // Bytes of archive data after decompression
+        StoredBytesCopied,      // Bytes of uncompressed package members copied file to file by the kernel
+        FilesCreated,
+        DirectoriesCreated,
+        StatCalls,              // exists/is_directory/file_size probes on the filesystem
+        UnlinkCalls,            // Files and folders that were removed
+        ManifestsParsed,        // Package and repository manifests, as well as owned-files lists, that could be read
+        RepositoryLookups,      // Times a repository was asked whether it has a package
+        DependencyChecks,       // Dependency edges looked at by the DependencyEngine
+        FilesHashed,            // Installed files hashed by --verify
+        VerifyCacheHits,        // Installed files --verify did not hash, as they were unchanged since the last run
+        BuffersAllocated,       // Read buffers the BufferPool had to allocate, rather than reuse
+        TriggersRun,            // Manifest triggers run at the end of a transaction
+        CounterCount
+    };
+
+    static void add(Counter counter, uint64_t amount = 1) { counters[counter].fetch_add(amount, std::memory_order_relaxed); }
+    static uint64_t get(Counter counter) { return counters[counter].load(std::memory_order_relaxed); }
+
+    /// Number of operator new calls and bytes requested through them since startup.
+    static uint64_t allocationCount();
+    static uint64_t allocatedBytes();
+    /// Number of operator new allocations that were not deleted yet.
+    static uint64_t liveAllocations();
+    /// Peak resident set size of the process, in bytes.
+    static uint64_t peakRSS();
+
+    static void printTable(std::ostream& out);
+    static void printJSON(std::ostream& out);
+private:
+    static std::atomic<uint64_t> counters[CounterCount];
+};
+
+#endif //BVPM_STATS_H
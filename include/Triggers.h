@@ -0,0 +1,50 @@
+#ifndef BVPM_TRIGGERS_H
+#define BVPM_TRIGGERS_H
+
+#include <set>
+#include <string>
+#include <vector>
+#include <config.h>
+
+/// Commands that run once at the end of a transaction, if any file it installed or removed matches their patterns,
+/// instead of once for every package from its after install script, like ldconfig or rebuilding a cache.
+///
+/// Packages declare them in their manifest as TRIGGER_<name>=<patterns>:<command>. The patterns are comma separated
+/// shell patterns (see fnmatch) for absolute paths, where * also matches slashes; the command is run with /bin/sh -c,
+/// chrooted into the install root. Triggers with the same name and command are the same trigger, however many
+/// packages declare them, so they run once.
+///
+/// The triggers of the installed packages are kept in ROOT/var/lib/bvpm/triggers, so that a transaction finds them
+/// without reading every installed manifest. Roots without one get it from their manifests the first time.
+class TriggerSet {
+public:
+    /// Add the TRIGGER_ entries of a package manifest.
+    void addManifest(const ConfigFile& manifest);
+    /// Add the triggers of every package installed under root, except those in skip.
+    void addInstalled(const std::string& root, const std::set<std::string>& skip = {});
+    /// Record in the trigger index of root that the packages of installed were installed or upgraded, and those in
+    /// removed were uninstalled.
+    static void updateInstalled(const std::string& root, const std::vector<const ConfigFile*>& installed, const std::set<std::string>& removed);
+    /// Mark every trigger that path matches to run. The path is relative to the install root, with or without
+    /// a leading slash.
+    void match(const std::string& path);
+    bool empty() const { return triggers.empty(); }
+    /// Whether any trigger has matched
+    bool pending() const { return matched != 0; }
+    /// Run every trigger that matched once, chrooted into root, in the order they were added.
+    void run(const std::string& root);
+
+private:
+    void addTrigger(const std::string& package_name, const std::string& name, const std::string& value);
+
+    struct Trigger {
+        std::string name;
+        std::string command;
+        std::vector<std::string> patterns;
+        bool matched = false;
+    };
+    std::vector<Trigger> triggers;
+    size_t matched = 0;
+};
+
+#endif //BVPM_TRIGGERS_H
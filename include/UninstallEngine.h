@@ -9,6 +9,8 @@
 class UninstallEngine {
 public:
     UninstallEngine(std::string root) : dependencyEngine(root), install_root(root) { }
+    /// Start from an already loaded package database
+    UninstallEngine(std::string root, const DependencyEngine& loaded) : dependencyEngine(loaded), install_root(root) { }
     bool AddToList(std::string name, bool ignore_deps);
     bool GetUserPermission();
     bool Execute();
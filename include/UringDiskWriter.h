@@ -0,0 +1,103 @@
+#ifndef BVPM_URINGDISKWRITER_H
+#define BVPM_URINGDISKWRITER_H
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <ctime>
+#include <sys/types.h>
+#include <DiskWriter.h>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+/// A disk writer that batches its system calls through io_uring.
+/// A regular file is read from the archive into memory and handed to the kernel as one linked chain:
+/// open a temporary name next to the file (into a fixed file slot), fallocate it if it is large, write it,
+/// close it and rename it over the real name. Many chains are in flight at once, and one io_uring_enter()
+/// submits them all. Folders are opened once and kept open, so that every open and rename is relative to a
+/// cached folder fd. io_uring has no utimes or chmod, so times (and permissions the umask took away) are set
+/// in one batch at the end. Files too large to buffer, and stored members of uncompressed packages, are written
+/// directly (see DiskWriter::writeDirect).
+/// Anything but a regular file goes to the libarchive writer.
+/// Needs Linux 5.17 or newer; available() is false if the kernel (or a seccomp filter) does not allow it.
+class UringDiskWriter : public DiskWriter {
+public:
+    UringDiskWriter();
+    ~UringDiskWriter() override;
+    UringDiskWriter(const UringDiskWriter&) = delete;
+    UringDiskWriter& operator=(const UringDiskWriter&) = delete;
+
+    bool available() const { return ring_fd >= 0; }
+    bool writeEntry(struct archive* a, struct archive_entry* entry) override;
+    bool finish() override;
+
+private:
+    /// One file on its way to the disk; its index is also its fixed file slot
+    struct Chain {
+        bool in_use = false;
+        unsigned pending = 0;
+        int error = 0;
+        int dirfd = -1;
+        std::string base;
+        std::string temporary;
+        std::string path;
+        std::unique_ptr<char[]> data;
+        size_t size = 0;
+        mode_t mode = 0;
+        struct timespec times[2]{};
+    };
+    /// Times and permissions to set once the file is in place
+    struct Metadata {
+        int dirfd;
+        std::string base;
+        mode_t mode;
+        struct timespec times[2];
+    };
+
+    bool setup();
+    void teardown();
+    io_uring_sqe* getSqe();
+    /// Submit everything queued, and wait for at least min_complete completions
+    bool submit(unsigned min_complete);
+    void reap();
+    void complete(Chain& chain);
+    /// Wait until nothing is in flight anymore
+    void drain();
+    void applyMetadata();
+    /// \return A cached fd of the folder, which is created if it does not exist; -1 on errors
+    int directory(const std::string& path);
+    bool readData(struct archive* a, struct archive_entry* entry, char* data, size_t size);
+    void addMetadata(int dirfd, const std::string& base, mode_t mode, const struct timespec times[2]);
+
+    int ring_fd = -1;
+    unsigned sq_entries = 0;
+    unsigned* sq_head = nullptr;
+    unsigned* sq_tail = nullptr;
+    unsigned* sq_mask = nullptr;
+    unsigned* sq_array = nullptr;
+    unsigned* cq_head = nullptr;
+    unsigned* cq_tail = nullptr;
+    unsigned* cq_mask = nullptr;
+    io_uring_sqe* sqes = nullptr;
+    io_uring_cqe* cqes = nullptr;
+    void* sq_ring = nullptr;
+    size_t sq_ring_size = 0;
+    void* cq_ring = nullptr;
+    size_t cq_ring_size = 0;
+    size_t sqes_size = 0;
+    unsigned queued = 0;
+
+    std::vector<Chain> chains;
+    size_t chains_in_use = 0;
+    size_t bytes_in_flight = 0;
+    unsigned long temporary_counter = 0;
+
+    std::unordered_map<std::string, int> directories;
+    std::vector<Metadata> metadata;
+    LibarchiveDiskWriter fallback;
+    bool failed = false;
+};
+
+#endif //BVPM_URINGDISKWRITER_H
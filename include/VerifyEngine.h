@@ -0,0 +1,60 @@
+#ifndef BVPM_VERIFYENGINE_H
+#define BVPM_VERIFYENGINE_H
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <config.h>
+#include <QueryEngine.h>
+
+/// Answers --verify: checks installed files against the sums file their package was installed with.
+/// Files are hashed on a thread pool. The digest of every file is cached in CACHE_DIR/verify.cache together with
+/// the size, times and inode the file had, so that later runs only hash the files that were changed since.
+///
+/// A file is modified if its digest differs, and missing if it is gone. Extra files are files that no package
+/// owns, in folders that only this package installs files into; folders like /usr/bin that are shared with other
+/// packages are not searched for extra files, as there is no telling which package they would belong to.
+class VerifyEngine {
+public:
+    VerifyEngine(std::string root, const ConfigFile& config, QueryEngine::Format _format, std::ostream& _out);
+
+    /// Verify the packages, or every installed package if packages is empty.
+    /// \return The number of packages that have problems or are not installed.
+    int Verify(const std::vector<std::string>& packages);
+
+private:
+    /// A file's digest, and what the file looked like when it was computed
+    struct CacheEntry {
+        uint64_t size = 0;
+        int64_t mtime = 0;
+        int64_t ctime = 0;
+        uint64_t inode = 0;
+        std::string digest;
+    };
+    /// One file from a sums file
+    struct Check {
+        size_t package;
+        std::string path;
+        std::string expected;
+        enum Result { Ok, Modified, Missing } result = Ok;
+        bool hashed = false;
+        bool cached = false;
+        CacheEntry entry;
+    };
+
+    void loadCache();
+    void saveCache(const std::vector<Check>& checks);
+    /// Check one file; called on the worker threads, which only read the cache
+    void runCheck(Check& check) const;
+
+    std::string install_root;
+    std::string cache_file;
+    QueryEngine::Format format;
+    std::ostream& out;
+    unsigned threads;
+    std::unordered_map<std::string, CacheEntry> cache;
+};
+
+#endif //BVPM_VERIFYENGINE_H
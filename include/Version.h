@@ -0,0 +1,16 @@
+#ifndef BVPM_VERSION_H
+#define BVPM_VERSION_H
+
+#include <string_view>
+
+/// Ordering of package versions, the way dpkg orders them: an optional numeric epoch ("2:"), then runs of digits
+/// compared as numbers and runs of anything else compared character by character, where letters sort before
+/// other characters, and "~" sorts before everything, even the end of the version. So 1.10 > 1.9, 1.0 == 1.00,
+/// 1.0a > 1.0, and 1.0~rc1 < 1.0. Versions without an epoch have epoch 0.
+class Version {
+public:
+    /// \return Less than, equal to or greater than zero if a is older than, the same as or newer than b.
+    static int compare(std::string_view a, std::string_view b);
+};
+
+#endif //BVPM_VERSION_H
@@ -0,0 +1,48 @@
+#ifndef BVPM_ZSTDDICTIONARY_H
+#define BVPM_ZSTDDICTIONARY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+typedef struct ZSTD_CCtx_s ZSTD_CCtx;
+typedef struct ZSTD_CDict_s ZSTD_CDict;
+typedef struct ZSTD_DDict_s ZSTD_DDict;
+
+/// The zstd dictionaries packages can be compressed with. A repository keeps them in dictionaries/<ID>.zdict, and a
+/// package names the one it needs with the dictionary ID in its zstd frame header, so nothing else has to record it.
+/// Every dictionary is loaded at most once per process, the first time a package needs it, and kept from then on.
+class ZstdDictionaries {
+public:
+    /// Look for dictionaries in folder too, after the folders that were added before it.
+    static void addFolder(const std::string& folder);
+    /// \return The dictionary with this ID, or nullptr if none of the folders has a valid one.
+    static const ZSTD_DDict* find(uint32_t id);
+    /// \return The ID of the dictionary the zstd frame at the start of data needs; 0 if it needs none, or data does
+    /// not start with a zstd frame.
+    static uint32_t frameDictionaryID(const void* data, size_t size);
+    /// \return The ID of a trained dictionary; 0 if it is not one.
+    static uint32_t dictionaryID(const std::string& dictionary);
+    /// Train a dictionary of at most capacity bytes on samples.
+    /// \return The dictionary; "" if it could not be trained, and the error has been printed.
+    static std::string train(const std::vector<std::string>& samples, size_t capacity);
+};
+
+/// Compresses data into single zstd frames, with a dictionary that is digested once for all of them.
+class ZstdCompressor {
+public:
+    /// With dictionary "", the frames are compressed without one.
+    ZstdCompressor(const std::string& dictionary, int level);
+    ~ZstdCompressor();
+    ZstdCompressor(const ZstdCompressor&) = delete;
+    ZstdCompressor& operator=(const ZstdCompressor&) = delete;
+
+    /// \return If false, the error has been printed.
+    bool compress(const std::string& data, std::string& out);
+private:
+    ZSTD_CCtx* context;
+    ZSTD_CDict* dictionary = nullptr;
+};
+
+#endif //BVPM_ZSTDDICTIONARY_H
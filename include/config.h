@@ -2,6 +2,7 @@
 #define CONFIG_HPP
 // Things for config files
 #include <string>
+#include <string_view>
 #include <map>
 #include <fstream>
 
@@ -14,7 +15,7 @@ public:
 class Config {
 public:
 	static ConfigFile readConfigFile(std::string file);
-    static ConfigFile readFromData(char* data);
+    static ConfigFile readFromData(std::string_view data);
     static ConfigFile readFromStream(std::istream& stream);
 };
 #endif
@@ -3,11 +3,46 @@
 #include <InstallEngine.h>
 #include <UninstallEngine.h>
 #include <DependencyEngine.h>
+#include <QueryEngine.h>
+#include <VerifyEngine.h>
 #include <config.h>
 #include <debug.h>
+#include <Stats.h>
+#include <Daemon.h>
+#include <FileLock.h>
+#include <filesystem>
+#include <thread>
 #include "LocalFolderRepository.h"
 #include "RepositoryEngine.h"
+#include <RepositoryQueryEngine.h>
 
+static std::string stats_format;
+/// The scratch root of an --image build that we made ourselves, and remove again on exit
+static std::string scratch_root;
+
+static void removeScratchRoot() {
+    std::error_code ec;
+    std::filesystem::remove_all(scratch_root, ec);
+}
+
+static void printStats() {
+    if(stats_format == "json") {
+        Stats::printJSON(std::cerr);
+    } else {
+        Stats::printTable(std::cerr);
+    }
+}
+
+/// If --stats was passed, print the counters on exit, however we end up exiting
+static void setupStats(args::ImplicitValueFlag<std::string>& stats_arg) {
+    if(!stats_arg) { return; }
+    stats_format = stats_arg.Get();
+    if(stats_format != "table" && stats_format != "json") {
+        std::cerr << "Unknown stats format " << stats_format << ", expected table or json" << std::endl;
+        exit(1);
+    }
+    atexit(printStats);
+}
 
 int main_bvpm_repo(int argc, char** argv) {
     args::ArgumentParser parser("BVPM is a simple package manager. It can install, uninstall, and query the version number of packages.", "This is the repo manager. Use it to add, remove, or update packages to a BVPM repository.");
@@ -15,13 +50,31 @@ int main_bvpm_repo(int argc, char** argv) {
     args::Group flag_group(parser, "You must choose one of these:", args::Group::Validators::Xor);
     args::Flag add(flag_group, "add", "Add package file to repo", {'a', "add"});
     args::Flag remove(flag_group, "remove", "Remove package from repo", {'r', "remove"});
-    args::Flag query(flag_group, "query", "Query packages in repo", {'q', "query"});
+    args::Flag query(flag_group, "query", "Show the packages in repo", {'q', "query"});
+    args::Flag train_dictionary(flag_group, "train-dictionary", "Train a zstd dictionary on the small packages in repo, and compress them again with it", {"train-dictionary"});
+
+    args::Group only_for_query(parser, "Only for -q:", args::Group::Validators::DontCare);
+    args::Flag query_all(only_for_query, "query-all", "List all packages", {"query-all"});
+    args::Flag search(only_for_query, "search", "Treat the packages as glob patterns; a pattern without wildcards is a prefix", {"search"});
+    args::Flag rdeps(only_for_query, "rdeps", "List the packages in the repository that depend on the packages", {"rdeps"});
+    args::ValueFlag<std::string> format_arg(only_for_query, "format", "Output format: text, tsv or json", {"format"}, "text");
 
     args::ValueFlag<std::string> repository_arg(parser, "repository", "Path to repository folder", {'r', "repository"}, args::Options::Required);
-    args::PositionalList<std::string> packages(parser, "packages", "Packages/Package files", args::Options::Required);
+    args::PositionalList<std::string> packages(parser, "packages", "Packages/Package files");
+    args::ImplicitValueFlag<std::string> stats_arg(parser, "stats", "Print execution statistics to stderr on exit (table or json)", {"stats"}, "table", "");
+    args::ValueFlag<unsigned> jobs_arg(parser, "jobs", "Number of package files to read at the same time with --add and --train-dictionary (default: one per CPU)", {'j', "jobs"});
+    args::Flag hardlink_arg(parser, "hardlink", "With --add, store package files as hard links to the originals if they can not be reflinked. The originals must not be changed afterwards", {"hardlink"});
+    args::ValueFlag<size_t> max_package_size_arg(parser, "max-package-size", "With --train-dictionary, the largest package file in bytes to train on and compress again", {"max-package-size"}, 128 * 1024);
+    args::ValueFlag<size_t> dictionary_size_arg(parser, "dictionary-size", "With --train-dictionary, the largest dictionary in bytes to train", {"dictionary-size"}, 112640);
+    args::ValueFlag<int> level_arg(parser, "level", "With --train-dictionary, the zstd level to compress the packages at", {"level"}, 19);
 
     try {
         parser.ParseCLI(argc, argv);
+        if(packages->empty() && !query_all && !train_dictionary) {
+            std::cerr << "Failed parsing arguments: missing packages list!\n";
+            std::cout << parser;
+            exit(1);
+        }
     } catch(args::Help&) {
         std::cout << parser;
         exit(0);
@@ -33,7 +86,7 @@ int main_bvpm_repo(int argc, char** argv) {
         std::string error;
         if(std::string(e.what()) == "Group validation failed somewhere!") {
             // Hacky workaround to give a decent error message
-            error = "You must pass -a, -r or -q";
+            error = "You must pass -a, -r, -q or --train-dictionary";
         } else {
             error = e.what();
         }
@@ -42,24 +95,49 @@ int main_bvpm_repo(int argc, char** argv) {
         exit(1);
     }
 
+    setupStats(stats_arg);
+
     const std::string& repository = repository_arg.Get();
     PRINT_DEBUG("repository path: " << repository << std::endl);
 
-    LocalFolderRepository repo("repository", repository);
+    if(query) {
+        QueryEngine::Format format;
+        if(!QueryEngine::parseFormat(format_arg.Get(), format)) {
+            std::cerr << "Unknown format " << format_arg.Get() << ", expected text, tsv or json" << std::endl;
+            exit(1);
+        }
+        if((query_all ? 1 : 0) + (search ? 1 : 0) + (rdeps ? 1 : 0) > 1) {
+            std::cerr << "Failed validating arguments: --query-all, --search and --rdeps can not be combined" << std::endl;
+            exit(1);
+        }
+        // Queries are answered from repo.query alone; the repository itself is only opened if that has to be written
+        RepositoryQueryIndex query_index;
+        if(!LocalFolderRepository::openQueryIndex(repository, query_index)) {
+            std::cerr << "error reading repository " << repository << std::endl;
+            exit(1);
+        }
+        RepositoryQueryEngine queryEngine(query_index, format, std::cout);
+        if(query_all) { return queryEngine.List(); }
+        if(search) { return queryEngine.Search(packages.Get()); }
+        if(rdeps) { return queryEngine.ReverseDependencies(packages.Get()); }
+        return queryEngine.Show(packages.Get());
+    }
+
+    LocalFolderRepository repo("repository", repository, true);
 
     if(add.Get()) {
-        for(const std::string& package : packages) {
-            std::cout << "Adding package file " << package << " to repository" << std::endl;
-            repo.addPackageFileToRepository(package);
-        }
+        // All package files are read in parallel, and the index is written once at the end
+        unsigned jobs = jobs_arg ? jobs_arg.Get() : std::thread::hardware_concurrency();
+        std::cout << "Adding " << packages.Get().size() << " package file(s) to repository" << std::endl;
+        if(!repo.addPackageFilesToRepository(packages.Get(), jobs, hardlink_arg.Get())) { return 1; }
     } else if(remove.Get()) {
         for(const std::string& package : packages) {
             std::cout << "Removing package " << package << " from repository" << std::endl;
             repo.removePackageFromRepository(package);
         }
-    } else if(query.Get()) {
-        std::cerr << "TODO" << std::endl;
-        exit(-1);
+    } else if(train_dictionary.Get()) {
+        unsigned jobs = jobs_arg ? jobs_arg.Get() : std::thread::hardware_concurrency();
+        if(!repo.trainDictionary(max_package_size_arg.Get(), dictionary_size_arg.Get(), level_arg.Get(), jobs)) { return 1; }
     }
 
     return 0;
@@ -70,6 +148,15 @@ int main(int argc, char** argv) {
     if(argc && std::string(argv[0]) == "bvpm-repo") {
         return main_bvpm_repo(argc, argv);
     }
+    // Running as bvpmd is the same as bvpm --daemon
+    std::vector<char*> daemon_argv;
+    if(argc && std::filesystem::path(argv[0]).filename() == "bvpmd") {
+        daemon_argv.assign(argv, argv + argc);
+        daemon_argv.push_back((char*)"--daemon");
+        daemon_argv.push_back(nullptr);
+        argc++;
+        argv = daemon_argv.data();
+    }
 
     args::ArgumentParser parser("BVPM is a simple package manager. It can install, uninstall, and query the version number of packages.", "To install a package, do: bvpm -i PACKAGE_FILE");
     args::HelpFlag help(parser, "help", "Display this help menu", { 'h', "help" });
@@ -77,21 +164,34 @@ int main(int argc, char** argv) {
     args::Group flag_group(parser, "You must choose one of these:", args::Group::Validators::Xor);
     args::Flag install(flag_group, "install", "Install packages", {'i', "install"});
     args::Flag uninstall(flag_group, "uninstall", "Uninstall packages", {'u', "uninstall"});
+    args::Flag upgrade_all(flag_group, "upgrade-all", "Upgrade every installed package the repositories have a newer version of, in one transaction", {"upgrade-all"});
     args::Flag query(flag_group, "query", "Query package versions", {'q', "query"});
+    args::Flag verify(flag_group, "verify", "Check the installed files of packages (all of them if none are given) against their sums", {"verify"});
+    args::ValueFlag<std::string> apply_plan(flag_group, "apply-plan", "Install the packages of a plan written with --write-plan, without resolving dependencies", {"apply-plan"});
+    args::Flag daemon(flag_group, "daemon", "Run as bvpmd, serving requests from other bvpm invocations over a Unix socket", {"daemon"});
 
     args::Group only_for_query(parser, "Only for -q:", args::Group::Validators::DontCare);
     args::Flag query_all(only_for_query, "query-all", "List all packages", {"query-all"}, false);
+    args::Flag search(only_for_query, "search", "Treat the packages as glob patterns; a pattern without wildcards is a prefix", {"search"});
+    args::Flag available(only_for_query, "available", "With --search or --query-all, also list the packages in the repositories", {"available"});
+    args::Flag list_files(only_for_query, "list-files", "List the files owned by the packages", {"list-files"});
+    args::Flag owns(only_for_query, "owns", "Find the packages owning the given paths", {"owns"});
+    args::ValueFlag<std::string> format_arg(only_for_query, "format", "Output format: text, tsv or json (also for --verify)", {"format"}, "text");
 
     args::Flag dont_ask_for_permission(parser, "yes", "Skip asking for permission to perform actions", {'y', "yes"});
     args::Flag assume_inputs_are_files(parser, "files", "Assume that packages to install point directly to bvp files", {"files"});
     args::Flag ignore_dependencies(parser, "ignore-dependencies", "Do not account for dependencies", {"ignore-dependencies"});
     args::ValueFlag<std::string> install_root_arg(parser, "install-root", "Root folder to install to", {"install-root"}, "/");
     args::ValueFlag<std::string> config_file_arg(parser, "config-file", "Path to BVPM config file", {"config-file"}, "/etc/bvpm/bvpm.cfg");
+    args::ValueFlag<std::string> write_plan_arg(parser, "write-plan", "With -i or --upgrade-all, resolve the install and write it to this plan file instead of installing it", {"write-plan"});
+    args::ValueFlag<std::string> image_arg(parser, "image", "With -i, write the packages into this image archive instead of installing them. The extension picks the format: .tar, .tar.gz, .tar.zst, .cpio, .iso, ... The install root, a fresh temporary folder by default, is where after install scripts run", {"image"});
+    args::Flag no_daemon(parser, "no-daemon", "Do not hand the request to bvpmd, even if it is running", {"no-daemon"});
     args::PositionalList<std::string> packages(parser, "packages", "Packages to install");
+    args::ImplicitValueFlag<std::string> stats_arg(parser, "stats", "Print execution statistics to stderr on exit (table or json)", {"stats"}, "table", "");
 
     try {
         parser.ParseCLI(argc, argv);
-        if(packages->empty() && !query_all) {
+        if(packages->empty() && !query_all && !daemon && !verify && !apply_plan && !upgrade_all) {
             std::cerr << "Failed parsing arguments: missing packages list!\n";
             std::cout << parser;
             exit(1);
@@ -107,7 +207,7 @@ int main(int argc, char** argv) {
         std::string error;
         if(std::string(e.what()) == "Group validation failed somewhere!") {
             // Hacky workaround to give a decent error message
-            error = "You must pass -i, -u or -q";
+            error = "You must pass -i, -u, -q, --verify, --upgrade-all, --apply-plan or --daemon";
         } else {
             error = e.what();
         }
@@ -116,7 +216,46 @@ int main(int argc, char** argv) {
         exit(1);
     }
 
-    const std::string& install_root = install_root_arg.Get();
+    setupStats(stats_arg);
+
+    QueryEngine::Format format;
+    if(!QueryEngine::parseFormat(format_arg.Get(), format)) {
+        std::cerr << "Unknown format " << format_arg.Get() << ", expected text, tsv or json" << std::endl;
+        exit(1);
+    }
+    if((search ? 1 : 0) + (list_files ? 1 : 0) + (owns ? 1 : 0) > 1) {
+        std::cerr << "Failed validating arguments: --search, --list-files and --owns can not be combined" << std::endl;
+        exit(1);
+    }
+
+    if(write_plan_arg && !install && !upgrade_all) {
+        std::cerr << "Failed validating arguments: --write-plan only works with -i and --upgrade-all" << std::endl;
+        exit(1);
+    }
+    if(upgrade_all && !packages->empty()) {
+        std::cerr << "Failed validating arguments: --upgrade-all takes no packages" << std::endl;
+        exit(1);
+    }
+    std::string install_root = install_root_arg.Get();
+    if(image_arg) {
+        if(!install && !apply_plan) {
+            std::cerr << "Failed validating arguments: --image only works with -i and --apply-plan" << std::endl;
+            exit(1);
+        }
+        // The image holds the packages and nothing else, so they are resolved against an empty root
+        std::error_code ec;
+        if(!install_root_arg) {
+            std::string tmpl = (std::filesystem::temp_directory_path() / "bvpm-image-XXXXXX").generic_string();
+            if(!mkdtemp(tmpl.data())) { perror("failed to create the scratch root"); exit(1); }
+            install_root = scratch_root = tmpl;
+            atexit(removeScratchRoot);
+        } else if(std::filesystem::exists(install_root, ec) && !std::filesystem::is_empty(install_root, ec)) {
+            std::cerr << "The scratch root " << install_root << " for --image has to be empty" << std::endl;
+            exit(1);
+        } else {
+            std::filesystem::create_directories(install_root, ec);
+        }
+    }
     const std::string& config_file = config_file_arg.Get();
     // Attempt to read config file
     // The config file is always read from the install root
@@ -128,9 +267,57 @@ int main(int argc, char** argv) {
 
     // Check arguments
     PRINT_DEBUG("install root: " << install_root << std::endl);
-    if(install) {
+    const std::string socket_path = Daemon::defaultSocketPath(install_root, config);
+    if(daemon) {
+        Daemon bvpmd(install_root, config, std::filesystem::absolute(config_file).lexically_normal().generic_string(), socket_path);
+        return bvpmd.run();
+    }
+
+    // If bvpmd is running, we let it do the work, as it already has everything loaded.
+    // It can not ask for permission, so transactions only go through it with -y.
+    if(!no_daemon && !stats_arg && !image_arg && !write_plan_arg) {
+        std::vector<std::string> request;
+        if(query) {
+            // Only plain queries go to the daemon; the rest is cheap enough to answer here
+            if(!search && !available && !list_files && !owns && format == QueryEngine::Format::Text) {
+                request.emplace_back(query_all ? "query-all" : "query");
+            }
+        } else if(dont_ask_for_permission && (install || uninstall)) {
+            request.emplace_back(install ? "install" : "uninstall");
+            if(install && assume_inputs_are_files) { request.emplace_back("--files"); }
+            if(ignore_dependencies) { request.emplace_back("--ignore-dependencies"); }
+        }
+        if(!request.empty()) {
+            request.push_back("--config-file=" + std::filesystem::absolute(config_file).lexically_normal().generic_string());
+            for(const std::string& package : packages) {
+                // The daemon has a different working directory
+                bool is_local_file = install && assume_inputs_are_files && package.find("://") == std::string::npos;
+                request.push_back(is_local_file ? std::filesystem::absolute(package).generic_string() : package);
+            }
+            int exit_code;
+            if(Daemon::sendRequest(socket_path, request, exit_code)) { return exit_code; }
+        }
+    }
+
+    // Transactions on a root keep out everything else on it, queries only keep out transactions. A shared lock that
+    // can not be taken (say, on a read-only root) is not needed either, as nobody can change the root then.
+    FileLock root_lock;
+    const bool changes_root = ((install || upgrade_all) && !write_plan_arg) || uninstall || apply_plan;
+    if(!root_lock.lock(FileLock::rootLockPath(install_root), changes_root ? FileLock::Mode::Exclusive : FileLock::Mode::Shared,
+                       "install root " + install_root) && changes_root) {
+        perror(("error locking install root " + install_root).c_str());
+        exit(-1);
+    }
+
+    if(install || upgrade_all) {
         InstallEngine installEngine(install_root, config);
-        if(assume_inputs_are_files.Get()) {
+        if(image_arg) { installEngine.SetImage(std::filesystem::absolute(image_arg.Get()).generic_string()); }
+        if(upgrade_all) {
+            if(installEngine.AddUpgrades() == 0) {
+                std::cout << "All packages are up to date" << std::endl;
+                return 0;
+            }
+        } else if(assume_inputs_are_files.Get()) {
             for (const std::string& package: packages) {
                 if (!installEngine.AddPackageFile(std::string(package))) {
                     exit(-1);
@@ -151,6 +338,11 @@ int main(int argc, char** argv) {
             std::cout << "Failed to resolve dependencies during install stage; are there problems with the repositories? Bailing!" << std::endl;
             exit(-1);
         }
+        if(write_plan_arg) {
+            if(!installEngine.WritePlan(write_plan_arg.Get())) { exit(-1); }
+            std::cout << "Wrote plan " << write_plan_arg.Get() << std::endl;
+            return 0;
+        }
         if(!dont_ask_for_permission) {
             if(!installEngine.GetUserPermission()) {
                 std::cout << "Bailing" << std::endl;
@@ -159,7 +351,28 @@ int main(int argc, char** argv) {
         }
         if(installEngine.Execute()) {
             std::cout << "Operations complete" << std::endl;
+        } else if(image_arg) {
+            exit(-1);
+        }
+    } else if(apply_plan) {
+        InstallEngine installEngine(install_root, config);
+        if(image_arg) { installEngine.SetImage(std::filesystem::absolute(image_arg.Get()).generic_string()); }
+        if(!installEngine.LoadPlan(apply_plan.Get())) {
+            std::cout << "Can not apply plan " << apply_plan.Get() << ", bailing" << std::endl;
+            exit(-1);
+        }
+        if(installEngine.empty()) {
+            std::cout << "The plan has nothing to install" << std::endl;
+            return 0;
+        }
+        if(!dont_ask_for_permission) {
+            if(!installEngine.GetUserPermission()) {
+                std::cout << "Bailing" << std::endl;
+                exit(-1);
+            }
         }
+        if(!installEngine.Execute()) { exit(-1); }
+        std::cout << "Operations complete" << std::endl;
     } else if(uninstall) {
         UninstallEngine uninstallEngine(install_root);
         for(const auto& package : packages) {
@@ -180,27 +393,21 @@ int main(int argc, char** argv) {
         uninstallEngine.Execute();
         std::cout << "Operations complete" << std::endl;
     } else if(query) {
-        InstallEngine installEngine(install_root, config);
+        QueryEngine queryEngine(install_root, config, format, std::cout);
         if(query_all) {
-            // Go through all packages
-            for (const auto& package: installEngine.dependencyEngine.installed_packages) {
-                std::cout << package.first << ": " << package.second << std::endl;
-            }
-        } else {
-            // Try to find the package
-            int num_notfound = 0;
-            for (const auto& package: packages) {
-                if (installEngine.dependencyEngine.installed_packages.find(std::string(package)) !=
-                    installEngine.dependencyEngine.installed_packages.end()) {
-                    std::cout << package << ": "
-                              << installEngine.dependencyEngine.installed_packages[std::string(package)] << std::endl;
-                } else {
-                    std::cout << "package " << package << " not installed" << std::endl;
-                    num_notfound++;
-                }
-                return num_notfound;
-            }
+            queryEngine.Search({"*"}, available);
+            return 0;
+        } else if(search) {
+            return queryEngine.Search(packages.Get(), available);
+        } else if(list_files) {
+            return queryEngine.ListFiles(packages.Get());
+        } else if(owns) {
+            return queryEngine.Owns(packages.Get());
         }
+        return queryEngine.Query(packages.Get());
+    } else if(verify) {
+        VerifyEngine verifyEngine(install_root, config, format, std::cout);
+        return verifyEngine.Verify(packages.Get()) ? 1 : 0;
     }
     return 0;
 }